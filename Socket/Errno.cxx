@@ -1,17 +1,15 @@
 #include "Errno.hxx"
 
-#include <sstream>
 #include <string.h>
 
 Errno::Errno(std::string what, int errno_value) throw() :
-	std::runtime_error(what),
+	std::runtime_error(what + ": " + strerror(errno_value)),
 	m_errno(errno_value)
 {
 }
 
 const char* Errno::what() const throw() {
-	std::ostringstream e;
-	e << std::runtime_error::what()
-	  << ": " << strerror(m_errno);
-	return e.str().c_str();
+	// The error string is already appended in the constructor, so the
+	// returned pointer stays valid as long as this object lives
+	return std::runtime_error::what();
 }
@@ -6,36 +6,104 @@
 #include <ifaddrs.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <strings.h>
 #include <sstream>
 
 namespace SockAddr {
 
-bool SockAddr::address_equal(SockAddr const &b) const throw() {
-	if( this->addr_family() != b.addr_family() ) return false;
-	switch( this->addr_family() ) {
-	case AF_INET:
-		return dynamic_cast<Inet4 const *>(this)->address_equal( dynamic_cast<Inet4 const &>(b) );
-	case AF_INET6:
-		return dynamic_cast<Inet6 const *>(this)->address_equal( dynamic_cast<Inet6 const &>(b) );
-	}
+void SockAddr::assign(struct sockaddr_in const &addr) throw() {
+	memset(&m_addr, 0, sizeof(m_addr));
+	struct sockaddr_in *a = reinterpret_cast<struct sockaddr_in*>(&m_addr);
+#ifdef SOCKADDR_HAS_LEN_FIELD
+	a->sin_len = sizeof(*a);
+#endif
+	a->sin_family = AF_INET;
+	a->sin_port = addr.sin_port;
+	a->sin_addr.s_addr = addr.sin_addr.s_addr;
+}
+
+void SockAddr::assign(struct sockaddr_in6 const &addr) throw() {
+	memset(&m_addr, 0, sizeof(m_addr));
+	struct sockaddr_in6 *a = reinterpret_cast<struct sockaddr_in6*>(&m_addr);
+#ifdef SOCKADDR_HAS_LEN_FIELD
+	a->sin6_len = sizeof(*a);
+#endif
+	a->sin6_family = AF_INET6;
+	a->sin6_port = addr.sin6_port;
+	a->sin6_flowinfo = addr.sin6_flowinfo;
+	a->sin6_addr = addr.sin6_addr;
+	a->sin6_scope_id = addr.sin6_scope_id;
+}
+
+SockAddr::SockAddr(struct sockaddr const *addr) throw(std::invalid_argument) {
+	init(addr);
+}
+
+SockAddr::SockAddr(struct sockaddr_storage const *addr) throw(std::invalid_argument) {
+	init( reinterpret_cast<struct sockaddr const*>(addr) );
 }
 
-std::auto_ptr<SockAddr> create(struct sockaddr_storage const *addr) throw(std::invalid_argument) {
+void SockAddr::init(struct sockaddr const *addr) throw(std::invalid_argument) {
 	if( addr == NULL ) throw std::invalid_argument("Empty address");
 
-	switch( addr->ss_family ) {
+	switch( addr->sa_family ) {
 	case AF_INET:
-		return std::auto_ptr<SockAddr>( new Inet4( *reinterpret_cast<const struct sockaddr_in*>(addr) ) );
+		assign( *reinterpret_cast<struct sockaddr_in const*>(addr) );
+		break;
 	case AF_INET6:
-		return std::auto_ptr<SockAddr>( new Inet6( *reinterpret_cast<const struct sockaddr_in6*>(addr) ) );
+		assign( *reinterpret_cast<struct sockaddr_in6 const*>(addr) );
+		break;
 	default:
 		throw(std::invalid_argument("Unknown address family"));
 	}
 }
 
-std::auto_ptr<SockAddr> translate(std::string const &host, unsigned short const port) throw(std::invalid_argument) {
+size_t SockAddr::hash() const throw() {
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	unsigned char const *p;
+	size_t len;
+	in_port_t port;
+	switch( m_addr.ss_family ) {
+	case AF_INET:
+		p = reinterpret_cast<unsigned char const*>(&in4().sin_addr); len = 4; port = in4().sin_port;
+		break;
+	case AF_INET6:
+		p = reinterpret_cast<unsigned char const*>(&in6().sin6_addr); len = 16; port = in6().sin6_port;
+		break;
+	default:
+		return h;
+	}
+	for( size_t i = 0; i < len; i++ ) h = (h ^ p[i]) * 16777619u;
+	h = (h ^ (port & 0xff)) * 16777619u;
+	h = (h ^ (port >> 8)) * 16777619u;
+	h = (h ^ m_addr.ss_family) * 16777619u;
+	return h;
+}
+
+char* SockAddr::format(char *buf, size_t const len) const throw() {
+	char address[INET6_ADDRSTRLEN];
+	void const *a;
+	switch( m_addr.ss_family ) {
+	case AF_INET:  a = &in4().sin_addr; break;
+	case AF_INET6: a = &in6().sin6_addr; break;
+	default:
+		snprintf(buf, len, "[unspecified]");
+		return buf;
+	}
+	if( inet_ntop(m_addr.ss_family, a, address, sizeof(address)) == NULL ) strcpy(address, "?");
+	snprintf(buf, len, "[%s]:%d", address, port_number());
+	return buf;
+}
+
+std::string SockAddr::string() const {
+	char buf[STRLEN];
+	return std::string( format(buf, sizeof(buf)) );
+}
+
+SockAddr translate(std::string const &host, unsigned short const port) throw(std::invalid_argument) {
 	bool looks_like_v4 = ( host.find('.') != std::string::npos );
 	bool looks_like_v6 = ( host.find(':') != std::string::npos );
 	if( ( !looks_like_v4 && !looks_like_v6 ) || ( looks_like_v4 && looks_like_v6 ) ) {
@@ -59,7 +127,7 @@ std::auto_ptr<SockAddr> translate(std::string const &host, unsigned short const
 		}
 		sa.sin_port = htons(port);
 
-		return create(&sa);
+		return SockAddr(sa);
 	} else { // looks_like_v6
 		struct sockaddr_in6 sa;
 		bzero(&sa, sizeof(sa));
@@ -75,11 +143,11 @@ std::auto_ptr<SockAddr> translate(std::string const &host, unsigned short const
 		}
 		sa.sin6_port = htons(port);
 
-		return create(&sa);
+		return SockAddr(sa);
 	}
 }
 
-std::auto_ptr< boost::ptr_vector< SockAddr > > resolve(std::string const &host, std::string const &port, int const family, int const socktype, int const protocol, bool const v4_mapped) {
+std::vector< SockAddr > resolve(std::string const &host, std::string const &port, int const family, int const socktype, int const protocol, bool const v4_mapped) {
 	struct addrinfo hints;
 	hints.ai_family = family;
 	hints.ai_socktype = socktype;
@@ -111,10 +179,9 @@ std::auto_ptr< boost::ptr_vector< SockAddr > > resolve(std::string const &host,
 	}
 
 	struct addrinfo *p = res;
-	std::auto_ptr< boost::ptr_vector< SockAddr > > ret( new boost::ptr_vector< SockAddr> );
+	std::vector< SockAddr > ret;
 	while( p != NULL ) {
-		std::auto_ptr<SockAddr> a( create( reinterpret_cast<sockaddr_storage*>(p->ai_addr) ) );
-		ret->push_back( a.release() );
+		ret.push_back( SockAddr(p->ai_addr) );
 
 		p = p->ai_next;
 	}
@@ -124,96 +191,25 @@ std::auto_ptr< boost::ptr_vector< SockAddr > > resolve(std::string const &host,
 	return ret;
 }
 
-std::auto_ptr< boost::ptr_vector< SockAddr > > getifaddrs() {
-	std::auto_ptr< boost::ptr_vector< SockAddr > > ret( new boost::ptr_vector< SockAddr> );
+std::vector< SockAddr > getifaddrs() {
+	std::vector< SockAddr > ret;
 
 	struct ifaddrs *ifap;
-	int rv = ::getifaddrs(&ifap);
-
-	while( ifap != NULL ) {
-		try {
-			std::auto_ptr<SockAddr> a( create( reinterpret_cast<sockaddr_storage*>(ifap->ifa_addr) ) );
-			ret->push_back( a.release() );
-		} catch( std::invalid_argument &e ) {
-			// Unknown address family, ignore
-		}
-	
-		ifap = ifap->ifa_next;
+	if( ::getifaddrs(&ifap) == -1 ) {
+		throw Errno("Could not getifaddrs()", errno);
 	}
 
-	freeifaddrs(ifap);
-
-	return ret;
-}
-
-Inet4::Inet4(struct sockaddr_in const &addr) throw() {
-	bzero(&m_addr, sizeof(m_addr));
-#ifdef SOCKADDR_HAS_LEN_FIELD
-	m_addr.sin_len = sizeof(m_addr);
-#endif
-	m_addr.sin_family = addr.sin_family;
-	m_addr.sin_port = addr.sin_port;
-	m_addr.sin_addr.s_addr = addr.sin_addr.s_addr;
-}
-
-std::string Inet4::string() const throw(Errno) {
-	std::string a("[");
-	{
-		char address[INET_ADDRSTRLEN];
-		if( inet_ntop(AF_INET, &m_addr.sin_addr, address, sizeof(address)) == NULL ) {
-			throw Errno("Could not convert IPv4 address to text", errno);
+	for( struct ifaddrs *i = ifap; i != NULL; i = i->ifa_next ) {
+		if( i->ifa_addr == NULL ) continue;
+		if( i->ifa_addr->sa_family != AF_INET && i->ifa_addr->sa_family != AF_INET6 ) {
+			continue; // Unknown address family, ignore
 		}
-		a.append(address);
+		ret.push_back( SockAddr(i->ifa_addr) );
 	}
 
-	a.append("]:");
-
-	{
-		char port[6];
-		int rv = snprintf(port, sizeof(port), "%d", ntohs(m_addr.sin_port));
-		assert( rv < (signed)sizeof(port) ); // unsigned shorts are always 5 digits or less
-		if( rv == -1 ) {
-			throw Errno("Could not convert IPv4 address to text", errno);
-		}
-		a.append(port);
-	}
-	return a;
-}
-
-Inet6::Inet6(struct sockaddr_in6 const &addr) throw() {
-	bzero(&m_addr, sizeof(m_addr));
-#ifdef SOCKADDR_HAS_LEN_FIELD
-	m_addr.sin6_len = sizeof(m_addr);
-#endif
-	m_addr.sin6_family = AF_INET6;
-	m_addr.sin6_port = addr.sin6_port;
-	m_addr.sin6_flowinfo = addr.sin6_flowinfo;
-	for( unsigned int i = 0; i < sizeof(addr.sin6_addr.s6_addr); i++) m_addr.sin6_addr.s6_addr[i] = addr.sin6_addr.s6_addr[i];
-	m_addr.sin6_scope_id = addr.sin6_scope_id;
-}
-
-std::string Inet6::string() const throw(std::runtime_error) {
-	std::string a("[");
-	{
-		char address[INET6_ADDRSTRLEN];
-		if( inet_ntop(AF_INET6, &m_addr.sin6_addr, address, sizeof(address)) == NULL ) {
-			throw Errno("Could not convert IPv6 address to text", errno);
-		}
-		a.append(address);
-	}
-
-	a.append("]:");
+	freeifaddrs(ifap);
 
-	{
-		char port[6];
-		int rv = snprintf(port, sizeof(port), "%d", ntohs(m_addr.sin6_port));
-		assert( rv < (signed)sizeof(port) ); // unsigned shorts are always 5 digits or less
-		if( rv == -1 ) {
-			throw Errno("Could not convert IPv6 address to text", errno);
-		}
-		a.append(port);
-	}
-	return a;
+	return ret;
 }
 
 } // namespace
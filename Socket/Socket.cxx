@@ -37,43 +37,50 @@ Socket Socket::accept(int const socket, struct sockaddr *address, socklen_t *add
 	return Socket(s);
 }
 
-Socket Socket::accept(std::auto_ptr<SockAddr::SockAddr> *client_address) throw(Errno) {
+Socket Socket::accept(SockAddr::SockAddr *client_address) throw(Errno) {
 	struct sockaddr_storage a;
 	socklen_t a_len = sizeof(a);
 	Socket s( accept(m_socket, reinterpret_cast<sockaddr*>(&a), &a_len) );
 	if( client_address != NULL ) {
-		*client_address = SockAddr::create(&a);
+		*client_address = SockAddr::SockAddr(&a);
 	}
 	return s;
 }
 
-std::auto_ptr<SockAddr::SockAddr> Socket::getsockname() const throw(Errno) {
+SockAddr::SockAddr Socket::getsockname() const throw(Errno) {
 	struct sockaddr_storage a;
 	socklen_t a_len = sizeof(a);
 	if( -1 == ::getsockname(m_socket, reinterpret_cast<sockaddr*>(&a), &a_len) ) {
 		throw Errno("Could not getsockname()", errno);
 	}
-	std::auto_ptr<SockAddr::SockAddr> addr( SockAddr::create(&a) );
-	return addr;
+	return SockAddr::SockAddr(&a);
 }
 
-std::auto_ptr<SockAddr::SockAddr> Socket::getpeername() const throw(Errno) {
+SockAddr::SockAddr Socket::getpeername() const throw(Errno) {
 	struct sockaddr_storage a;
 	socklen_t a_len = sizeof(a);
 	if( -1 == ::getpeername(m_socket, reinterpret_cast<sockaddr*>(&a), &a_len) ) {
 		throw Errno("Could not getpeername()", errno);
 	}
-	std::auto_ptr<SockAddr::SockAddr> addr( SockAddr::create(&a) );
-	return addr;
+	return SockAddr::SockAddr(&a);
 }
 
 std::string Socket::recv(size_t const max_length ) throw(Errno) {
-	std::auto_ptr<char> buf( new char[max_length] );
-	ssize_t length = ::recv(m_socket, buf.get(), max_length, 0);
-	if( length == -1 ) {
+	std::string buf(max_length, '\0');
+	ssize_t length = this->try_recv(&buf[0], max_length);
+	if( length < 0 ) {
+		throw Errno("Could not recv()", -length);
+	}
+	buf.resize(length);
+	return buf;
+}
+
+ssize_t Socket::recv(char *data, size_t len) throw(Errno) {
+	ssize_t rv = ::recv(m_socket, data, len, 0);
+	if( rv == -1 ) {
 		throw Errno("Could not recv()", errno);
 	}
-	return std::string(buf.get(), length); // TODO: avoid needless copy of data
+	return rv;
 }
 
 ssize_t Socket::send(char const *data, size_t len) throw(Errno) {
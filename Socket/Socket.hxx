@@ -3,6 +3,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <string>
 
@@ -53,19 +54,61 @@ public:
 	/**
 	 * Accept a new connection on this socket (must be in listening mode)
 	 * The new socket FD is returned
-	 * if client_address is not NULL, the target auto_ptr is reassigned to
-	 * own the SockAddr of the client.
+	 * if client_address is not NULL, it is set to the address of the client.
 	 */
-	Socket accept(std::auto_ptr<SockAddr::SockAddr> *client_address) throw(Errno);
+	Socket accept(SockAddr::SockAddr *client_address) throw(Errno);
 
 	std::string recv(size_t const max_length = 4096) throw(Errno);
+	ssize_t recv(char *data, size_t len) throw(Errno);
 	ssize_t send(char const *data, size_t len) throw(Errno);
 	void send(std::string const &data) throw(Errno,std::runtime_error);
 
+	/**
+	 * Non-throwing I/O on caller-owned buffers, for use on the data path
+	 * These return the number of bytes transferred (0 means EOF for the
+	 * receiving calls), or -errno on failure. Nothing is allocated.
+	 * EAGAIN and EINTR are returned like any other error, it's up to the
+	 * caller to decide what to do with them.
+	 */
+	ssize_t try_recv(void *data, size_t len, int flags = 0) throw() {
+		ssize_t rv = ::recv(m_socket, data, len, flags);
+		return rv == -1 ? -errno : rv;
+	}
+	ssize_t try_send(void const *data, size_t len, int flags = 0) throw() {
+		ssize_t rv = ::send(m_socket, data, len, flags);
+		return rv == -1 ? -errno : rv;
+	}
+	ssize_t try_readv(struct iovec const *iov, int iovcnt) throw() {
+		ssize_t rv = ::readv(m_socket, iov, iovcnt);
+		return rv == -1 ? -errno : rv;
+	}
+	ssize_t try_writev(struct iovec const *iov, int iovcnt) throw() {
+		ssize_t rv = ::writev(m_socket, iov, iovcnt);
+		return rv == -1 ? -errno : rv;
+	}
+
+	/**
+	 * Non-throwing accept4(): returns the FD of the new connection, or -errno
+	 * The new socket is non-blocking and close-on-exec by default.
+	 */
+	int try_accept(struct sockaddr_storage *client_address, int const flags = SOCK_NONBLOCK | SOCK_CLOEXEC) throw() {
+		socklen_t a_len = sizeof(*client_address);
+		int rv = ::accept4(m_socket, reinterpret_cast<struct sockaddr*>(client_address), &a_len, flags);
+		return rv == -1 ? -errno : rv;
+	}
+
+	/**
+	 * Is this (negated) error code a temporary condition, after which the
+	 * call should simply be retried later?
+	 */
+	static bool is_transient_error(ssize_t const error) throw() {
+		return error == -EAGAIN || error == -EWOULDBLOCK || error == -EINTR;
+	}
+
 	void shutdown(int how) throw(Errno);
 
-	std::auto_ptr<SockAddr::SockAddr> getsockname() const throw(Errno);
-	std::auto_ptr<SockAddr::SockAddr> getpeername() const throw(Errno);
+	SockAddr::SockAddr getsockname() const throw(Errno);
+	SockAddr::SockAddr getpeername() const throw(Errno);
 
 	/**
 	 * {set,get}sockopt calls
@@ -78,6 +121,11 @@ public:
 		return this->setsockopt(SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
 	}
 
+	void set_reuseport(bool state = true) throw(Errno) {
+		int optval = state;
+		return this->setsockopt(SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
+	}
+
 	int getsockopt_so_error() throw(Errno) {
 		int error;
 		socklen_t error_len = sizeof(error);
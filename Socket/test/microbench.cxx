@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+#include "../Socket.hxx"
+#include "../../src/LocalAddresses.hxx"
+
+/*
+ * Microbenchmarks of the per-connection primitives of the Socket library
+ * Reports the time and the number of heap allocations per operation.
+ * Run with an optional factor to scale the number of iterations.
+ */
+
+static unsigned long allocations = 0;
+
+#ifdef __GLIBC__
+/*
+ * Count every heap allocation, operator new's included, by putting glibc's
+ * allocator behind our own malloc(). Replacing operator new and delete
+ * instead trips GCC's -Wmismatched-new-delete and -Wsized-deallocation.
+ * Other C libraries have no __libc_malloc(), there the count is "n/a".
+ */
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void *p, size_t size);
+void __libc_free(void *p);
+
+void* malloc(size_t size) throw() { allocations++; return __libc_malloc(size); }
+void* calloc(size_t n, size_t size) throw() { allocations++; return __libc_calloc(n, size); }
+void* realloc(void *p, size_t size) throw() { allocations++; return __libc_realloc(p, size); }
+void free(void *p) throw() { __libc_free(p); }
+}
+#endif
+
+static volatile unsigned long sink; // keeps results from being optimized away
+
+static double now() throw() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(char const *name, void (*fn)(unsigned long), unsigned long const n) {
+	fn(n / 100 + 1); // warm up
+	unsigned long a = allocations;
+	double start = now();
+	fn(n);
+	double elapsed = now() - start;
+	a = allocations - a;
+#ifdef __GLIBC__
+	printf("%-32s %12.1f %12.2f\n", name, elapsed * 1e9 / n, (double)a / n);
+#else
+	printf("%-32s %12.1f %12s\n", name, elapsed * 1e9 / n, "n/a");
+#endif
+}
+
+
+static struct sockaddr_storage sa4, sa6;
+static SockAddr::SockAddr addr4, addr4b, addr6, addr6b;
+static SockAddr::SockAddr dest_ours, dest_other, dest_local;
+
+static void setup_addresses() {
+	addr4 = SockAddr::translate("192.0.2.1", 41234);
+	addr4b = SockAddr::translate("192.0.2.2", 41234);
+	addr6 = SockAddr::translate("2001:db8::1", 41234);
+	addr6b = SockAddr::translate("2001:db8::2", 41234);
+	dest_ours = SockAddr::translate("192.0.2.1", 5000);
+	dest_other = SockAddr::translate("192.0.2.2", 5000);
+	dest_local = SockAddr::translate("127.0.0.1", 5000);
+	memcpy(&sa4, static_cast<struct sockaddr const*>(addr4), addr4.addr_len());
+	memcpy(&sa6, static_cast<struct sockaddr const*>(addr6), addr6.addr_len());
+}
+
+static void construct_v4(unsigned long n) {
+	for( unsigned long i = 0; i < n; i++ ) {
+		SockAddr::SockAddr a(&sa4);
+		sink += a.port_number();
+	}
+}
+static void construct_v6(unsigned long n) {
+	for( unsigned long i = 0; i < n; i++ ) {
+		SockAddr::SockAddr a(&sa6);
+		sink += a.port_number();
+	}
+}
+static void string_v4(unsigned long n) {
+	for( unsigned long i = 0; i < n; i++ ) sink += addr4.string().size();
+}
+static void string_v6(unsigned long n) {
+	for( unsigned long i = 0; i < n; i++ ) sink += addr6.string().size();
+}
+static void format_v4(unsigned long n) {
+	char buf[SockAddr::SockAddr::STRLEN];
+	for( unsigned long i = 0; i < n; i++ ) sink += addr4.format(buf, sizeof(buf))[1];
+}
+static void format_v6(unsigned long n) {
+	char buf[SockAddr::SockAddr::STRLEN];
+	for( unsigned long i = 0; i < n; i++ ) sink += addr6.format(buf, sizeof(buf))[1];
+}
+static void address_equal_v4(unsigned long n) {
+	for( unsigned long i = 0; i < n; i++ ) sink += addr4.address_equal( (i & 1) ? addr4 : addr4b );
+}
+static void address_equal_v6(unsigned long n) {
+	for( unsigned long i = 0; i < n; i++ ) sink += addr6.address_equal( (i & 1) ? addr6 : addr6b );
+}
+static void hash_v6(unsigned long n) {
+	for( unsigned long i = 0; i < n; i++ ) sink += addr6.hash();
+}
+
+/**
+ * tcp-intercept's check for connections directly to itself, listening on
+ * one fixed address, and on the wildcard address (with a lookup in the local
+ * addresses); half of the destinations match
+ */
+static std::vector<SockAddr::SockAddr> listen_fixed, listen_any;
+static LocalAddresses *local_addrs;
+static void our_sockaddr_fixed(unsigned long n) {
+	for( unsigned long i = 0; i < n; i++ ) {
+		sink += our_sockaddr(listen_fixed, NULL, (i & 1) ? dest_ours : dest_other);
+	}
+}
+static void our_sockaddr_any(unsigned long n) {
+	for( unsigned long i = 0; i < n; i++ ) {
+		sink += our_sockaddr(listen_any, local_addrs, (i & 1) ? dest_local : dest_other);
+	}
+}
+static void local_addresses_contains_v6(unsigned long n) {
+	for( unsigned long i = 0; i < n; i++ ) sink += local_addrs->contains(addr6);
+}
+
+static Socket *pair_a, *pair_b;
+static void send_recv(unsigned long n) {
+	char buf[64];
+	memset(buf, 'x', sizeof(buf));
+	for( unsigned long i = 0; i < n; i++ ) {
+		pair_a->send(buf, sizeof(buf));
+		sink += pair_b->recv(buf, sizeof(buf));
+	}
+}
+static void try_send_recv(unsigned long n) {
+	char buf[64];
+	memset(buf, 'x', sizeof(buf));
+	for( unsigned long i = 0; i < n; i++ ) {
+		pair_a->try_send(buf, sizeof(buf));
+		sink += pair_b->try_recv(buf, sizeof(buf));
+	}
+}
+static void send_recv_string(unsigned long n) {
+	std::string msg(64, 'x');
+	for( unsigned long i = 0; i < n; i++ ) {
+		pair_a->send(msg);
+		sink += pair_b->recv(64).size();
+	}
+}
+
+/**
+ * The Socket side of setting up and tearing down an intercepted connection:
+ * accept it, look at both addresses, set options, and close
+ */
+static Socket *s_listen;
+static SockAddr::SockAddr listen_bound;
+static void connection_setup(unsigned long n) {
+	for( unsigned long i = 0; i < n; i++ ) {
+		Socket c( Socket::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0) );
+		c.connect(listen_bound);
+
+		SockAddr::SockAddr client;
+		Socket s( s_listen->accept(&client) );
+		SockAddr::SockAddr server = s.getsockname();
+		int val = 1;
+		s.setsockopt(IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+		sink += client.port_number() + server.port_number();
+	}
+}
+
+int main(int argc, char *argv[]) {
+	double factor = argc > 1 ? atof(argv[1]) : 1;
+	if( factor <= 0 ) factor = 1;
+	unsigned long const n = 1000000 * factor;
+
+	setup_addresses();
+	listen_fixed.push_back(dest_ours);
+	listen_any.push_back( SockAddr::translate("0.0.0.0", 5000) );
+	try {
+		local_addrs = new LocalAddresses;
+	} catch( Errno &e ) {
+		fprintf(stderr, "Could not read the local addresses: %s\n", e.what());
+		return 1;
+	}
+
+	int sv[2];
+	if( socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0 ) {
+		perror("socketpair");
+		return 1;
+	}
+	pair_a = new Socket(sv[0]);
+	pair_b = new Socket(sv[1]);
+
+	s_listen = new Socket( Socket::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0) );
+	s_listen->bind( SockAddr::translate("127.0.0.1", 0) );
+	s_listen->listen(128);
+	listen_bound = s_listen->getsockname();
+
+	printf("%-32s %12s %12s\n", "", "ns/op", "allocs/op");
+	run("SockAddr(sockaddr_in)", construct_v4, n);
+	run("SockAddr(sockaddr_in6)", construct_v6, n);
+	run("SockAddr::string() IPv4", string_v4, n);
+	run("SockAddr::string() IPv6", string_v6, n);
+	run("SockAddr::format() IPv4", format_v4, n);
+	run("SockAddr::format() IPv6", format_v6, n);
+	run("SockAddr::address_equal() IPv4", address_equal_v4, n);
+	run("SockAddr::address_equal() IPv6", address_equal_v6, n);
+	run("SockAddr::hash() IPv6", hash_v6, n);
+	run("our_sockaddr(), fixed address", our_sockaddr_fixed, n);
+	run("our_sockaddr(), wildcard address", our_sockaddr_any, n);
+	run("LocalAddresses::contains() IPv6", local_addresses_contains_v6, n);
+	run("Socket::send()/recv() 64B", send_recv, n / 10);
+	run("Socket::try_send()/try_recv() 64B", try_send_recv, n / 10);
+	run("Socket::send()/recv() std::string", send_recv_string, n / 10);
+	run("connection setup/teardown", connection_setup, n / 100);
+
+	delete s_listen;
+	delete pair_a;
+	delete pair_b;
+	delete local_addrs;
+	return 0;
+}
@@ -0,0 +1,130 @@
+#include "../config.h"
+#include "AsyncLog.hxx"
+
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <libsimplelog.h>
+
+#include "gettext.h"
+#define _(String) gettext(String)
+
+int log_level = LEVEL_INFO;
+
+void ConnectionId::set(struct sockaddr const *client, struct sockaddr const *server) throw() {
+	family = client->sa_family;
+	if( family == AF_INET6 ) {
+		struct sockaddr_in6 const *c = reinterpret_cast<struct sockaddr_in6 const*>(client);
+		struct sockaddr_in6 const *s = reinterpret_cast<struct sockaddr_in6 const*>(server);
+		memcpy(client_addr, &c->sin6_addr, 16);
+		memcpy(server_addr, &s->sin6_addr, 16);
+		client_port = c->sin6_port;
+		server_port = s->sin6_port;
+	} else {
+		struct sockaddr_in const *c = reinterpret_cast<struct sockaddr_in const*>(client);
+		struct sockaddr_in const *s = reinterpret_cast<struct sockaddr_in const*>(server);
+		memcpy(client_addr, &c->sin_addr, 4);
+		memcpy(server_addr, &s->sin_addr, 4);
+		client_port = c->sin_port;
+		server_port = s->sin_port;
+	}
+}
+
+void ConnectionId::format(char *buf, size_t const len) const throw() {
+	char c[INET6_ADDRSTRLEN], s[INET6_ADDRSTRLEN];
+	if( inet_ntop(family, client_addr, c, sizeof(c)) == NULL ) strcpy(c, "?");
+	if( inet_ntop(family, server_addr, s, sizeof(s)) == NULL ) strcpy(s, "?");
+	snprintf(buf, len, "[%s]:%u-->[%s]:%u", c, ntohs(client_port), s, ntohs(server_port));
+}
+
+
+bool AsyncLog::Ring::push(int const level, char const *format, ConnectionId const &id,
+                          char const *arg1, char const *arg2, unsigned int const translate) throw() {
+	Record *r = reserve();
+	if( r == NULL ) return false;
+	r->level = level;
+	r->format = format;
+	r->id = id;
+	strncpy(r->args[0], arg1, sizeof(r->args[0]) - 1);
+	r->args[0][sizeof(r->args[0]) - 1] = '\0';
+	strncpy(r->args[1], arg2, sizeof(r->args[1]) - 1);
+	r->args[1][sizeof(r->args[1]) - 1] = '\0';
+	r->translate = translate;
+	publish();
+	return true;
+}
+
+
+AsyncLog::AsyncLog(unsigned int const producers, unsigned int const ring_size)
+	: m_running(false), m_stop(false) {
+	for( unsigned int i = 0; i < producers; i++ ) {
+		m_rings.push_back( new Ring(ring_size) );
+	}
+}
+
+AsyncLog::~AsyncLog() throw() {
+	stop();
+	for( typeof(m_rings.begin()) i = m_rings.begin(); i != m_rings.end(); ++i ) {
+		delete *i;
+	}
+}
+
+void AsyncLog::start() throw(Errno) {
+	int rv = pthread_create(&m_thread, NULL, thread_main, this);
+	if( rv != 0 ) throw Errno("Could not start log thread", rv);
+	m_running = true;
+}
+
+void AsyncLog::stop() throw() {
+	if( ! m_running ) return;
+	__atomic_store_n(&m_stop, true, __ATOMIC_RELEASE);
+	pthread_join(m_thread, NULL);
+	m_running = false;
+}
+
+void* AsyncLog::thread_main(void *arg) {
+	AsyncLog *log = reinterpret_cast<AsyncLog*>(arg);
+	while( true ) {
+		// Read the flag first: after a drain() that came up empty, the
+		// producers are done for good
+		bool stop = __atomic_load_n(&log->m_stop, __ATOMIC_ACQUIRE);
+		if( log->drain() ) continue;
+		if( stop ) break;
+		usleep(10000); // Batch up the messages of the next 10ms
+	}
+	return NULL;
+}
+
+bool AsyncLog::drain() throw() {
+	bool any = false;
+	for( typeof(m_rings.begin()) i = m_rings.begin(); i != m_rings.end(); ++i ) {
+		Ring *ring = *i;
+		for( Record const *r; (r = ring->front()) != NULL; ring->pop() ) {
+			write(*r);
+			any = true;
+		}
+
+		unsigned long dropped = ring->dropped();
+		if( dropped > 0 ) {
+			/* TRANSLATORS: %1$lu contains the number of log messages that
+			   were lost because they came in too fast */
+			LogWarn(_("Log can't keep up, dropped %1$lu messages"), dropped);
+		}
+	}
+	return any;
+}
+
+void AsyncLog::write(Record const &r) throw() {
+	char id[CONNECTION_ID_STRLEN];
+	r.id.format(id, sizeof(id));
+	char const *format = _(r.format);
+	char const *arg1 = (r.translate & TRANSLATE_ARG1) && r.args[0][0] != '\0' ? _(r.args[0]) : r.args[0];
+	char const *arg2 = (r.translate & TRANSLATE_ARG2) && r.args[1][0] != '\0' ? _(r.args[1]) : r.args[1];
+	switch( r.level ) {
+	case LEVEL_DEBUG: LogDebug(format, id, arg1, arg2); break;
+	case LEVEL_INFO:  LogInfo(format, id, arg1, arg2); break;
+	case LEVEL_WARN:  LogWarn(format, id, arg1, arg2); break;
+	default:          LogError(format, id, arg1, arg2); break;
+	}
+}
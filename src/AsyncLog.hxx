@@ -0,0 +1,105 @@
+#ifndef __ASYNCLOG_HXX__
+#define __ASYNCLOG_HXX__
+
+#include <vector>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "../Socket/Errno.hxx"
+#include "SpscRing.hxx"
+
+/**
+ * Binary identification of a connection: client and server address and port
+ * Filling it in is a few copies; it is only turned into text when a message
+ * about the connection is actually written.
+ */
+struct ConnectionId {
+	sa_family_t family;
+	in_port_t client_port, server_port; // network byte order
+	unsigned char client_addr[16], server_addr[16];
+
+	void set(struct sockaddr const *client, struct sockaddr const *server) throw();
+
+	/**
+	 * Format as "[client]:port-->[server]:port"
+	 */
+	void format(char *buf, size_t const len) const throw();
+};
+static const size_t CONNECTION_ID_STRLEN = 2 * (INET6_ADDRSTRLEN + 8) + 3;
+
+enum log_level { LEVEL_DEBUG = 0, LEVEL_INFO, LEVEL_WARN, LEVEL_ERROR };
+
+/**
+ * Messages below this level are dropped before anything is formatted
+ */
+extern int log_level;
+inline bool log_enabled(int const level) throw() { return level >= log_level; }
+
+/**
+ * Messages about connections, written out by a background thread
+ * Every worker has its own single-producer/single-consumer ring, so logging a
+ * message costs a few stores in the worker: no locks, no system calls and no
+ * formatting. The log thread picks the messages up, translates and formats
+ * them, and hands them to libsimplelog.
+ * When a ring is full, messages are dropped (and the drops are reported).
+ */
+class AsyncLog {
+public:
+	// Which args are untranslated messages (N_()) themselves; the others
+	// are written as they are
+	enum { TRANSLATE_ARG1 = 1, TRANSLATE_ARG2 = 2 };
+
+	struct Record {
+		int level;
+		char const *format; // untranslated; %1$s gets the connection ID
+		ConnectionId id;
+		char args[2][120];  // %2$s and %3$s
+		unsigned int translate; // TRANSLATE_ARG1 | TRANSLATE_ARG2
+	};
+
+	class Ring : public SpscRing<Record> {
+	public:
+		/**
+		 * size must be a power of 2
+		 */
+		Ring(unsigned int const size) : SpscRing<Record>(size) {}
+
+		/**
+		 * Queue a message, returns false if it had to be dropped
+		 * translate tells which args to translate as well.
+		 * Only call this from one thread.
+		 */
+		bool push(int const level, char const *format, ConnectionId const &id,
+		          char const *arg1, char const *arg2, unsigned int const translate) throw();
+	};
+
+private:
+	std::vector<Ring*> m_rings;
+	pthread_t m_thread;
+	bool m_running;
+	bool m_stop;
+
+	AsyncLog(AsyncLog const &);
+	AsyncLog & operator =(AsyncLog const &);
+
+	static void* thread_main(void *arg);
+	bool drain() throw();
+	static void write(Record const &r) throw();
+
+public:
+	AsyncLog(unsigned int const producers, unsigned int const ring_size = 1024);
+	~AsyncLog() throw();
+
+	Ring* ring(unsigned int const producer) throw() { return m_rings[producer]; }
+
+	void start() throw(Errno);
+
+	/**
+	 * Write out what is still queued, and stop the log thread
+	 */
+	void stop() throw();
+};
+
+#endif // __ASYNCLOG_HXX__
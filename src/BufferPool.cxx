@@ -0,0 +1,51 @@
+#include "../config.h"
+#include "BufferPool.hxx"
+
+#include <new>
+
+bool MemoryBudget::reserve(size_t const len) throw() {
+	size_t used = __atomic_add_fetch(&m_used, len, __ATOMIC_RELAXED);
+	if( m_limit != 0 && used > m_limit ) {
+		__atomic_sub_fetch(&m_used, len, __ATOMIC_RELAXED);
+		return false;
+	}
+	return true;
+}
+
+void MemoryBudget::release(size_t const len) throw() {
+	__atomic_sub_fetch(&m_used, len, __ATOMIC_RELAXED);
+}
+
+
+BufferPool::~BufferPool() throw() {
+	for( typeof(m_free.begin()) i = m_free.begin(); i != m_free.end(); ++i ) {
+		delete[] *i;
+		m_budget.release(m_buffer_size);
+	}
+}
+
+char* BufferPool::get() throw() {
+	if( ! m_free.empty() ) {
+		char *buf = m_free.back();
+		m_free.pop_back();
+		return buf;
+	}
+	return get(m_buffer_size);
+}
+
+char* BufferPool::get(size_t const size) throw() {
+	if( ! m_budget.reserve(size) ) return NULL;
+	char *buf = new (std::nothrow) char[size];
+	if( buf == NULL ) m_budget.release(size);
+	return buf;
+}
+
+void BufferPool::put(char *buf, size_t const size) throw() {
+	if( buf == NULL ) return;
+	if( size == m_buffer_size && m_free.size() < m_max_free ) {
+		m_free.push_back(buf);
+	} else {
+		delete[] buf;
+		m_budget.release(size);
+	}
+}
@@ -0,0 +1,77 @@
+#ifndef __BUFFERPOOL_HXX__
+#define __BUFFERPOOL_HXX__
+
+#include <vector>
+#include <stddef.h>
+
+/**
+ * Upper limit on the memory used for relay buffers, shared by all workers
+ * Thread-safe: the counter is only touched with atomic operations.
+ */
+class MemoryBudget {
+private:
+	size_t m_limit; // 0 means unlimited
+	size_t m_used;
+
+public:
+	MemoryBudget(size_t const limit = 0) throw() : m_limit(limit), m_used(0) {}
+
+	/**
+	 * Only change the limit before the workers start
+	 */
+	void set_limit(size_t const limit) throw() { m_limit = limit; }
+	size_t limit() const throw() { return m_limit; }
+	size_t used() const throw() { return __atomic_load_n(&m_used, __ATOMIC_RELAXED); }
+
+	/**
+	 * Account for len more bytes. Returns false (and accounts nothing) if
+	 * that would exceed the limit.
+	 */
+	bool reserve(size_t const len) throw();
+	void release(size_t const len) throw();
+};
+
+/**
+ * Per-worker pool of equally sized buffers, charged to a MemoryBudget
+ * Buffers that are put back are kept for reuse (up to max_free of them), so
+ * connections can give back their memory as soon as they have no data in
+ * flight, without hitting the allocator on every burst.
+ * Not thread-safe: use one BufferPool per thread.
+ */
+class BufferPool {
+private:
+	MemoryBudget &m_budget;
+	size_t m_buffer_size;
+	std::vector<char*> m_free;
+	size_t m_max_free;
+
+	BufferPool(BufferPool const &);
+	BufferPool & operator =(BufferPool const &);
+
+public:
+	BufferPool(MemoryBudget &budget, size_t const buffer_size, size_t const max_free = 16) throw()
+		: m_budget(budget), m_buffer_size(buffer_size), m_max_free(max_free) {}
+	~BufferPool() throw();
+
+	size_t buffer_size() const throw() { return m_buffer_size; }
+
+	/**
+	 * Get a buffer of buffer_size() bytes
+	 * Returns NULL if the budget is exhausted.
+	 */
+	char* get() throw();
+
+	/**
+	 * Get a buffer of size bytes, for data that doesn't fit in buffer_size()
+	 * It is not kept for reuse when it is put back.
+	 * Returns NULL if the budget is exhausted.
+	 */
+	char* get(size_t const size) throw();
+
+	/**
+	 * Return a buffer of size bytes, NULL is ignored
+	 */
+	void put(char *buf, size_t const size) throw();
+};
+
+#endif // __BUFFERPOOL_HXX__
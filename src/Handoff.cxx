@@ -0,0 +1,203 @@
+#include "../config.h"
+#include "Handoff.hxx"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+Handoff::Handoff(int const fd) throw(Errno) : m_socket(fd) {
+	int flags = fcntl(fd, F_GETFL);
+	if( flags == -1 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == -1
+	    || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1 ) {
+		throw Errno("Could not set up the handoff socket", errno);
+	}
+}
+
+void Handoff::set_timeout(unsigned int const timeout) throw(Errno) {
+	struct timeval tv;
+	tv.tv_sec = timeout;
+	tv.tv_usec = 0;
+	m_socket.setsockopt(SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	m_socket.setsockopt(SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * Write all of iov, resuming after short writes
+ */
+static void write_all(int const fd, struct iovec *iov, int iovcnt) throw(Errno) {
+	while( iovcnt > 0 ) {
+		if( iov->iov_len == 0 ) {
+			iov++; iovcnt--;
+			continue;
+		}
+		ssize_t rv = writev(fd, iov, iovcnt);
+		if( rv == -1 ) {
+			if( errno == EINTR ) continue;
+			throw Errno("Could not send handoff", errno);
+		}
+		while( iovcnt > 0 && (size_t)rv >= iov->iov_len ) {
+			rv -= iov->iov_len;
+			iov++; iovcnt--;
+		}
+		if( iovcnt > 0 ) {
+			iov->iov_base = static_cast<char*>(iov->iov_base) + rv;
+			iov->iov_len -= rv;
+		}
+	}
+}
+
+/**
+ * Read exactly len bytes; returns false on EOF before the first byte
+ */
+static bool read_all(int const fd, char *buf, size_t len) throw(Errno) {
+	size_t done = 0;
+	while( done < len ) {
+		ssize_t rv = ::recv(fd, buf + done, len - done, MSG_WAITALL);
+		if( rv == -1 ) {
+			if( errno == EINTR ) continue;
+			throw Errno("Could not receive handoff", errno);
+		} else if( rv == 0 ) {
+			if( done == 0 ) return false;
+			throw Errno("Handoff cut short", EPIPE);
+		}
+		done += rv;
+	}
+	return true;
+}
+
+void Handoff::send(Record &r, int const *fds, struct iovec const *iov, int const iovcnt) throw(Errno) {
+	if( r.fds > MAX_FDS ) throw Errno("Too many file descriptors to hand off", EINVAL);
+	r.magic = MAGIC;
+
+	struct iovec header;
+	header.iov_base = &r;
+	header.iov_len = sizeof(r);
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &header;
+	msg.msg_iovlen = 1;
+	std::vector<char> control( CMSG_SPACE(r.fds * sizeof(int)) );
+	if( r.fds > 0 ) {
+		msg.msg_control = &control[0];
+		msg.msg_controllen = control.size();
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(r.fds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, r.fds * sizeof(int));
+	}
+	ssize_t rv;
+	do {
+		rv = sendmsg(m_socket, &msg, MSG_NOSIGNAL);
+	} while( rv == -1 && errno == EINTR );
+	if( rv == -1 ) throw Errno("Could not send handoff", errno);
+	if( rv < (ssize_t)sizeof(r) ) {
+		struct iovec rest;
+		rest.iov_base = reinterpret_cast<char*>(&r) + rv;
+		rest.iov_len = sizeof(r) - rv;
+		write_all(m_socket, &rest, 1);
+	}
+
+	std::vector<struct iovec> payload(iov, iov + iovcnt);
+	if( ! payload.empty() ) write_all(m_socket, &payload[0], payload.size());
+}
+
+void Handoff::send(record_type const type) throw(Errno) {
+	Record r;
+	memset(&r, 0, sizeof(r));
+	r.type = type;
+	send(r, NULL, NULL, 0);
+}
+
+bool Handoff::receive(Record &r, std::vector<int> &fds, std::string &c_to_s, std::string &s_to_c) throw(Errno) {
+	fds.clear();
+	struct iovec header;
+	header.iov_base = &r;
+	header.iov_len = sizeof(r);
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &header;
+	msg.msg_iovlen = 1;
+	std::vector<char> control( CMSG_SPACE(MAX_FDS * sizeof(int)) );
+	msg.msg_control = &control[0];
+	msg.msg_controllen = control.size();
+	ssize_t rv;
+	do {
+		rv = recvmsg(m_socket, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+	} while( rv == -1 && errno == EINTR );
+	if( rv == -1 ) throw Errno("Could not receive handoff", errno);
+	if( rv == 0 ) return false;
+
+	for( struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg) ) {
+		if( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ) continue;
+		size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for( size_t i = 0; i < n; i++ ) {
+			int fd;
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+			fds.push_back(fd);
+		}
+	}
+	if( msg.msg_flags & MSG_CTRUNC ) throw Errno("Handoff file descriptors truncated", EPROTO);
+	if( rv < (ssize_t)sizeof(r)
+	    && ! read_all(m_socket, reinterpret_cast<char*>(&r) + rv, sizeof(r) - rv) ) {
+		throw Errno("Handoff cut short", EPIPE);
+	}
+	if( r.magic != MAGIC ) throw Errno("Handoff from an incompatible version", EPROTO);
+	if( fds.size() != r.fds ) throw Errno("Handoff file descriptors missing", EPROTO);
+
+	c_to_s.resize(r.len_c_to_s);
+	s_to_c.resize(r.len_s_to_c);
+	if( ( r.len_c_to_s > 0 && ! read_all(m_socket, &c_to_s[0], r.len_c_to_s) )
+	    || ( r.len_s_to_c > 0 && ! read_all(m_socket, &s_to_c[0], r.len_s_to_c) ) ) {
+		throw Errno("Handoff cut short", EPIPE);
+	}
+	return true;
+}
+
+void Handoff::send_listeners(std::vector<int> const &listeners, int const *maps) throw(Errno) {
+	std::vector<int> fds(listeners);
+	Record r;
+	// One record can only carry MAX_FDS; the last one has room for the maps
+	size_t sent = 0;
+	while( fds.size() - sent > MAX_FDS - 2 ) {
+		memset(&r, 0, sizeof(r));
+		r.type = LISTENERS;
+		r.flags = MORE;
+		r.fds = MAX_FDS - 2;
+		send(r, &fds[sent], NULL, 0);
+		sent += r.fds;
+	}
+	memset(&r, 0, sizeof(r));
+	r.type = LISTENERS;
+	if( maps != NULL ) {
+		// The connections in it are only relayed as long as the maps exist
+		r.flags = SOCKMAP;
+		fds.push_back( maps[0] );
+		fds.push_back( maps[1] );
+	}
+	r.fds = fds.size() - sent;
+	send(r, r.fds > 0 ? &fds[sent] : NULL, NULL, 0);
+}
+
+void Handoff::receive_listeners(std::vector<int> &listeners, int maps[2]) throw(Errno) {
+	listeners.clear();
+	maps[0] = maps[1] = -1;
+	Record r;
+	std::vector<int> fds;
+	std::string c_to_s, s_to_c;
+	do {
+		if( ! receive(r, fds, c_to_s, s_to_c) || r.type != LISTENERS ) {
+			throw Errno("No listening sockets handed over", EPROTO);
+		}
+		if( (r.flags & SOCKMAP) && fds.size() >= 2 ) {
+			maps[1] = fds.back();
+			fds.pop_back();
+			maps[0] = fds.back();
+			fds.pop_back();
+		}
+		listeners.insert(listeners.end(), fds.begin(), fds.end());
+	} while( r.flags & MORE );
+	if( listeners.empty() ) throw Errno("No listening sockets handed over", EPROTO);
+}
@@ -0,0 +1,112 @@
+#ifndef __HANDOFF_HXX__
+#define __HANDOFF_HXX__
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "../Socket/Socket.hxx"
+
+/**
+ * Channel over which a running tcp-intercept hands its listening sockets and
+ * established connections to a newly started one, on a hitless upgrade
+ * Runs over one end of a UNIX stream socketpair; the file descriptors travel
+ * with SCM_RIGHTS, attached to the record header. Data buffered in the
+ * old process follows the header as payload.
+ *
+ * The conversation goes:
+ *   old -> new: LISTENERS (the listening sockets, and the sockmap's maps),
+ *               as many as it takes to stay within MAX_FDS each
+ *   new -> old: READY     (set up, anything that can fail has been done)
+ *   old -> new: CONNECTION, for every connection (s_client, s_server)
+ *   old -> new: END
+ * Both sides block; neither does anything else in the mean time.
+ */
+class Handoff {
+public:
+	enum record_type {
+		LISTENERS = 1,
+		READY,
+		CONNECTION,
+		END
+	};
+	// flags of a CONNECTION
+	enum {
+		C_TO_S_OPEN = 1, // no EOF seen from the client yet
+		S_TO_C_OPEN = 2,
+		CONNECTED = 4,   // else the connect() to the server is still in progress
+		SOCKMAP = 8,     // relayed by the sockmap (on LISTENERS: the last two
+		                 // fds are its maps, targets and sockets)
+		C_TO_S_DRAINING = 16, // SOCKMAP: EOF seen, the FIN is not passed on yet
+		S_TO_C_DRAINING = 32,
+		C_TO_S_PAUSED = 64,     // SOCKMAP: the receiving socket is out of the map
+		S_TO_C_PAUSED = 128,
+		C_TO_S_USERSPACE = 256, // SOCKMAP: this direction is relayed as usual
+		S_TO_C_USERSPACE = 512,
+		MORE = 1024      // on LISTENERS: another LISTENERS record follows
+	};
+
+	struct Record {
+		uint32_t magic;
+		uint32_t type;
+		uint32_t flags;
+		uint32_t fds;        // attached file descriptors
+		uint32_t len_c_to_s; // payload: data not yet sent to the server,
+		uint32_t len_s_to_c; // followed by the data not yet sent to the client
+		uint64_t sent_offset_c_to_s; // SOCKMAP: what the sockets counted as sent
+		uint64_t sent_offset_s_to_c; // before the sockmap took over
+		uint64_t paused_at_c_to_s;   // SOCKMAP: what the receiving socket had
+		uint64_t paused_at_s_to_c;   // received when it was paused
+	};
+	static const uint32_t MAGIC = 0x7463686a; // "tchj", changes with the format
+	static const unsigned int MAX_FDS = 253;  // SCM_MAX_FD
+
+private:
+	Socket m_socket;
+
+	// Not copyable
+	Handoff(Handoff const &);
+	Handoff & operator =(Handoff const &);
+
+public:
+	/**
+	 * Take responsibility of fd, which is made blocking and close-on-exec
+	 */
+	explicit Handoff(int const fd) throw(Errno);
+
+	int fd() throw() { return m_socket; }
+
+	/**
+	 * Give up waiting for the other side after timeout seconds
+	 */
+	void set_timeout(unsigned int const timeout) throw(Errno);
+
+	/**
+	 * Send a record with fds attached, followed by the iovcnt pieces of
+	 * payload in iov. The lengths in r must add up to them; the magic is
+	 * filled in.
+	 */
+	void send(Record &r, int const *fds, struct iovec const *iov, int const iovcnt) throw(Errno);
+	void send(record_type const type) throw(Errno);
+
+	/**
+	 * Receive a record, its file descriptors (close-on-exec) and its payload
+	 * Returns false when the other side closed the channel.
+	 */
+	bool receive(Record &r, std::vector<int> &fds, std::string &c_to_s, std::string &s_to_c) throw(Errno);
+
+	/**
+	 * Send the LISTENERS records: the listening sockets, and the sockmap's
+	 * two maps if maps is not NULL
+	 */
+	void send_listeners(std::vector<int> const &listeners, int const *maps) throw(Errno);
+
+	/**
+	 * Receive what send_listeners() sent. maps is set to -1, -1 when there
+	 * is no sockmap. Throws EPROTO when no listening sockets came.
+	 */
+	void receive_listeners(std::vector<int> &listeners, int maps[2]) throw(Errno);
+};
+
+#endif // __HANDOFF_HXX__
@@ -0,0 +1,280 @@
+#include "../config.h"
+#include "IoUring.hxx"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#if HAVE_LINUX_IO_URING_H
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p) {
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+static int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+static int io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+template<typename T>
+static inline T* ring_ptr(void *ring, __u32 offset) {
+	return reinterpret_cast<T*>( reinterpret_cast<char*>(ring) + offset );
+}
+
+IoUring::IoUring(unsigned int const entries) throw(Errno)
+	: m_sq_ring(MAP_FAILED), m_cq_ring(MAP_FAILED), m_sqes(reinterpret_cast<struct io_uring_sqe*>(MAP_FAILED)) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CLAMP;
+	m_fd = io_uring_setup(entries, &p);
+	if( m_fd == -1 ) {
+		throw Errno("Could not io_uring_setup()", errno);
+	}
+	m_features = p.features;
+
+	m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if( m_features & IORING_FEAT_SINGLE_MMAP ) {
+		if( m_cq_ring_size > m_sq_ring_size ) m_sq_ring_size = m_cq_ring_size;
+	}
+	m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                 m_fd, IORING_OFF_SQ_RING);
+	if( m_sq_ring == MAP_FAILED ) {
+		int e = errno;
+		close(m_fd);
+		throw Errno("Could not mmap() io_uring", e);
+	}
+	if( m_features & IORING_FEAT_SINGLE_MMAP ) {
+		m_cq_ring = m_sq_ring;
+	} else {
+		m_cq_ring = mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		                 m_fd, IORING_OFF_CQ_RING);
+	}
+	m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	m_sqes = reinterpret_cast<struct io_uring_sqe*>(
+		mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES) );
+	if( m_cq_ring == MAP_FAILED || m_sqes == MAP_FAILED ) {
+		int e = errno;
+		unmap();
+		throw Errno("Could not mmap() io_uring", e);
+	}
+
+	m_sq_head = ring_ptr<unsigned>(m_sq_ring, p.sq_off.head);
+	m_sq_tail = ring_ptr<unsigned>(m_sq_ring, p.sq_off.tail);
+	m_sq_mask = *ring_ptr<unsigned>(m_sq_ring, p.sq_off.ring_mask);
+	m_sq_entries = *ring_ptr<unsigned>(m_sq_ring, p.sq_off.ring_entries);
+	m_sqe_tail = *m_sq_tail;
+	// SQE i always lives in slot i
+	unsigned *sq_array = ring_ptr<unsigned>(m_sq_ring, p.sq_off.array);
+	for( unsigned i = 0; i < m_sq_entries; i++ ) sq_array[i] = i;
+
+	m_cq_head = ring_ptr<unsigned>(m_cq_ring, p.cq_off.head);
+	m_cq_tail = ring_ptr<unsigned>(m_cq_ring, p.cq_off.tail);
+	m_cq_mask = *ring_ptr<unsigned>(m_cq_ring, p.cq_off.ring_mask);
+	m_cqes = ring_ptr<struct io_uring_cqe>(m_cq_ring, p.cq_off.cqes);
+}
+
+void IoUring::unmap() throw() {
+	if( m_sqes != MAP_FAILED ) munmap(m_sqes, m_sqes_size);
+	if( m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring ) munmap(m_cq_ring, m_cq_ring_size);
+	if( m_sq_ring != MAP_FAILED ) munmap(m_sq_ring, m_sq_ring_size);
+	close(m_fd);
+}
+
+IoUring::~IoUring() throw() {
+	unmap();
+}
+
+struct io_uring_sqe* IoUring::get_sqe() throw() {
+	unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+	if( m_sqe_tail - head >= m_sq_entries ) return NULL;
+	struct io_uring_sqe *sqe = &m_sqes[ m_sqe_tail & m_sq_mask ];
+	m_sqe_tail++;
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+unsigned int IoUring::sq_space() const throw() {
+	return m_sq_entries - ( m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) );
+}
+
+unsigned int IoUring::unsubmitted() const throw() {
+	return m_sqe_tail - *m_sq_tail;
+}
+
+int IoUring::submit() throw() {
+	unsigned tail = *m_sq_tail;
+	unsigned to_submit = m_sqe_tail - tail;
+	if( to_submit == 0 ) return 0;
+	__atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+	int rv = io_uring_enter(m_fd, to_submit, 0, 0);
+	return rv == -1 ? -errno : rv;
+}
+
+struct io_uring_cqe* IoUring::peek_cqe() throw() {
+	unsigned head = *m_cq_head;
+	if( head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE) ) return NULL;
+	return &m_cqes[ head & m_cq_mask ];
+}
+
+void IoUring::cqe_seen() throw() {
+	__atomic_store_n(m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE);
+}
+
+void IoUring::register_eventfd(int const efd) throw(Errno) {
+	int fd = efd;
+	if( io_uring_register(m_fd, IORING_REGISTER_EVENTFD, &fd, 1) == -1 ) {
+		throw Errno("Could not register eventfd with io_uring", errno);
+	}
+}
+
+int IoUring::register_raw(unsigned int const opcode, void *arg, unsigned int const nr_args) throw() {
+	int rv = io_uring_register(m_fd, opcode, arg, nr_args);
+	return rv == -1 ? -errno : rv;
+}
+
+void IoUring::prep_rw(struct io_uring_sqe *sqe, int const op, int const fd,
+                      void const *addr, unsigned int const len, __u64 const offset) throw() {
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->off = offset;
+	sqe->addr = reinterpret_cast<unsigned long>(addr);
+	sqe->len = len;
+}
+
+void IoUring::prep_accept_multishot(struct io_uring_sqe *sqe, int const fd, int const flags) throw() {
+	prep_rw(sqe, IORING_OP_ACCEPT, fd, NULL, 0, 0);
+	sqe->accept_flags = flags;
+	sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+}
+
+void IoUring::prep_connect(struct io_uring_sqe *sqe, int const fd,
+                           struct sockaddr const *addr, socklen_t const addr_len) throw() {
+	prep_rw(sqe, IORING_OP_CONNECT, fd, addr, 0, addr_len);
+}
+
+void IoUring::prep_recv_select(struct io_uring_sqe *sqe, int const fd,
+                               unsigned int const len, unsigned short const buf_group) throw() {
+	prep_rw(sqe, IORING_OP_RECV, fd, NULL, len, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = buf_group;
+}
+
+void IoUring::prep_send(struct io_uring_sqe *sqe, int const fd,
+                        void const *buf, unsigned int const len, int const flags) throw() {
+	prep_rw(sqe, IORING_OP_SEND, fd, buf, len, 0);
+	sqe->msg_flags = flags;
+}
+
+void IoUring::prep_poll(struct io_uring_sqe *sqe, int const fd, unsigned int const events) throw() {
+	prep_rw(sqe, IORING_OP_POLL_ADD, fd, NULL, 0, 0);
+	sqe->poll32_events = events;
+}
+
+void IoUring::prep_splice(struct io_uring_sqe *sqe, int const fd_in, int const fd_out,
+                          unsigned int const len, unsigned int const flags) throw() {
+	prep_rw(sqe, IORING_OP_SPLICE, fd_out, NULL, len, (__u64)-1);
+	sqe->splice_off_in = (__u64)-1;
+	sqe->splice_fd_in = fd_in;
+	sqe->splice_flags = flags;
+}
+
+void IoUring::prep_close(struct io_uring_sqe *sqe, int const fd) throw() {
+	prep_rw(sqe, IORING_OP_CLOSE, fd, NULL, 0, 0);
+}
+
+void IoUring::prep_cancel_fd(struct io_uring_sqe *sqe, int const fd) throw() {
+	prep_rw(sqe, IORING_OP_ASYNC_CANCEL, fd, NULL, 0, 0);
+	sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+}
+
+
+ProvidedBuffers::ProvidedBuffers(IoUring &ring, unsigned short const group,
+                                 unsigned int const entries, size_t const buffer_size) throw(Errno)
+	: m_ring(ring), m_group(group), m_entries(entries), m_buffer_size(buffer_size), m_tail(0) {
+	void *bufs;
+	int rv = posix_memalign(&bufs, sysconf(_SC_PAGESIZE), entries * sizeof(struct io_uring_buf));
+	if( rv != 0 ) throw Errno("Could not allocate buffer ring", rv);
+	m_bufs = reinterpret_cast<struct io_uring_buf*>(bufs);
+	memset(m_bufs, 0, entries * sizeof(struct io_uring_buf));
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = reinterpret_cast<unsigned long>(m_bufs);
+	reg.ring_entries = entries;
+	reg.bgid = group;
+	rv = m_ring.register_raw(IORING_REGISTER_PBUF_RING, &reg, 1);
+	if( rv < 0 ) {
+		free(m_bufs);
+		throw Errno("Could not register buffer ring", -rv);
+	}
+
+	m_memory = new char[entries * buffer_size];
+	for( unsigned int i = 0; i < entries; i++ ) {
+		recycle(i);
+	}
+}
+
+ProvidedBuffers::~ProvidedBuffers() throw() {
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.bgid = m_group;
+	m_ring.register_raw(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+	free(m_bufs);
+	delete[] m_memory;
+}
+
+void ProvidedBuffers::recycle(unsigned short const id) throw() {
+	struct io_uring_buf *b = &m_bufs[ m_tail & (m_entries - 1) ];
+	b->addr = reinterpret_cast<unsigned long>( buffer(id) );
+	b->len = m_buffer_size;
+	b->bid = id;
+	m_tail++;
+	// The tail overlays the resv field of the first entry
+	__atomic_store_n(&m_bufs[0].resv, m_tail, __ATOMIC_RELEASE);
+}
+
+#else // ! HAVE_LINUX_IO_URING_H
+
+IoUring::IoUring(unsigned int const entries) throw(Errno) {
+	throw Errno("Built without io_uring support", ENOSYS);
+}
+IoUring::~IoUring() throw() {}
+void IoUring::unmap() throw() {}
+struct io_uring_sqe* IoUring::get_sqe() throw() { return NULL; }
+unsigned int IoUring::sq_space() const throw() { return 0; }
+unsigned int IoUring::unsubmitted() const throw() { return 0; }
+int IoUring::submit() throw() { return -ENOSYS; }
+struct io_uring_cqe* IoUring::peek_cqe() throw() { return NULL; }
+void IoUring::cqe_seen() throw() {}
+void IoUring::register_eventfd(int const efd) throw(Errno) { throw Errno("Built without io_uring support", ENOSYS); }
+int IoUring::register_raw(unsigned int const opcode, void *arg, unsigned int const nr_args) throw() { return -ENOSYS; }
+void IoUring::prep_rw(struct io_uring_sqe *sqe, int const op, int const fd,
+                      void const *addr, unsigned int const len, __u64 const offset) throw() {}
+void IoUring::prep_accept_multishot(struct io_uring_sqe *sqe, int const fd, int const flags) throw() {}
+void IoUring::prep_connect(struct io_uring_sqe *sqe, int const fd,
+                           struct sockaddr const *addr, socklen_t const addr_len) throw() {}
+void IoUring::prep_recv_select(struct io_uring_sqe *sqe, int const fd,
+                               unsigned int const len, unsigned short const buf_group) throw() {}
+void IoUring::prep_send(struct io_uring_sqe *sqe, int const fd,
+                        void const *buf, unsigned int const len, int const flags) throw() {}
+void IoUring::prep_poll(struct io_uring_sqe *sqe, int const fd, unsigned int const events) throw() {}
+void IoUring::prep_splice(struct io_uring_sqe *sqe, int const fd_in, int const fd_out,
+                          unsigned int const len, unsigned int const flags) throw() {}
+void IoUring::prep_close(struct io_uring_sqe *sqe, int const fd) throw() {}
+void IoUring::prep_cancel_fd(struct io_uring_sqe *sqe, int const fd) throw() {}
+
+ProvidedBuffers::ProvidedBuffers(IoUring &ring, unsigned short const group,
+                                 unsigned int const entries, size_t const buffer_size) throw(Errno)
+	: m_ring(ring) {
+	throw Errno("Built without io_uring support", ENOSYS);
+}
+ProvidedBuffers::~ProvidedBuffers() throw() {}
+void ProvidedBuffers::recycle(unsigned short const id) throw() {}
+
+#endif // HAVE_LINUX_IO_URING_H
@@ -0,0 +1,150 @@
+#ifndef __IOURING_HXX__
+#define __IOURING_HXX__
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stddef.h>
+#include <linux/types.h>
+#if HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#else
+/*
+ * Built without (recent enough) io_uring headers: just what the io_uring
+ * engine touches, so it compiles. Creating an IoUring fails with ENOSYS.
+ */
+struct io_uring_sqe { __u8 flags; __u64 user_data; };
+struct io_uring_cqe { __u64 user_data; __s32 res; __u32 flags; };
+struct io_uring_buf;
+#define IOSQE_IO_LINK (1U << 2)
+#define IORING_CQE_F_BUFFER (1U << 0)
+#define IORING_CQE_F_MORE (1U << 1)
+#define IORING_CQE_BUFFER_SHIFT 16
+#endif
+
+#include "../Socket/Errno.hxx"
+
+/**
+ * Thin wrapper around an io_uring instance, using the raw system calls
+ * Submission queue entries are prepared with get_sqe() and the prep_*()
+ * helpers; they are only handed to the kernel by submit(), so many of them
+ * can be batched into a single system call.
+ * Not thread-safe: use one IoUring per thread.
+ */
+class IoUring {
+private:
+	int m_fd;
+	unsigned int m_features;
+
+	void *m_sq_ring;
+	size_t m_sq_ring_size;
+	void *m_cq_ring;
+	size_t m_cq_ring_size;
+	struct io_uring_sqe *m_sqes;
+	size_t m_sqes_size;
+
+	unsigned *m_sq_head, *m_sq_tail, m_sq_mask, m_sq_entries;
+	unsigned m_sqe_tail; // SQEs handed out by get_sqe(), not yet visible to the kernel
+	unsigned *m_cq_head, *m_cq_tail, m_cq_mask;
+	struct io_uring_cqe *m_cqes;
+
+	// Not copyable
+	IoUring(IoUring const &);
+	IoUring & operator =(IoUring const &);
+
+	void unmap() throw();
+
+public:
+	IoUring(unsigned int const entries) throw(Errno);
+	~IoUring() throw();
+
+	int fd() const throw() { return m_fd; }
+	unsigned int features() const throw() { return m_features; }
+
+	/**
+	 * Get a zeroed submission queue entry
+	 * Returns NULL when the submission queue is full, submit() first.
+	 */
+	struct io_uring_sqe* get_sqe() throw();
+
+	/**
+	 * Hand all prepared entries to the kernel
+	 * Returns the number of entries submitted, or -errno.
+	 */
+	int submit() throw();
+	unsigned int unsubmitted() const throw();
+
+	/**
+	 * Number of entries get_sqe() can still hand out before submit() is needed
+	 */
+	unsigned int sq_space() const throw();
+
+	/**
+	 * Get the next completion, or NULL if there is none
+	 * Call cqe_seen() when done with it.
+	 */
+	struct io_uring_cqe* peek_cqe() throw();
+	void cqe_seen() throw();
+
+	/**
+	 * Have the kernel signal this eventfd whenever a completion is posted
+	 */
+	void register_eventfd(int const efd) throw(Errno);
+
+	int register_raw(unsigned int const opcode, void *arg, unsigned int const nr_args) throw();
+
+	/*
+	 * Helpers to fill in submission queue entries
+	 */
+	static void prep_rw(struct io_uring_sqe *sqe, int const op, int const fd,
+	                    void const *addr, unsigned int const len, __u64 const offset) throw();
+	static void prep_accept_multishot(struct io_uring_sqe *sqe, int const fd, int const flags) throw();
+	static void prep_connect(struct io_uring_sqe *sqe, int const fd,
+	                         struct sockaddr const *addr, socklen_t const addr_len) throw();
+	static void prep_recv_select(struct io_uring_sqe *sqe, int const fd,
+	                             unsigned int const len, unsigned short const buf_group) throw();
+	static void prep_send(struct io_uring_sqe *sqe, int const fd,
+	                      void const *buf, unsigned int const len, int const flags) throw();
+	static void prep_poll(struct io_uring_sqe *sqe, int const fd, unsigned int const events) throw();
+	static void prep_splice(struct io_uring_sqe *sqe, int const fd_in, int const fd_out,
+	                        unsigned int const len, unsigned int const flags) throw();
+	static void prep_close(struct io_uring_sqe *sqe, int const fd) throw();
+	static void prep_cancel_fd(struct io_uring_sqe *sqe, int const fd) throw();
+};
+
+
+/**
+ * A ring of buffers provided to the kernel (IORING_REGISTER_PBUF_RING)
+ * Receive operations with IOSQE_BUFFER_SELECT pick a buffer from this group
+ * when data arrives, so idle connections don't tie up any memory. Buffers
+ * must be given back with recycle() once their data is used.
+ */
+class ProvidedBuffers {
+private:
+	IoUring &m_ring;
+	unsigned short m_group;
+	unsigned int m_entries;
+	size_t m_buffer_size;
+
+	struct io_uring_buf *m_bufs; // shared with the kernel
+	char *m_memory;
+	unsigned short m_tail;
+
+	ProvidedBuffers(ProvidedBuffers const &);
+	ProvidedBuffers & operator =(ProvidedBuffers const &);
+
+public:
+	/**
+	 * entries must be a power of 2
+	 */
+	ProvidedBuffers(IoUring &ring, unsigned short const group,
+	                unsigned int const entries, size_t const buffer_size) throw(Errno);
+	~ProvidedBuffers() throw();
+
+	unsigned short group() const throw() { return m_group; }
+	size_t buffer_size() const throw() { return m_buffer_size; }
+	char* buffer(unsigned short const id) const throw() { return m_memory + id * m_buffer_size; }
+
+	void recycle(unsigned short const id) throw();
+};
+
+#endif // __IOURING_HXX__
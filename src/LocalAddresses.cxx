@@ -0,0 +1,165 @@
+#include "../config.h"
+#include "LocalAddresses.hxx"
+
+#include <algorithm>
+#include <errno.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+LocalAddresses::LocalAddresses() throw(Errno) {
+	m_netlink = Socket::socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+
+	struct sockaddr_nl local;
+	memset(&local, 0, sizeof(local));
+	local.nl_family = AF_NETLINK;
+	local.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+	m_netlink.bind(reinterpret_cast<struct sockaddr*>(&local), sizeof(local));
+
+	// Subscribe first, then dump: no change can fall in between
+	dump();
+}
+
+void LocalAddresses::dump() throw(Errno) {
+	// Use a separate socket, so the dump doesn't get mixed with notifications
+	Socket s( Socket::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE) );
+
+	struct {
+		struct nlmsghdr nlh;
+		struct ifaddrmsg ifa;
+	} req;
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifa));
+	req.nlh.nlmsg_type = RTM_GETADDR;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = 1;
+	req.ifa.ifa_family = AF_UNSPEC;
+	ssize_t rv = s.try_send(&req, req.nlh.nlmsg_len);
+	if( rv < 0 ) throw Errno("Could not request address dump", -rv);
+
+	m_addrs.clear();
+
+	char buf[16384];
+	while( true ) {
+		rv = s.try_recv(buf, sizeof(buf));
+		if( rv == -EINTR ) continue;
+		if( rv < 0 ) throw Errno("Could not read address dump", -rv);
+
+		int len = rv;
+		for( struct nlmsghdr *nlh = reinterpret_cast<struct nlmsghdr*>(buf);
+		     NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len) ) {
+			if( nlh->nlmsg_type == NLMSG_DONE ) return;
+			if( nlh->nlmsg_type == NLMSG_ERROR ) {
+				struct nlmsgerr *err = reinterpret_cast<struct nlmsgerr*>( NLMSG_DATA(nlh) );
+				throw Errno("Address dump failed", -err->error);
+			}
+			handle_message(nlh);
+		}
+	}
+}
+
+void LocalAddresses::handle_message(struct nlmsghdr const *nlh) throw() {
+	if( nlh->nlmsg_type != RTM_NEWADDR && nlh->nlmsg_type != RTM_DELADDR ) return;
+
+	struct ifaddrmsg const *ifa = reinterpret_cast<struct ifaddrmsg const*>( NLMSG_DATA(nlh) );
+	size_t addr_len;
+	switch( ifa->ifa_family ) {
+	case AF_INET:  addr_len = 4; break;
+	case AF_INET6: addr_len = 16; break;
+	default: return;
+	}
+
+	// IFA_LOCAL is the local address on point-to-point links, where
+	// IFA_ADDRESS is the peer. IPv6 only sends IFA_ADDRESS.
+	struct rtattr const *local = NULL, *address = NULL;
+	int len = IFA_PAYLOAD(nlh);
+	for( struct rtattr const *rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len) ) {
+		if( rta->rta_type == IFA_LOCAL ) local = rta;
+		if( rta->rta_type == IFA_ADDRESS ) address = rta;
+	}
+	if( local == NULL ) local = address;
+	if( local == NULL || RTA_PAYLOAD(local) < addr_len ) return;
+
+	Key k;
+	memset(&k, 0, sizeof(k));
+	k.family = ifa->ifa_family;
+	memcpy(k.addr, RTA_DATA(local), addr_len);
+	int ifindex = ifa->ifa_index;
+
+	if( nlh->nlmsg_type == RTM_NEWADDR ) {
+		std::vector<int> &ifs = m_addrs[k];
+		if( std::find(ifs.begin(), ifs.end(), ifindex) == ifs.end() ) ifs.push_back(ifindex);
+	} else {
+		typeof(m_addrs.begin()) i = m_addrs.find(k);
+		if( i == m_addrs.end() ) return;
+		i->second.erase( std::remove(i->second.begin(), i->second.end(), ifindex), i->second.end() );
+		if( i->second.empty() ) m_addrs.erase(i);
+	}
+}
+
+void LocalAddresses::process() throw(Errno) {
+	char buf[16384];
+	while( true ) {
+		ssize_t rv = m_netlink.try_recv(buf, sizeof(buf));
+		if( rv == -EAGAIN || rv == -EWOULDBLOCK ) return;
+		if( rv == -EINTR ) continue;
+		if( rv == -ENOBUFS ) {
+			// We missed some updates, start over
+			dump();
+			continue;
+		}
+		if( rv < 0 ) throw Errno("Could not read address updates", -rv);
+
+		int len = rv;
+		for( struct nlmsghdr *nlh = reinterpret_cast<struct nlmsghdr*>(buf);
+		     NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len) ) {
+			handle_message(nlh);
+		}
+	}
+}
+
+bool LocalAddresses::contains(SockAddr::SockAddr const &a) const throw() {
+	struct sockaddr const *sa = a;
+	Key k;
+	memset(&k, 0, sizeof(k));
+	k.family = sa->sa_family;
+	switch( sa->sa_family ) {
+	case AF_INET:
+		memcpy(k.addr, &reinterpret_cast<struct sockaddr_in const*>(sa)->sin_addr, 4);
+		break;
+	case AF_INET6: {
+		struct in6_addr const *a6 = &reinterpret_cast<struct sockaddr_in6 const*>(sa)->sin6_addr;
+		if( IN6_IS_ADDR_V4MAPPED(a6) ) {
+			k.family = AF_INET;
+			memcpy(k.addr, &a6->s6_addr[12], 4);
+		} else {
+			memcpy(k.addr, a6, 16);
+		}
+		break;
+		}
+	default:
+		return false;
+	}
+	return m_addrs.find(k) != m_addrs.end();
+}
+
+bool our_sockaddr(std::vector< SockAddr::SockAddr > const &listen_addrs,
+                  LocalAddresses const *local_addrs,
+                  SockAddr::SockAddr const &destination) throw() {
+	for( typeof(listen_addrs.begin()) i = listen_addrs.begin(); i != listen_addrs.end(); ++i ) {
+		// Begin with quick checks
+		if( destination.port_number() != i->port_number() ) continue;
+
+		if( ! i->is_any() ) {
+			if( destination == *i ) {
+				// We've "intercepted" a connection that was directed to us
+				return true;
+			}
+		} else if( destination.proto_family() == i->proto_family() && local_addrs != NULL ) {
+			// Look it up in the set of local IPs, which is kept up to date
+			// with netlink notifications
+			if( local_addrs->contains(destination) ) return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,68 @@
+#ifndef __LOCALADDRESSES_HXX__
+#define __LOCALADDRESSES_HXX__
+
+#include <vector>
+#include <string.h>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+
+#include "../Socket/Socket.hxx"
+
+/**
+ * The set of IP addresses configured on this host
+ * The set is filled with a netlink dump, and kept up to date by listening for
+ * RTM_NEWADDR/RTM_DELADDR notifications: call process() whenever fd() is
+ * ready for reading. Lookups don't do any syscalls.
+ */
+class LocalAddresses {
+private:
+	struct Key {
+		int family;
+		unsigned char addr[16];
+
+		bool operator ==(Key const &b) const throw() {
+			return family == b.family && memcmp(addr, b.addr, sizeof(addr)) == 0;
+		}
+	};
+	struct KeyHash {
+		size_t operator ()(Key const &k) const throw() {
+			size_t seed = k.family;
+			boost::hash_combine(seed, boost::hash_range(k.addr, k.addr + sizeof(k.addr)));
+			return seed;
+		}
+	};
+
+	Socket m_netlink;
+	// An address can be on multiple interfaces, keep track of their ifindex
+	boost::unordered_map< Key, std::vector<int>, KeyHash > m_addrs;
+
+	void dump() throw(Errno);
+	void handle_message(struct nlmsghdr const *nlh) throw();
+
+public:
+	LocalAddresses() throw(Errno);
+
+	/**
+	 * The netlink socket that receives the updates
+	 */
+	int fd() throw() { return m_netlink; }
+
+	/**
+	 * Read and apply all pending updates
+	 */
+	void process() throw(Errno);
+
+	bool contains(SockAddr::SockAddr const &a) const throw();
+	size_t size() const throw() { return m_addrs.size(); }
+};
+
+/**
+ * Whether destination is one of the addresses we listen on, listen_addrs
+ * A wildcard address in listen_addrs matches every address in local_addrs,
+ * which may be NULL when there are none.
+ */
+bool our_sockaddr(std::vector< SockAddr::SockAddr > const &listen_addrs,
+                  LocalAddresses const *local_addrs,
+                  SockAddr::SockAddr const &destination) throw();
+
+#endif // __LOCALADDRESSES_HXX__
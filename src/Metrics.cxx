@@ -0,0 +1,93 @@
+#include "../config.h"
+#include "Metrics.hxx"
+
+#include <string>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static size_t segment_size(unsigned int const workers) throw() {
+	return sizeof(struct metrics_header) + workers * sizeof(struct worker_metrics);
+}
+
+MetricsSegment::~MetricsSegment() throw() {
+	if( m_mem != NULL ) munmap(m_mem, m_size);
+}
+
+MetricsSegment* MetricsSegment::create(std::string const &filename, unsigned int const workers) throw(Errno) {
+	std::auto_ptr<MetricsSegment> m( new MetricsSegment );
+	m->m_size = segment_size(workers);
+
+	void *mem;
+	if( filename.empty() ) {
+		mem = mmap(NULL, m->m_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	} else {
+		// A new file replaces the old one: a previous instance that is still
+		// handing over (see SIGUSR2) keeps its own mapping intact
+		std::string tmp = filename + ".new";
+		int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if( fd == -1 ) throw Errno("Could not open metrics file", errno);
+		if( ftruncate(fd, m->m_size) == -1 || rename(tmp.c_str(), filename.c_str()) == -1 ) {
+			int e = errno;
+			close(fd);
+			unlink(tmp.c_str());
+			throw Errno("Could not create metrics file", e);
+		}
+		mem = mmap(NULL, m->m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd); // the mapping stays
+	}
+	if( mem == MAP_FAILED ) throw Errno("Could not mmap() metrics", errno);
+	m->m_mem = mem;
+
+	memset(mem, 0, m->m_size); // new mappings are zeroed, but be explicit
+	struct metrics_header *h = m->header();
+	h->version = METRICS_VERSION;
+	h->workers = workers;
+	h->pid = getpid();
+	h->start_time = time(NULL);
+	// The magic goes in last, readers ignore the segment until then
+	__atomic_store_n(&h->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+	return m.release();
+}
+
+MetricsSegment* MetricsSegment::open(std::string const &filename) throw(Errno) {
+	std::auto_ptr<MetricsSegment> m( new MetricsSegment );
+
+	int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if( fd == -1 ) throw Errno("Could not open metrics file", errno);
+	struct stat st;
+	if( fstat(fd, &st) == -1 ) {
+		int e = errno;
+		close(fd);
+		throw Errno("Could not stat metrics file", e);
+	}
+	if( (size_t)st.st_size < sizeof(struct metrics_header) ) {
+		close(fd);
+		throw Errno("Not a metrics file", EINVAL);
+	}
+	m->m_size = st.st_size;
+	m->m_dev = st.st_dev;
+	m->m_ino = st.st_ino;
+	void *mem = mmap(NULL, m->m_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if( mem == MAP_FAILED ) throw Errno("Could not mmap() metrics", errno);
+	m->m_mem = mem;
+
+	struct metrics_header *h = m->header();
+	if( __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != METRICS_MAGIC
+	    || h->version != METRICS_VERSION
+	    || m->m_size < segment_size(h->workers) ) {
+		throw Errno("Not a metrics file", EINVAL);
+	}
+	return m.release();
+}
+
+bool MetricsSegment::replaced(std::string const &filename) const throw() {
+	struct stat st;
+	if( stat(filename.c_str(), &st) == -1 ) return false; // keep what we have
+	return st.st_dev != m_dev || st.st_ino != m_ino;
+}
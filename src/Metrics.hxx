@@ -0,0 +1,149 @@
+#ifndef __METRICS_HXX__
+#define __METRICS_HXX__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <string>
+#include <memory>
+
+#include "../Socket/Errno.hxx"
+
+/*
+ * Counters shared with tcp-intercept-stat through a memory-mapped file
+ * Every worker has its own slot, which only that worker writes to, so
+ * updating a counter is a plain relaxed load and store: no locked instructions
+ * and no cache lines bouncing between cores. Readers load the values with
+ * relaxed atomics as well, and sum over the workers.
+ */
+
+static const uint64_t METRICS_MAGIC = 0x54435049534d4554ULL; // "TCPISMET"
+static const uint32_t METRICS_VERSION = 2;
+
+/*
+ * connect() failures are counted per errno, for the most common ones
+ */
+static const int metrics_connect_errnos[] = {
+	ECONNREFUSED, ETIMEDOUT, EHOSTUNREACH, ENETUNREACH, ECONNRESET, EADDRINUSE, EADDRNOTAVAIL
+};
+static char const * const metrics_connect_errno_names[] = {
+	"ECONNREFUSED", "ETIMEDOUT", "EHOSTUNREACH", "ENETUNREACH", "ECONNRESET", "EADDRINUSE", "EADDRNOTAVAIL",
+	"other"
+};
+static const unsigned int METRICS_CONNECT_ERRNOS =
+	sizeof(metrics_connect_errnos) / sizeof(metrics_connect_errnos[0]) + 1; // + other
+
+inline unsigned int metrics_connect_errno_index(int const e) throw() {
+	unsigned int i;
+	for( i = 0; i < METRICS_CONNECT_ERRNOS - 1; i++ ) {
+		if( metrics_connect_errnos[i] == e ) break;
+	}
+	return i;
+}
+
+/*
+ * Histograms of the TCP_INFO samples (see --tcp-info-interval), per leg
+ * (towards the client, towards the server), with log2 buckets: bucket i holds
+ * the values below 2^i that didn't fit in bucket i-1, the last one holds the
+ * rest.
+ */
+static const unsigned int METRICS_LEGS = 2;
+static char const * const metrics_leg_names[] = { "client", "server" };
+static const unsigned int METRICS_HISTOGRAM_BUCKETS = 48;
+
+inline unsigned int metrics_histogram_bucket(uint64_t const value) throw() {
+	if( value == 0 ) return 0;
+	unsigned int i = 64 - __builtin_clzll(value);
+	return i < METRICS_HISTOGRAM_BUCKETS ? i : METRICS_HISTOGRAM_BUCKETS - 1;
+}
+
+struct metrics_histogram {
+	uint64_t buckets[METRICS_HISTOGRAM_BUCKETS];
+	uint64_t sum;
+};
+
+struct worker_metrics {
+	uint64_t accepted;        // connections accept()ed
+	uint64_t active;          // connections being relayed (gauge)
+	uint64_t closed;
+	uint64_t connect_failed[METRICS_CONNECT_ERRNOS];
+	uint64_t bytes_c_to_s;    // bytes sent to the server
+	uint64_t bytes_s_to_c;    // bytes sent to the client
+	uint64_t buffer_bytes;    // relay buffer memory held by connections (gauge)
+	struct metrics_histogram rtt[METRICS_LEGS];           // microseconds
+	struct metrics_histogram delivery_rate[METRICS_LEGS]; // bytes per second
+	uint64_t retransmits[METRICS_LEGS]; // segments, of closed connections
+} __attribute__((aligned(64)));
+
+struct metrics_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t workers;
+	uint64_t pid;
+	uint64_t start_time;      // time() at startup
+	uint64_t buffer_memory_limit; // 0: unlimited
+	uint64_t buffer_size;
+} __attribute__((aligned(64)));
+
+/**
+ * Add n to a counter that only the calling thread writes to
+ */
+inline void metrics_add(uint64_t &counter, uint64_t const n) throw() {
+	__atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+inline void metrics_sub(uint64_t &counter, uint64_t const n) throw() {
+	__atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) - n, __ATOMIC_RELAXED);
+}
+inline uint64_t metrics_get(uint64_t const &counter) throw() {
+	return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+inline void metrics_observe(struct metrics_histogram &h, uint64_t const value) throw() {
+	metrics_add(h.buckets[ metrics_histogram_bucket(value) ], 1);
+	metrics_add(h.sum, value);
+}
+
+/**
+ * The mapped segment: a header, followed by a slot per worker
+ */
+class MetricsSegment {
+private:
+	void *m_mem;
+	size_t m_size;
+	dev_t m_dev; // of the file it was opened from
+	ino_t m_ino;
+
+	MetricsSegment(MetricsSegment const &);
+	MetricsSegment & operator =(MetricsSegment const &);
+
+	MetricsSegment() throw() : m_mem(NULL), m_size(0), m_dev(0), m_ino(0) {}
+
+public:
+	~MetricsSegment() throw();
+
+	/**
+	 * Create the segment for a daemon with the given number of workers
+	 * With an empty filename, the counters are kept in anonymous memory.
+	 */
+	static MetricsSegment* create(std::string const &filename, unsigned int const workers) throw(Errno);
+
+	/**
+	 * Map an existing segment read-only
+	 */
+	static MetricsSegment* open(std::string const &filename) throw(Errno);
+
+	/**
+	 * Whether filename is no longer the file this segment was opened from:
+	 * a new instance replaces it when it takes over (see SIGUSR2)
+	 */
+	bool replaced(std::string const &filename) const throw();
+
+	struct metrics_header* header() const throw() {
+		return reinterpret_cast<struct metrics_header*>(m_mem);
+	}
+	struct worker_metrics* worker(unsigned int const i) const throw() {
+		return reinterpret_cast<struct worker_metrics*>( header() + 1 ) + i;
+	}
+};
+
+#endif // __METRICS_HXX__
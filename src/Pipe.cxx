@@ -0,0 +1,69 @@
+#include "../config.h"
+#include "Pipe.hxx"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+Pipe::Pipe() throw(Errno) : m_bytes(0), m_grown(false) {
+	int fds[2];
+	if( pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1 ) {
+		throw Errno("Could not create pipe", errno);
+	}
+	m_read = fds[0];
+	m_write = fds[1];
+
+	int size = fcntl(m_write, F_GETPIPE_SZ);
+	m_capacity = ( size > 0 ? size : 65536 );
+}
+
+void Pipe::grow(size_t const size) throw(Errno) {
+	int rv = fcntl(m_write, F_SETPIPE_SZ, (int)size);
+	if( rv == -1 ) throw Errno("Could not grow pipe", errno);
+	m_capacity = rv;
+	m_grown = true;
+}
+
+Pipe::~Pipe() throw() {
+	close(m_read);
+	close(m_write);
+}
+
+ssize_t Pipe::splice_from(int const fd, size_t const len) throw() {
+	ssize_t rv = splice(fd, NULL, m_write, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if( rv == -1 ) return -errno;
+	m_bytes += rv;
+	return rv;
+}
+
+ssize_t Pipe::splice_to(int const fd, size_t const len) throw() {
+	ssize_t rv = splice(m_read, NULL, fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if( rv == -1 ) return -errno;
+	m_bytes -= rv;
+	return rv;
+}
+
+
+PipePool::~PipePool() throw() {
+	for( typeof(m_free.begin()) i = m_free.begin(); i != m_free.end(); ++i ) {
+		delete *i;
+	}
+}
+
+Pipe* PipePool::get() throw(Errno) {
+	if( m_free.empty() ) {
+		return new Pipe;
+	}
+	Pipe *p = m_free.back();
+	m_free.pop_back();
+	return p;
+}
+
+void PipePool::put(Pipe *p) throw() {
+	if( p == NULL ) return;
+	if( p->empty() && ! p->grown() && m_free.size() < m_max_free ) {
+		m_free.push_back(p);
+	} else {
+		delete p;
+	}
+}
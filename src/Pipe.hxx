@@ -0,0 +1,93 @@
+#ifndef __PIPE_HXX__
+#define __PIPE_HXX__
+
+#include <sys/types.h>
+#include <vector>
+
+#include "../Socket/Errno.hxx"
+
+/**
+ * A non-blocking pipe, used as the in-kernel buffer for splice()ing data
+ * from one socket to another without copying it to userspace.
+ * Keeps track of the number of bytes that are currently in the pipe.
+ */
+class Pipe {
+private:
+	int m_read;
+	int m_write;
+	size_t m_capacity;
+	size_t m_bytes;
+	bool m_grown;
+
+	// Not copyable
+	Pipe(Pipe const &);
+	Pipe & operator =(Pipe const &);
+
+public:
+	Pipe() throw(Errno);
+	~Pipe() throw();
+
+	size_t capacity() const throw() { return m_capacity; }
+	size_t bytes() const throw() { return m_bytes; }
+	size_t space() const throw() { return m_bytes < m_capacity ? m_capacity - m_bytes : 0; }
+	bool empty() const throw() { return m_bytes == 0; }
+	bool grown() const throw() { return m_grown; }
+
+	/**
+	 * Make the pipe hold at least size bytes
+	 * Beyond /proc/sys/fs/pipe-max-size, that takes CAP_SYS_RESOURCE.
+	 */
+	void grow(size_t const size) throw(Errno);
+
+	/**
+	 * Raw ends of the pipe, for splice()s that are not done through
+	 * splice_from() or splice_to() (e.g. by io_uring). Use added() and
+	 * removed() to keep the byte count right.
+	 */
+	int read_end() const throw() { return m_read; }
+	int write_end() const throw() { return m_write; }
+	void added(size_t const len) throw() { m_bytes += len; }
+	void removed(size_t const len) throw() { m_bytes -= len; }
+
+	/**
+	 * Move up to len bytes from fd into the pipe.
+	 * Returns the number of bytes moved, 0 on EOF of fd, or -errno on
+	 * failure. -EAGAIN means either fd has no data, or the pipe is full.
+	 */
+	ssize_t splice_from(int const fd, size_t const len) throw();
+
+	/**
+	 * Move up to len bytes from the pipe to fd.
+	 * Returns the number of bytes moved, or -errno on failure.
+	 */
+	ssize_t splice_to(int const fd, size_t const len) throw();
+};
+
+
+/**
+ * Keeps empty pipes around for reuse, so that we don't need to create a new
+ * pair of file descriptors every time a connection has data in flight.
+ */
+class PipePool {
+private:
+	std::vector<Pipe*> m_free;
+	size_t m_max_free;
+
+public:
+	PipePool(size_t const max_free = 64) throw() : m_max_free(max_free) {}
+	~PipePool() throw();
+
+	/**
+	 * Get an empty pipe, either from the pool or a newly created one.
+	 */
+	Pipe* get() throw(Errno);
+
+	/**
+	 * Return a pipe to the pool.
+	 * Pipes that still contain data, were grown, or don't fit in the pool
+	 * are destroyed.
+	 */
+	void put(Pipe *p) throw();
+};
+
+#endif // __PIPE_HXX__
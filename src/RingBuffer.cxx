@@ -0,0 +1,70 @@
+#include "../config.h"
+#include "RingBuffer.hxx"
+
+#include <assert.h>
+
+void RingBuffer::attach(char *mem, size_t const capacity) throw() {
+	assert( m_buf == NULL );
+	m_buf = mem;
+	m_capacity = capacity;
+	m_start = m_length = 0;
+}
+
+char* RingBuffer::detach() throw() {
+	char *mem = m_buf;
+	m_buf = NULL;
+	m_start = m_length = 0;
+	return mem;
+}
+
+int RingBuffer::space_iov(struct iovec iov[2]) const throw() {
+	assert( m_buf != NULL );
+	if( full() ) return 0;
+
+	size_t end = m_start + m_length;
+	if( end >= m_capacity ) {
+		// Data wraps around, free space is between the end and the start
+		end -= m_capacity;
+		iov[0].iov_base = m_buf + end;
+		iov[0].iov_len = m_start - end;
+		return 1;
+	}
+	// Free space runs up to the end of the memory, and again from 0 to m_start
+	iov[0].iov_base = m_buf + end;
+	iov[0].iov_len = m_capacity - end;
+	if( m_start == 0 ) return 1;
+	iov[1].iov_base = m_buf;
+	iov[1].iov_len = m_start;
+	return 2;
+}
+
+void RingBuffer::commit(size_t const len) throw() {
+	assert( len <= space() );
+	m_length += len;
+}
+
+int RingBuffer::data_iov(struct iovec iov[2]) const throw() {
+	if( empty() ) return 0;
+
+	iov[0].iov_base = m_buf + m_start;
+	if( m_start + m_length <= m_capacity ) {
+		iov[0].iov_len = m_length;
+		return 1;
+	}
+	iov[0].iov_len = m_capacity - m_start;
+	iov[1].iov_base = m_buf;
+	iov[1].iov_len = m_length - iov[0].iov_len;
+	return 2;
+}
+
+void RingBuffer::consume(size_t const len) throw() {
+	assert( len <= m_length );
+	m_length -= len;
+	if( m_length == 0 ) {
+		// Start over at the beginning, keeps the data contiguous
+		m_start = 0;
+	} else {
+		m_start += len;
+		if( m_start >= m_capacity ) m_start -= m_capacity;
+	}
+}
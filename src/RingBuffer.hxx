@@ -0,0 +1,66 @@
+#ifndef __RINGBUFFER_HXX__
+#define __RINGBUFFER_HXX__
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stddef.h>
+
+/**
+ * Fixed-capacity circular byte buffer
+ * Data is appended at the write cursor and consumed from the read cursor,
+ * so one side can fill the buffer while the other side is draining it,
+ * without ever moving the buffered bytes around.
+ * The memory is not owned by the buffer: it is handed in with attach() and
+ * taken back with detach(), so it can be returned to a BufferPool whenever the
+ * buffer runs empty.
+ */
+class RingBuffer {
+private:
+	char *m_buf;
+	size_t m_capacity;
+	size_t m_start;  // read cursor
+	size_t m_length; // number of buffered bytes
+
+	// Not copyable
+	RingBuffer(RingBuffer const &);
+	RingBuffer & operator =(RingBuffer const &);
+
+public:
+	RingBuffer() throw()
+		: m_buf(NULL), m_capacity(0), m_start(0), m_length(0) {}
+
+	/**
+	 * Use capacity bytes at mem as buffer space
+	 */
+	void attach(char *mem, size_t const capacity) throw();
+	/**
+	 * Give back the memory, discarding any data that is still buffered
+	 * Returns NULL if no memory was attached.
+	 */
+	char* detach() throw();
+	bool attached() const throw() { return m_buf != NULL; }
+
+	size_t capacity() const throw() { return m_capacity; }
+	size_t length() const throw() { return m_length; }
+	size_t space() const throw() { return m_capacity - m_length; }
+	bool empty() const throw() { return m_length == 0; }
+	bool full() const throw() { return m_buf != NULL && m_length == m_capacity; }
+
+	/**
+	 * Describe the free space after the write cursor in (at most) 2 iovecs,
+	 * ready for readv(). Returns the number of iovecs used.
+	 * Fill (part of) it and call commit() with the number of bytes written.
+	 */
+	int space_iov(struct iovec iov[2]) const throw();
+	void commit(size_t const len) throw();
+
+	/**
+	 * Describe the data after the read cursor in (at most) 2 iovecs,
+	 * ready for writev(). Returns the number of iovecs used.
+	 * Send (part of) it and call consume() with the number of bytes used.
+	 */
+	int data_iov(struct iovec iov[2]) const throw();
+	void consume(size_t const len) throw();
+};
+
+#endif // __RINGBUFFER_HXX__
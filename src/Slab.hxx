@@ -0,0 +1,111 @@
+#ifndef __SLAB_HXX__
+#define __SLAB_HXX__
+
+#include <new>
+#include <vector>
+#include <stddef.h>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+/**
+ * Free-list allocator for objects of type T
+ * Objects are carved out of chunks of PerChunk objects. Freed objects go on a
+ * free list and are handed out again by the next alloc(); chunks are only
+ * returned to the system when the Slab itself is destroyed.
+ * Not thread-safe: use one Slab per thread.
+ */
+template<typename T, size_t PerChunk = 256>
+class Slab {
+private:
+	union Slot {
+		Slot *next_free;
+		typename boost::aligned_storage< sizeof(T), boost::alignment_of<T>::value >::type storage;
+	};
+
+	std::vector<Slot*> m_chunks;
+	Slot *m_free;
+	size_t m_in_use;
+
+	// Not copyable
+	Slab(Slab const &);
+	Slab & operator =(Slab const &);
+
+	void grow() {
+		Slot *chunk = new Slot[PerChunk];
+		m_chunks.push_back(chunk);
+		for( size_t i = 0; i < PerChunk; i++ ) {
+			chunk[i].next_free = m_free;
+			m_free = &chunk[i];
+		}
+	}
+
+public:
+	Slab() throw() : m_free(NULL), m_in_use(0) {}
+
+	/**
+	 * Releases all chunks. All objects must have been free()d before.
+	 */
+	~Slab() throw() {
+		for( typeof(m_chunks.begin()) i = m_chunks.begin(); i != m_chunks.end(); ++i ) {
+			delete[] *i;
+		}
+	}
+
+	/**
+	 * Get a default-constructed T
+	 */
+	T* alloc() {
+		if( m_free == NULL ) grow();
+		Slot *s = m_free;
+		// Unlink first: constructing T overwrites next_free
+		m_free = s->next_free;
+		T *obj;
+		try {
+			obj = new (&s->storage) T();
+		} catch( ... ) {
+			s->next_free = m_free; // back on the free list
+			m_free = s;
+			throw;
+		}
+		m_in_use++;
+		return obj;
+	}
+
+	/**
+	 * Destroy obj and put its memory on the free list
+	 */
+	void free(T *obj) throw() {
+		if( obj == NULL ) return;
+		obj->~T();
+		Slot *s = reinterpret_cast<Slot*>(obj);
+		s->next_free = m_free;
+		m_free = s;
+		m_in_use--;
+	}
+
+	size_t in_use() const throw() { return m_in_use; }
+	size_t chunks() const throw() { return m_chunks.size(); }
+
+	/**
+	 * Like std::auto_ptr, but frees the object back to the Slab
+	 */
+	class Ptr {
+	private:
+		Slab &m_slab;
+		T *m_obj;
+
+		Ptr(Ptr const &);
+		Ptr & operator =(Ptr const &);
+
+	public:
+		Ptr(Slab &slab) : m_slab(slab), m_obj(slab.alloc()) {}
+		~Ptr() throw() { m_slab.free(m_obj); }
+
+		T* get() const throw() { return m_obj; }
+		T* operator ->() const throw() { return m_obj; }
+		T& operator *() const throw() { return *m_obj; }
+		T* release() throw() { T *tmp = m_obj; m_obj = NULL; return tmp; }
+	};
+};
+
+#endif // __SLAB_HXX__
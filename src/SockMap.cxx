@@ -0,0 +1,219 @@
+#include "../config.h"
+#include "SockMap.hxx"
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#if HAVE_LINUX_BPF_H
+#include <linux/bpf.h>
+#include <linux/tcp.h> // netinet/tcp.h's tcp_info lacks the byte counters
+#include <linux/sockios.h>
+#endif
+
+#ifndef SO_COOKIE
+#define SO_COOKIE 57
+#endif
+
+#if HAVE_LINUX_BPF_H
+
+static int bpf(int const cmd, union bpf_attr &attr) throw() {
+	return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+
+static struct bpf_insn insn(uint8_t const code, uint8_t const dst, uint8_t const src,
+                            int16_t const off, int32_t const imm) throw() {
+	struct bpf_insn i;
+	i.code = code;
+	i.dst_reg = dst;
+	i.src_reg = src;
+	i.off = off;
+	i.imm = imm;
+	return i;
+}
+
+static int create_map(unsigned int const entries) throw(Errno) {
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_SOCKHASH;
+	attr.key_size = sizeof(uint64_t); // socket cookie
+	attr.value_size = sizeof(uint32_t); // socket fd
+	attr.max_entries = entries;
+	int fd = bpf(BPF_MAP_CREATE, attr);
+	if( fd == -1 ) throw Errno("Could not create sockmap", errno);
+	return fd;
+}
+
+SockMap::SockMap(unsigned int const max_connections) throw(Errno)
+		: m_targets(-1), m_sockets(-1), m_program(-1) {
+	try {
+		m_targets = create_map(2 * max_connections);
+		m_sockets = create_map(2 * max_connections);
+
+		/* The verdict program, in C:
+		 *   if( skb->len == 0 ) return SK_DROP;
+		 *   __u64 key = bpf_get_socket_cookie(skb);
+		 *   return bpf_sk_redirect_hash(skb, &targets, &key, 0);
+		 * The empty skb is the FIN: redirected, it fails to send and
+		 * leaves EPIPE on the target.
+		 * Returns SK_DROP when there is no target, so insert() adds the
+		 * targets first.
+		 */
+		struct bpf_insn prog[] = {
+			insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct __sk_buff, len), 0),
+			insn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_2, 0, 2, 0),
+			insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, SK_DROP),
+			insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+			insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0), // r6 = skb
+			insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_get_socket_cookie),
+			insn(BPF_STX | BPF_MEM | BPF_DW, BPF_REG_10, BPF_REG_0, -8, 0), // key on the stack
+			insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_1, BPF_REG_6, 0, 0),
+			insn(BPF_LD | BPF_IMM | BPF_DW, BPF_REG_2, BPF_PSEUDO_MAP_FD, 0, m_targets),
+			insn(0, 0, 0, 0, 0), // upper half of the 64-bit immediate
+			insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_3, BPF_REG_10, 0, 0),
+			insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_3, 0, 0, -8),
+			insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_4, 0, 0, 0), // egress of the target
+			insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_sk_redirect_hash),
+			insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+		};
+		union bpf_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.prog_type = BPF_PROG_TYPE_SK_SKB;
+		attr.insns = reinterpret_cast<uintptr_t>(prog);
+		attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+		attr.license = reinterpret_cast<uintptr_t>("GPL"); // for the redirect helpers
+		m_program = bpf(BPF_PROG_LOAD, attr);
+		if( m_program == -1 ) throw Errno("Could not load the sockmap program", errno);
+
+		memset(&attr, 0, sizeof(attr));
+		attr.target_fd = m_sockets;
+		attr.attach_bpf_fd = m_program;
+		attr.attach_type = BPF_SK_SKB_STREAM_VERDICT;
+		if( bpf(BPF_PROG_ATTACH, attr) == -1 ) throw Errno("Could not attach the sockmap program", errno);
+	} catch( Errno & ) {
+		close_all();
+		throw;
+	}
+}
+
+uint64_t SockMap::cookie(Socket &s) throw(Errno) {
+	uint64_t c;
+	socklen_t len = sizeof(c);
+	s.getsockopt(SOL_SOCKET, SO_COOKIE, &c, &len);
+	return c;
+}
+
+void SockMap::add(int const map, uint64_t const key, Socket &s) throw(Errno) {
+	uint32_t fd = s;
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map;
+	attr.key = reinterpret_cast<uintptr_t>(&key);
+	attr.value = reinterpret_cast<uintptr_t>(&fd);
+	attr.flags = BPF_NOEXIST;
+	if( bpf(BPF_MAP_UPDATE_ELEM, attr) == -1 ) throw Errno("Could not add to sockmap", errno);
+}
+
+void SockMap::remove(int const map, uint64_t const key) throw(Errno) {
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map;
+	attr.key = reinterpret_cast<uintptr_t>(&key);
+	if( bpf(BPF_MAP_DELETE_ELEM, attr) == -1 && errno != ENOENT ) {
+		throw Errno("Could not remove from sockmap", errno);
+	}
+}
+
+/**
+ * Data that arrived before s was added only goes through the program when
+ * the next packet comes in, which may never happen. Setting SO_RCVLOWAT
+ * checks the receive queue right away.
+ */
+static void kick(Socket &s) throw(Errno) {
+	int one = 1;
+	s.setsockopt(SOL_SOCKET, SO_RCVLOWAT, &one, sizeof(one));
+}
+
+bool SockMap::insert(Socket &a, Socket &b) throw(Errno) {
+	uint64_t cookie_a = cookie(a), cookie_b = cookie(b);
+	// Targets first: a packet that arrives in between is dropped without one
+	int added = 0;
+	try {
+		add(m_targets, cookie_a, b);
+		added++;
+		add(m_targets, cookie_b, a);
+		added++;
+		add(m_sockets, cookie_a, a);
+	} catch( Errno & ) {
+		if( added > 1 ) remove(m_targets, cookie_b);
+		if( added > 0 ) remove(m_targets, cookie_a);
+		return false;
+	}
+	// From here on, a is relayed
+	add(m_sockets, cookie_b, b);
+	kick(a);
+	kick(b);
+	return true;
+}
+
+void SockMap::pause(Socket &s) throw(Errno) {
+	remove(m_sockets, cookie(s));
+}
+
+bool SockMap::resume(Socket &s) throw(Errno) {
+	try {
+		add(m_sockets, cookie(s), s);
+	} catch( Errno & ) {
+		return false;
+	}
+	kick(s);
+	return true;
+}
+
+void SockMap::counters(Socket &s, Counters &c) throw(Errno) {
+	struct tcp_info info;
+	memset(&info, 0, sizeof(info));
+	socklen_t len = sizeof(info);
+	s.getsockopt(IPPROTO_TCP, TCP_INFO, &info, &len);
+	int unacked = 0;
+	if( ioctl(s, SIOCOUTQ, &unacked) == -1 ) throw Errno("Could not get the send queue", errno);
+	c.received = info.tcpi_bytes_received;
+	switch( info.tcpi_state ) {
+	case BPF_TCP_CLOSE_WAIT: case BPF_TCP_LAST_ACK: case BPF_TCP_CLOSING: case BPF_TCP_TIME_WAIT:
+	case BPF_TCP_CLOSE: // or reset, then the count doesn't matter any more
+		c.received--; // the FIN is not data
+		break;
+	}
+	c.sent = info.tcpi_bytes_acked + unacked;
+}
+
+#else // ! HAVE_LINUX_BPF_H
+
+SockMap::SockMap(unsigned int const max_connections) throw(Errno)
+		: m_targets(-1), m_sockets(-1), m_program(-1) {
+	throw Errno("Built without BPF support", ENOSYS);
+}
+uint64_t SockMap::cookie(Socket &s) throw(Errno) { throw Errno("Built without BPF support", ENOSYS); }
+bool SockMap::insert(Socket &a, Socket &b) throw(Errno) { return false; }
+void SockMap::pause(Socket &s) throw(Errno) {}
+bool SockMap::resume(Socket &s) throw(Errno) { return false; }
+void SockMap::counters(Socket &s, Counters &c) throw(Errno) { c.received = c.sent = 0; }
+
+#endif // HAVE_LINUX_BPF_H
+
+SockMap::SockMap(int const targets, int const sockets) throw()
+		: m_targets(targets), m_sockets(sockets), m_program(-1) {}
+
+void SockMap::close_all() throw() {
+	// The program stays loaded as long as the map it is attached to exists
+	if( m_program != -1 ) close(m_program);
+	if( m_sockets != -1 ) close(m_sockets);
+	if( m_targets != -1 ) close(m_targets);
+}
+
+SockMap::~SockMap() throw() {
+	close_all();
+}
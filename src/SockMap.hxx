@@ -0,0 +1,90 @@
+#ifndef __SOCKMAP_HXX__
+#define __SOCKMAP_HXX__
+
+#include <stdint.h>
+
+#include "../Socket/Socket.hxx"
+
+/**
+ * Relays connections inside the kernel, with an eBPF sockmap
+ * Two BPF_MAP_TYPE_SOCKHASH maps, both keyed by socket cookie (SO_COOKIE):
+ *   targets: for every socket, the socket its data goes out on
+ *   sockets: the sockets whose incoming data is redirected; the sk_skb
+ *            stream verdict program is attached to this one
+ * For every packet that arrives on a socket in sockets, the program looks up
+ * the cookie of that socket in targets, and queues the data for sending
+ * there. Nothing reaches userspace anymore, only the EOF.
+ * Sockets leave both maps when they are closed. The maps are shared by all
+ * workers, the kernel does the locking.
+ *
+ * The kernel does not limit how much is queued for a slow target: the
+ * caller watches the counters(), and pause()s the socket that feeds it.
+ */
+class SockMap {
+private:
+	int m_targets;
+	int m_sockets;
+	int m_program;
+
+	// Not copyable
+	SockMap(SockMap const &);
+	SockMap & operator =(SockMap const &);
+
+	void close_all() throw();
+	void add(int const map, uint64_t const key, Socket &s) throw(Errno);
+	void remove(int const map, uint64_t const key) throw(Errno);
+
+public:
+	/**
+	 * Create the maps, for max_connections pairs, and load the program
+	 * Throws if the kernel can't (no BPF, not permitted, ...).
+	 */
+	explicit SockMap(unsigned int const max_connections) throw(Errno);
+
+	/**
+	 * Take over the maps of another instance (with their program attached)
+	 */
+	SockMap(int const targets, int const sockets) throw();
+
+	~SockMap() throw();
+
+	int targets_fd() const throw() { return m_targets; }
+	int sockets_fd() const throw() { return m_sockets; }
+
+	static uint64_t cookie(Socket &s) throw(Errno);
+
+	/**
+	 * Relay everything a receives to b, and vice versa
+	 * Returns false if the kernel refuses (the maps are full, one of the
+	 * sockets is no longer established, ...); nothing changed then.
+	 * Throws if it failed halfway, when data may have been relayed already.
+	 */
+	bool insert(Socket &a, Socket &b) throw(Errno);
+
+	/**
+	 * Stop relaying what s receives: it stays in the kernel's receive
+	 * queue, until that is full and the window closes. Data for s is still
+	 * relayed.
+	 */
+	void pause(Socket &s) throw(Errno);
+
+	/**
+	 * Relay what s receives again, starting with what queued up
+	 * Returns false if the kernel refuses: s is no longer established
+	 * (it received the FIN) and stays out.
+	 */
+	bool resume(Socket &s) throw(Errno);
+
+	/**
+	 * Bytes received on s, and bytes handed to TCP to send on s, since it
+	 * was set up. received leaves out a FIN s got; the SYN and our own FIN
+	 * may count as a byte, so only differences are meaningful.
+	 */
+	struct Counters {
+		uint64_t received;
+		uint64_t sent;
+	};
+	static void counters(Socket &s, Counters &c) throw(Errno);
+};
+
+#endif // __SOCKMAP_HXX__
@@ -0,0 +1,85 @@
+#ifndef __SPSCRING_HXX__
+#define __SPSCRING_HXX__
+
+#include <stddef.h>
+
+/**
+ * Bounded single-producer/single-consumer queue of T, without locks
+ * One thread pushes, another one takes the items off the front. When the
+ * ring is full, items are dropped and counted, so the producer never waits.
+ * The size must be a power of 2.
+ */
+template<typename T>
+class SpscRing {
+private:
+	T *m_items;
+	unsigned int m_mask;
+	unsigned long m_dropped;  // written by the producer only
+	unsigned long m_reported; // consumer only
+	// Keep the indices on separate cache lines
+	char m_pad1[64];
+	unsigned int m_head; // written by the consumer
+	char m_pad2[64 - sizeof(unsigned int)];
+	unsigned int m_tail; // written by the producer
+
+	SpscRing(SpscRing const &);
+	SpscRing & operator =(SpscRing const &);
+
+public:
+	SpscRing(unsigned int const size)
+		: m_items(new T[size]), m_mask(size - 1), m_dropped(0), m_reported(0),
+		  m_head(0), m_tail(0) {}
+	~SpscRing() throw() { delete[] m_items; }
+
+	/**
+	 * Producer: the slot for the next item, to be filled in and then
+	 * published. NULL (and the drop is counted) when the ring is full.
+	 */
+	T* reserve() throw() {
+		unsigned int tail = m_tail; // we're the only writer
+		if( tail - __atomic_load_n(&m_head, __ATOMIC_ACQUIRE) > m_mask ) {
+			__atomic_store_n(&m_dropped, m_dropped + 1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+		return &m_items[tail & m_mask];
+	}
+	void publish() throw() {
+		__atomic_store_n(&m_tail, m_tail + 1, __ATOMIC_RELEASE);
+	}
+
+	/**
+	 * Producer: queue a copy of item, returns false if it had to be dropped
+	 */
+	bool push(T const &item) throw() {
+		T *slot = reserve();
+		if( slot == NULL ) return false;
+		*slot = item;
+		publish();
+		return true;
+	}
+
+	/**
+	 * Consumer: the oldest item, NULL if there is none. It stays valid until
+	 * pop().
+	 */
+	T const* front() const throw() {
+		unsigned int head = m_head; // we're the only writer
+		if( head == __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE) ) return NULL;
+		return &m_items[head & m_mask];
+	}
+	void pop() throw() {
+		__atomic_store_n(&m_head, m_head + 1, __ATOMIC_RELEASE);
+	}
+
+	/**
+	 * Consumer: how many items were dropped since the last call
+	 */
+	unsigned long dropped() throw() {
+		unsigned long dropped = __atomic_load_n(&m_dropped, __ATOMIC_RELAXED);
+		unsigned long n = dropped - m_reported;
+		m_reported = dropped;
+		return n;
+	}
+};
+
+#endif // __SPSCRING_HXX__
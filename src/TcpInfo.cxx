@@ -0,0 +1,128 @@
+#include "../config.h"
+#include "TcpInfo.hxx"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h> // glibc's struct tcp_info lacks the newer fields
+#include <libsimplelog.h>
+
+#include "gettext.h"
+#define _(String) gettext(String)
+
+static char const * const leg_names[] = { "client", "server" };
+
+bool TcpInfoSample::read(int const fd) throw() {
+	struct tcp_info ti;
+	memset(&ti, 0, sizeof(ti));
+	socklen_t len = sizeof(ti);
+	if( getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) != 0 || len == 0 ) return false;
+	state = ti.tcpi_state;
+	rtt = ti.tcpi_rtt;
+	rttvar = ti.tcpi_rttvar;
+	min_rtt = ti.tcpi_min_rtt;
+	snd_cwnd = ti.tcpi_snd_cwnd;
+	snd_mss = ti.tcpi_snd_mss;
+	total_retrans = ti.tcpi_total_retrans;
+	delivery_rate = ti.tcpi_delivery_rate;
+	pacing_rate = ti.tcpi_pacing_rate;
+	bytes_acked = ti.tcpi_bytes_acked;
+	bytes_received = ti.tcpi_bytes_received;
+	return true;
+}
+
+
+TcpInfoLog::TcpInfoLog(std::string const &filename, unsigned int const producers,
+                       unsigned int const ring_size) throw(Errno)
+	: m_filename(filename), m_file(NULL), m_running(false), m_stop(false), m_reopen(false) {
+	m_file = fopen(m_filename.c_str(), "ae"); // O_CLOEXEC, it's not handed over
+	if( m_file == NULL ) throw Errno("Could not open TCP_INFO log", errno);
+	for( unsigned int i = 0; i < producers; i++ ) {
+		m_rings.push_back( new Ring(ring_size) );
+	}
+}
+
+TcpInfoLog::~TcpInfoLog() throw() {
+	stop();
+	for( typeof(m_rings.begin()) i = m_rings.begin(); i != m_rings.end(); ++i ) {
+		delete *i;
+	}
+	if( m_file != NULL ) fclose(m_file);
+}
+
+void TcpInfoLog::start() throw(Errno) {
+	int rv = pthread_create(&m_thread, NULL, thread_main, this);
+	if( rv != 0 ) throw Errno("Could not start TCP_INFO log thread", rv);
+	m_running = true;
+}
+
+void TcpInfoLog::stop() throw() {
+	if( ! m_running ) return;
+	__atomic_store_n(&m_stop, true, __ATOMIC_RELEASE);
+	pthread_join(m_thread, NULL);
+	m_running = false;
+}
+
+void* TcpInfoLog::thread_main(void *arg) {
+	TcpInfoLog *log = reinterpret_cast<TcpInfoLog*>(arg);
+	while( true ) {
+		bool stop = __atomic_load_n(&log->m_stop, __ATOMIC_ACQUIRE);
+		if( __atomic_exchange_n(&log->m_reopen, false, __ATOMIC_ACQ_REL) ) {
+			FILE *f = fopen(log->m_filename.c_str(), "ae");
+			if( f == NULL ) {
+				LogError(_("Could not reopen \"%1$s\": %2$s"), log->m_filename.c_str(), strerror(errno));
+			} else {
+				fclose(log->m_file);
+				log->m_file = f;
+			}
+		}
+		if( log->drain() ) {
+			fflush(log->m_file);
+			continue;
+		}
+		if( stop ) break;
+		usleep(100000); // Samples come in slowly
+	}
+	return NULL;
+}
+
+bool TcpInfoLog::drain() throw() {
+	bool any = false;
+	for( typeof(m_rings.begin()) i = m_rings.begin(); i != m_rings.end(); ++i ) {
+		Ring *ring = *i;
+		for( TcpInfoSample const *s; (s = ring->front()) != NULL; ring->pop() ) {
+			write(*s);
+			any = true;
+		}
+
+		unsigned long dropped = ring->dropped();
+		if( dropped > 0 ) {
+			/* TRANSLATORS: %1$lu contains the number of TCP_INFO samples that
+			   were lost because they came in too fast */
+			LogWarn(_("TCP_INFO log can't keep up, dropped %1$lu samples"), dropped);
+		}
+	}
+	return any;
+}
+
+void TcpInfoLog::write(TcpInfoSample const &s) throw() {
+	char id[CONNECTION_ID_STRLEN];
+	s.id.format(id, sizeof(id));
+	// The connection ID only holds addresses, digits and punctuation that
+	// need no escaping
+	fprintf(m_file, "{\"time\":%.3f,\"connection\":\"%s\",\"leg\":\"%s\",\"final\":%s,"
+	        "\"state\":%u,\"rtt_us\":%u,\"rttvar_us\":%u,\"min_rtt_us\":%u,"
+	        "\"cwnd\":%u,\"mss\":%u,\"retransmits\":%u,\"delivery_rate\":%llu,",
+	        s.time, id, leg_names[s.leg], s.final ? "true" : "false",
+	        s.state, s.rtt, s.rttvar, s.min_rtt,
+	        s.snd_cwnd, s.snd_mss, s.total_retrans, (unsigned long long)s.delivery_rate);
+	if( s.pacing_rate == ~(uint64_t)0 ) {
+		fprintf(m_file, "\"pacing_rate\":null,");
+	} else {
+		fprintf(m_file, "\"pacing_rate\":%llu,", (unsigned long long)s.pacing_rate);
+	}
+	fprintf(m_file, "\"bytes_acked\":%llu,\"bytes_received\":%llu}\n",
+	        (unsigned long long)s.bytes_acked, (unsigned long long)s.bytes_received);
+}
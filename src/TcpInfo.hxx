@@ -0,0 +1,92 @@
+#ifndef __TCPINFO_HXX__
+#define __TCPINFO_HXX__
+
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "../Socket/Errno.hxx"
+#include "AsyncLog.hxx"
+#include "SpscRing.hxx"
+
+enum tcp_info_leg { TCP_INFO_CLIENT = 0, TCP_INFO_SERVER = 1 };
+
+/**
+ * The part of TCP_INFO of one socket that says how well the path does
+ */
+struct TcpInfoSample {
+	double time;             // when it was taken, seconds since the epoch
+	ConnectionId id;
+	unsigned char leg;       // enum tcp_info_leg
+	bool final;              // taken when the connection closed
+	unsigned char state;     // TCP_ESTABLISHED, ...
+	uint32_t rtt, rttvar, min_rtt; // microseconds
+	uint32_t snd_cwnd;       // segments
+	uint32_t snd_mss;        // bytes
+	uint32_t total_retrans;  // segments retransmitted
+	uint64_t delivery_rate;  // bytes per second
+	uint64_t pacing_rate;    // bytes per second, ~0 when not paced
+	uint64_t bytes_acked, bytes_received;
+
+	/**
+	 * Fill in the TCP_INFO fields from socket fd, false if the kernel has
+	 * none for it. Fields an older kernel doesn't know stay 0.
+	 */
+	bool read(int const fd) throw();
+};
+
+/**
+ * Writes samples as JSON lines, one object per line, from a background
+ * thread
+ * Works like AsyncLog: every worker queues its samples in its own
+ * single-producer/single-consumer ring, and the thread formats and writes
+ * them. Samples that don't fit in the ring are dropped (and the drops are
+ * logged).
+ */
+class TcpInfoLog {
+public:
+	typedef SpscRing<TcpInfoSample> Ring;
+
+private:
+	std::string m_filename;
+	FILE *m_file;
+	std::vector<Ring*> m_rings;
+	pthread_t m_thread;
+	bool m_running;
+	bool m_stop;
+	bool m_reopen;
+
+	TcpInfoLog(TcpInfoLog const &);
+	TcpInfoLog & operator =(TcpInfoLog const &);
+
+	static void* thread_main(void *arg);
+	bool drain() throw();
+	void write(TcpInfoSample const &s) throw();
+
+public:
+	/**
+	 * Open filename for appending, throws if that fails
+	 */
+	TcpInfoLog(std::string const &filename, unsigned int const producers,
+	           unsigned int const ring_size = 4096) throw(Errno);
+	~TcpInfoLog() throw();
+
+	Ring* ring(unsigned int const producer) throw() { return m_rings[producer]; }
+
+	void start() throw(Errno);
+
+	/**
+	 * Have the thread open the file again (after it was rotated)
+	 * Can be called from any thread.
+	 */
+	void reopen() throw() { __atomic_store_n(&m_reopen, true, __ATOMIC_RELEASE); }
+
+	/**
+	 * Write out what is still queued, and stop the thread
+	 */
+	void stop() throw();
+};
+
+#endif // __TCPINFO_HXX__
@@ -0,0 +1,83 @@
+#include "../config.h"
+#include "TimerWheel.hxx"
+
+TimerWheel::~TimerWheel() throw() {
+	for( unsigned int l = 0; l < LEVELS; l++ ) {
+		for( unsigned int s = 0; s < SLOTS; s++ ) m_slots[l][s].clear();
+	}
+}
+
+/**
+ * Put t in the finest level that covers its expiry
+ * A slot of level l holds SLOTS^l ticks, and is emptied into the level below
+ * when time reaches its start. Timers that are due already go into the slot
+ * of the current tick, which advance() empties last.
+ */
+void TimerWheel::insert(Timer *t) throw() {
+	uint64_t const max_delta = (uint64_t)1 << (SLOT_BITS * LEVELS);
+	if( t->expires - m_now >= max_delta && t->expires > m_now ) {
+		t->expires = m_now + max_delta - 1;
+	}
+	uint64_t delta = t->expires > m_now ? t->expires - m_now : 0;
+
+	unsigned int level = 0;
+	while( level < LEVELS - 1 && delta >= (uint64_t)1 << (SLOT_BITS * (level + 1)) ) level++;
+	uint64_t when = t->expires > m_now ? t->expires : m_now;
+	t->level = level;
+	t->slot = (when >> (SLOT_BITS * level)) & (SLOTS - 1);
+	m_slots[t->level][t->slot].push_back(*t);
+}
+
+/**
+ * Time reached the start of the current slot of level: spread its timers
+ * over the levels below
+ */
+void TimerWheel::cascade(unsigned int const level) throw() {
+	slot_list &l = m_slots[level][ (m_now >> (SLOT_BITS * level)) & (SLOTS - 1) ];
+	while( ! l.empty() ) {
+		Timer &t = l.front();
+		l.pop_front();
+		insert(&t);
+	}
+}
+
+void TimerWheel::schedule(Timer *t, uint64_t const expires) throw() {
+	if( t->scheduled() ) {
+		m_slots[t->level][t->slot].erase( slot_list::s_iterator_to(*t) );
+	} else {
+		m_count++;
+	}
+	t->expires = expires > m_now ? expires : m_now + 1;
+	insert(t);
+}
+
+void TimerWheel::cancel(Timer *t) throw() {
+	if( ! t->scheduled() ) return;
+	m_slots[t->level][t->slot].erase( slot_list::s_iterator_to(*t) );
+	m_count--;
+}
+
+void TimerWheel::advance(uint64_t const now, std::vector<Timer*> &expired) throw() {
+	if( m_count == 0 && now > m_now ) {
+		m_now = now; // Nothing to step through
+		return;
+	}
+	while( m_now < now ) {
+		m_now++;
+		for( unsigned int level = 1; level < LEVELS; level++ ) {
+			if( (m_now & (((uint64_t)1 << (SLOT_BITS * level)) - 1)) != 0 ) break;
+			cascade(level);
+		}
+		slot_list &l = m_slots[0][ m_now & (SLOTS - 1) ];
+		while( ! l.empty() ) {
+			Timer &t = l.front();
+			l.pop_front();
+			m_count--;
+			expired.push_back(&t);
+		}
+		if( m_count == 0 ) {
+			m_now = now;
+			return;
+		}
+	}
+}
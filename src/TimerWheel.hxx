@@ -0,0 +1,74 @@
+#ifndef __TIMERWHEEL_HXX__
+#define __TIMERWHEEL_HXX__
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <boost/intrusive/list.hpp>
+
+/**
+ * Hierarchical timer wheel, for many timeouts that are rarely hit
+ * Time is counted in ticks, the caller decides how long a tick is. Scheduling
+ * and cancelling are O(1); timers further away sit in coarser levels and move
+ * down a level every time the level below has gone round once. Timeouts more
+ * than SLOTS^LEVELS ticks away are shortened to that.
+ * Not thread-safe: use one TimerWheel per thread.
+ */
+class TimerWheel {
+public:
+	static const unsigned int SLOT_BITS = 6;
+	static const unsigned int SLOTS = 1 << SLOT_BITS;
+	static const unsigned int LEVELS = 4;
+
+	/**
+	 * Embed one of these in every object that needs a timeout
+	 */
+	struct Timer : public boost::intrusive::list_base_hook<> {
+		uint64_t expires; // tick
+		void *data;       // for the caller, like the data of libev watchers
+		unsigned char level, slot;
+
+		Timer() throw() : expires(0), data(NULL), level(0), slot(0) {}
+		bool scheduled() const throw() { return is_linked(); }
+	};
+
+private:
+	typedef boost::intrusive::list<Timer> slot_list;
+	slot_list m_slots[LEVELS][SLOTS];
+	uint64_t m_now;  // the last tick that was processed
+	size_t m_count;
+
+	TimerWheel(TimerWheel const &);
+	TimerWheel & operator =(TimerWheel const &);
+
+	void insert(Timer *t) throw();
+	void cascade(unsigned int const level) throw();
+
+public:
+	TimerWheel(uint64_t const now = 0) throw() : m_now(now), m_count(0) {}
+	~TimerWheel() throw();
+
+	uint64_t now() const throw() { return m_now; }
+	size_t size() const throw() { return m_count; }
+	bool empty() const throw() { return m_count == 0; }
+
+	/**
+	 * Expire t at tick expires (at the next tick if that has passed
+	 * already). A t that was scheduled before is moved.
+	 */
+	void schedule(Timer *t, uint64_t const expires) throw();
+
+	/**
+	 * Nothing happens if t is not scheduled
+	 */
+	void cancel(Timer *t) throw();
+
+	/**
+	 * Move time forward to tick now, and append every timer that expired on
+	 * the way to expired. They are no longer scheduled, so they can be
+	 * scheduled again right away.
+	 */
+	void advance(uint64_t const now, std::vector<Timer*> &expired) throw();
+};
+
+#endif // __TIMERWHEEL_HXX__
@@ -0,0 +1,50 @@
+#include "../config.h"
+#include "TokenBucket.hxx"
+
+#include <math.h>
+
+static const uint64_t NS = 1000000000;
+
+/**
+ * Nanoseconds worth of len bytes at rate, rounded up: rounding down would
+ * hand out the last byte a little early, or leave a full bucket a byte short
+ */
+static uint64_t duration(uint64_t const len, uint64_t const rate) throw() {
+	return ceil( (double)len * NS / rate );
+}
+
+void TokenBucket::set_rate(uint64_t const rate, uint64_t const burst) throw() {
+	m_rate = rate;
+	m_burst = rate == 0 ? 0 : duration(burst, rate);
+	m_empty = 0;
+}
+
+size_t TokenBucket::available(uint64_t const now, size_t const max) const throw() {
+	if( m_rate == 0 ) return max;
+	uint64_t empty = __atomic_load_n(&m_empty, __ATOMIC_RELAXED);
+	if( empty >= now ) return 0;
+	uint64_t ns = now - empty;
+	if( ns > m_burst ) ns = m_burst; // a full bucket
+	double tokens = (double)ns * m_rate / NS;
+	return tokens < max ? (size_t)tokens : max;
+}
+
+uint64_t TokenBucket::wait(uint64_t const now, size_t const len) const throw() {
+	if( m_rate == 0 ) return 0;
+	uint64_t empty = __atomic_load_n(&m_empty, __ATOMIC_RELAXED);
+	if( empty + m_burst < now ) empty = now - m_burst;
+	uint64_t ready = empty + duration(len, m_rate);
+	return ready > now ? ready - now : 0;
+}
+
+void TokenBucket::consume(uint64_t const now, size_t const len) throw() {
+	if( m_rate == 0 ) return;
+	uint64_t cost = duration(len, m_rate);
+	uint64_t empty = __atomic_load_n(&m_empty, __ATOMIC_RELAXED);
+	uint64_t next;
+	do {
+		// Tokens beyond the burst size were never there
+		uint64_t start = empty + m_burst < now ? now - m_burst : empty;
+		next = start + cost;
+	} while( ! __atomic_compare_exchange_n(&m_empty, &empty, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED) );
+}
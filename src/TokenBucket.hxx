@@ -0,0 +1,47 @@
+#ifndef __TOKENBUCKET_HXX__
+#define __TOKENBUCKET_HXX__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Rate limit: on average rate bytes per second, in bursts of up to burst
+ * bytes
+ * Kept as the time at which the bucket is empty again (GCRA), a single
+ * word, so it can be shared by all workers: it is only touched with atomic
+ * operations. Times are in nanoseconds, on any clock the users agree on.
+ */
+class TokenBucket {
+private:
+	uint64_t m_rate;  // bytes per second, 0 means unlimited
+	uint64_t m_burst; // in ns worth of tokens
+	uint64_t m_empty; // when the bucket will be empty
+
+public:
+	TokenBucket() throw() : m_rate(0), m_burst(0), m_empty(0) {}
+
+	/**
+	 * Not thread-safe: only change the rate before the bucket is shared
+	 */
+	void set_rate(uint64_t const rate, uint64_t const burst) throw();
+	uint64_t rate() const throw() { return m_rate; }
+	bool limited() const throw() { return m_rate != 0; }
+
+	/**
+	 * How many bytes may go at now, at most max
+	 */
+	size_t available(uint64_t const now, size_t const max) const throw();
+
+	/**
+	 * Nanoseconds from now until len bytes are available
+	 */
+	uint64_t wait(uint64_t const now, size_t const len) const throw();
+
+	/**
+	 * Take len bytes from the bucket. It may go into debt: what was read is
+	 * relayed anyway, and later takes wait for it.
+	 */
+	void consume(uint64_t const now, size_t const len) throw();
+};
+
+#endif // __TOKENBUCKET_HXX__
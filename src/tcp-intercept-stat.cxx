@@ -0,0 +1,429 @@
+#include "../config.h"
+
+#include <iostream>
+#include <sstream>
+#include <getopt.h>
+#include <sysexits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "gettext.h"
+#define _(String) gettext(String)
+#define N_(String) String
+
+#include "../Socket/Socket.hxx"
+#include "Metrics.hxx"
+
+/*
+ * Reads the counters that tcp-intercept keeps in its metrics file (see
+ * --metrics), and prints them, or serves them to Prometheus.
+ */
+
+struct totals {
+	uint64_t accepted;
+	uint64_t active;
+	uint64_t closed;
+	uint64_t connect_failed[METRICS_CONNECT_ERRNOS];
+	uint64_t bytes_c_to_s;
+	uint64_t bytes_s_to_c;
+	uint64_t buffer_bytes;
+	struct metrics_histogram rtt[METRICS_LEGS];
+	struct metrics_histogram delivery_rate[METRICS_LEGS];
+	uint64_t retransmits[METRICS_LEGS];
+};
+
+static void add_histogram(struct metrics_histogram &to, struct metrics_histogram const &h) throw() {
+	for( unsigned int b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++ ) to.buckets[b] += metrics_get(h.buckets[b]);
+	to.sum += metrics_get(h.sum);
+}
+
+static uint64_t histogram_count(struct metrics_histogram const &h) throw() {
+	uint64_t n = 0;
+	for( unsigned int b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++ ) n += h.buckets[b];
+	return n;
+}
+
+/**
+ * The upper bound of the bucket that holds quantile q (0..1): the values are
+ * below it
+ */
+static double histogram_quantile(struct metrics_histogram const &h, double const q) throw() {
+	uint64_t rank = (uint64_t)(q * histogram_count(h));
+	uint64_t seen = 0;
+	unsigned int b;
+	for( b = 0; b < METRICS_HISTOGRAM_BUCKETS - 1; b++ ) {
+		seen += h.buckets[b];
+		if( seen > rank ) break;
+	}
+	return (double)(1ULL << b);
+}
+
+/**
+ * Add up the counters of worker number first up to (not including) last
+ */
+static void sum(MetricsSegment const &m, unsigned int const first, unsigned int const last,
+                struct totals &t) throw() {
+	memset(&t, 0, sizeof(t));
+	for( unsigned int i = first; i < last; i++ ) {
+		struct worker_metrics const *w = m.worker(i);
+		t.accepted += metrics_get(w->accepted);
+		t.active += metrics_get(w->active);
+		t.closed += metrics_get(w->closed);
+		for( unsigned int e = 0; e < METRICS_CONNECT_ERRNOS; e++ ) {
+			t.connect_failed[e] += metrics_get(w->connect_failed[e]);
+		}
+		t.bytes_c_to_s += metrics_get(w->bytes_c_to_s);
+		t.bytes_s_to_c += metrics_get(w->bytes_s_to_c);
+		t.buffer_bytes += metrics_get(w->buffer_bytes);
+		for( unsigned int l = 0; l < METRICS_LEGS; l++ ) {
+			add_histogram(t.rtt[l], w->rtt[l]);
+			add_histogram(t.delivery_rate[l], w->delivery_rate[l]);
+			t.retransmits[l] += metrics_get(w->retransmits[l]);
+		}
+	}
+}
+
+static uint64_t connect_failures(struct totals const &t) throw() {
+	uint64_t n = 0;
+	for( unsigned int e = 0; e < METRICS_CONNECT_ERRNOS; e++ ) n += t.connect_failed[e];
+	return n;
+}
+
+static void print_line(char const *name, struct totals const &t) {
+	printf("%-8s %12llu %8llu %12llu %8llu %15llu %15llu %12llu\n", name,
+		(unsigned long long)t.accepted, (unsigned long long)t.active,
+		(unsigned long long)t.closed, (unsigned long long)connect_failures(t),
+		(unsigned long long)t.bytes_c_to_s, (unsigned long long)t.bytes_s_to_c,
+		(unsigned long long)t.buffer_bytes);
+}
+
+static void print_totals(MetricsSegment const &m, bool const per_worker) {
+	struct metrics_header const *h = m.header();
+	/* TRANSLATORS: %1$llu contains the PID, %2$u the number of workers,
+	   %3$llu the uptime in seconds */
+	printf(_("PID %1$llu, %2$u workers, up %3$llu seconds\n"),
+		(unsigned long long)h->pid, h->workers,
+		(unsigned long long)(time(NULL) - h->start_time));
+	printf("%-8s %12s %8s %12s %8s %15s %15s %12s\n",
+		"", _("accepted"), _("active"), _("closed"), _("failed"),
+		_("C>S bytes"), _("S>C bytes"), _("buffers"));
+
+	struct totals t;
+	if( per_worker ) {
+		for( unsigned int i = 0; i < h->workers; i++ ) {
+			char name[16];
+			snprintf(name, sizeof(name), "#%u", i);
+			sum(m, i, i+1, t);
+			print_line(name, t);
+		}
+	}
+	sum(m, 0, h->workers, t);
+	print_line(_("total"), t);
+
+	if( connect_failures(t) > 0 ) {
+		printf(_("connect() failures:"));
+		for( unsigned int e = 0; e < METRICS_CONNECT_ERRNOS; e++ ) {
+			if( t.connect_failed[e] == 0 ) continue;
+			printf(" %s=%llu", metrics_connect_errno_names[e], (unsigned long long)t.connect_failed[e]);
+		}
+		printf("\n");
+	}
+
+	for( unsigned int l = 0; l < METRICS_LEGS; l++ ) {
+		uint64_t samples = histogram_count(t.rtt[l]);
+		if( samples == 0 ) continue;
+		/* TRANSLATORS: %1$s contains the leg ("client" or "server"),
+		   %2$llu the number of samples, %3$.1f to %5$.1f upper bounds of
+		   the median, 90th and 99th percentile of the RTT in ms, %6$.1f to
+		   %8$.1f the same of the delivery rate in Mbit/s, %9$llu the number
+		   of retransmitted segments */
+		printf(_("TCP_INFO %1$s leg, %2$llu samples: RTT p50/p90/p99 < %3$.1f/%4$.1f/%5$.1f ms, "
+		         "delivery rate p50/p90/p99 < %6$.1f/%7$.1f/%8$.1f Mbit/s, %9$llu retransmits\n"),
+			metrics_leg_names[l], (unsigned long long)samples,
+			histogram_quantile(t.rtt[l], .5) / 1e3, histogram_quantile(t.rtt[l], .9) / 1e3,
+			histogram_quantile(t.rtt[l], .99) / 1e3,
+			histogram_quantile(t.delivery_rate[l], .5) * 8 / 1e6,
+			histogram_quantile(t.delivery_rate[l], .9) * 8 / 1e6,
+			histogram_quantile(t.delivery_rate[l], .99) * 8 / 1e6,
+			(unsigned long long)t.retransmits[l]);
+	}
+}
+
+/**
+ * Switch to the metrics of the new instance, once one took over and replaced
+ * the file. Returns whether it switched.
+ */
+static bool follow_upgrade(std::auto_ptr<MetricsSegment> &m, std::string const &filename) throw() {
+	if( ! m->replaced(filename) ) return false;
+	try {
+		m.reset( MetricsSegment::open(filename) );
+	} catch( Errno & ) {
+		// Not filled in yet, try again next time
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Print the rates every interval seconds, until killed
+ */
+static void print_rates(std::auto_ptr<MetricsSegment> &m, std::string const &filename,
+                        unsigned int const interval) {
+	unsigned int workers = m->header()->workers;
+	struct totals prev, cur;
+	sum(*m, 0, workers, prev);
+	for( unsigned int line = 0; ; line++ ) {
+		sleep(interval);
+		if( follow_upgrade(m, filename) ) {
+			// The counters start over, rates are taken from here on
+			workers = m->header()->workers;
+			sum(*m, 0, workers, prev);
+			/* TRANSLATORS: %1$llu contains the PID */
+			printf(_("Now showing PID %1$llu\n"), (unsigned long long)m->header()->pid);
+			line = -1;
+			continue;
+		}
+		sum(*m, 0, workers, cur);
+		if( line % 20 == 0 ) {
+			printf("%10s %8s %10s %14s %14s %12s\n",
+				_("accepts/s"), _("active"), _("failed/s"),
+				_("C>S bytes/s"), _("S>C bytes/s"), _("buffers"));
+		}
+		printf("%10.1f %8llu %10.1f %14.0f %14.0f %12llu\n",
+			(double)(cur.accepted - prev.accepted) / interval,
+			(unsigned long long)cur.active,
+			(double)(connect_failures(cur) - connect_failures(prev)) / interval,
+			(double)(cur.bytes_c_to_s - prev.bytes_c_to_s) / interval,
+			(double)(cur.bytes_s_to_c - prev.bytes_s_to_c) / interval,
+			(unsigned long long)cur.buffer_bytes);
+		fflush(stdout);
+		prev = cur;
+	}
+}
+
+static void prometheus_metric(std::ostringstream &out, char const *name, char const *type,
+                              char const *help, uint64_t const value) {
+	out << "# HELP " << name << " " << help << "\n"
+	    << "# TYPE " << name << " " << type << "\n"
+	    << name << " " << value << "\n";
+}
+
+/**
+ * A histogram per leg; the bucket bounds are multiplied by scale, to get
+ * them in the unit of the metric
+ */
+static void prometheus_histogram(std::ostringstream &out, char const *name, char const *help,
+                                 struct metrics_histogram const h[METRICS_LEGS], double const scale) {
+	out.precision(12); // the bounds and sums are doubles
+	out << "# HELP " << name << " " << help << "\n"
+	    << "# TYPE " << name << " histogram\n";
+	for( unsigned int l = 0; l < METRICS_LEGS; l++ ) {
+		uint64_t cumulative = 0;
+		for( unsigned int b = 0; b < METRICS_HISTOGRAM_BUCKETS - 1; b++ ) {
+			cumulative += h[l].buckets[b];
+			out << name << "_bucket{leg=\"" << metrics_leg_names[l] << "\",le=\""
+			    << (double)(1ULL << b) * scale << "\"} " << cumulative << "\n";
+		}
+		cumulative += h[l].buckets[METRICS_HISTOGRAM_BUCKETS - 1];
+		out << name << "_bucket{leg=\"" << metrics_leg_names[l] << "\",le=\"+Inf\"} " << cumulative << "\n"
+		    << name << "_sum{leg=\"" << metrics_leg_names[l] << "\"} " << h[l].sum * scale << "\n"
+		    << name << "_count{leg=\"" << metrics_leg_names[l] << "\"} " << cumulative << "\n";
+	}
+}
+
+/**
+ * The current values in the Prometheus text exposition format
+ */
+static std::string prometheus_text(MetricsSegment const &m) {
+	struct metrics_header const *h = m.header();
+	struct totals t;
+	sum(m, 0, h->workers, t);
+
+	std::ostringstream out;
+	prometheus_metric(out, "tcp_intercept_connections_accepted_total", "counter",
+		"Connections accepted", t.accepted);
+	prometheus_metric(out, "tcp_intercept_connections_active", "gauge",
+		"Connections being relayed", t.active);
+	prometheus_metric(out, "tcp_intercept_connections_closed_total", "counter",
+		"Connections closed", t.closed);
+	out << "# HELP tcp_intercept_connect_failures_total Failed connects to the server\n"
+	    << "# TYPE tcp_intercept_connect_failures_total counter\n";
+	for( unsigned int e = 0; e < METRICS_CONNECT_ERRNOS; e++ ) {
+		out << "tcp_intercept_connect_failures_total{errno=\"" << metrics_connect_errno_names[e] << "\"} "
+		    << t.connect_failed[e] << "\n";
+	}
+	out << "# HELP tcp_intercept_bytes_total Bytes relayed\n"
+	    << "# TYPE tcp_intercept_bytes_total counter\n"
+	    << "tcp_intercept_bytes_total{direction=\"client_to_server\"} " << t.bytes_c_to_s << "\n"
+	    << "tcp_intercept_bytes_total{direction=\"server_to_client\"} " << t.bytes_s_to_c << "\n";
+	prometheus_metric(out, "tcp_intercept_buffer_bytes", "gauge",
+		"Relay buffer memory held by connections", t.buffer_bytes);
+	prometheus_metric(out, "tcp_intercept_buffer_memory_limit_bytes", "gauge",
+		"Limit on the relay buffer memory, 0 if unlimited", h->buffer_memory_limit);
+	prometheus_metric(out, "tcp_intercept_start_time_seconds", "gauge",
+		"Start time of the process since the epoch", h->start_time);
+	prometheus_histogram(out, "tcp_intercept_rtt_seconds",
+		"Smoothed RTT of the TCP_INFO samples", t.rtt, 1e-6);
+	prometheus_histogram(out, "tcp_intercept_delivery_rate_bytes",
+		"Delivery rate in bytes per second of the TCP_INFO samples", t.delivery_rate, 1);
+	out << "# HELP tcp_intercept_retransmits_total Segments retransmitted, of closed connections\n"
+	    << "# TYPE tcp_intercept_retransmits_total counter\n";
+	for( unsigned int l = 0; l < METRICS_LEGS; l++ ) {
+		out << "tcp_intercept_retransmits_total{leg=\"" << metrics_leg_names[l] << "\"} "
+		    << t.retransmits[l] << "\n";
+	}
+	return out.str();
+}
+
+/**
+ * Answer every connection on the Unix socket at path with an HTTP response
+ * holding the current values. One request at a time is plenty for scraping,
+ * as long as no client can hold it up for long.
+ */
+static void serve_prometheus(std::auto_ptr<MetricsSegment> &m, std::string const &filename,
+                             std::string const &path) throw(Errno) {
+	struct sockaddr_un sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if( path.size() >= sizeof(sa.sun_path) ) throw Errno("Socket path too long", ENAMETOOLONG);
+	strcpy(sa.sun_path, path.c_str());
+
+	Socket s_listen( Socket::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0) );
+	unlink(path.c_str()); // left behind by a previous run
+	s_listen.bind(reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa));
+	s_listen.listen(16);
+
+	while( true ) {
+		try {
+			Socket s( Socket::accept(s_listen, NULL, NULL) );
+			// A client that never sends (or never reads) must not hold up
+			// the next scrape
+			struct timeval timeout = { 5, 0 };
+			s.setsockopt(SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			s.setsockopt(SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+			// The request itself doesn't matter, but read it so closing
+			// doesn't reset the connection
+			char request[4096];
+			s.try_recv(request, sizeof(request));
+
+			follow_upgrade(m, filename);
+			std::string body = prometheus_text(*m);
+			std::ostringstream response;
+			response << "HTTP/1.0 200 OK\r\n"
+			         << "Content-Type: text/plain; version=0.0.4\r\n"
+			         << "Content-Length: " << body.size() << "\r\n"
+			         << "\r\n"
+			         << body;
+			std::string r = response.str();
+			for( size_t sent = 0; sent < r.size(); ) {
+				ssize_t rv = s.try_send(r.data() + sent, r.size() - sent, MSG_NOSIGNAL);
+				if( rv == -EINTR ) continue;
+				if( rv <= 0 ) break; // Client went away, or timed out
+				sent += rv;
+			}
+		} catch( Errno &e ) {
+			// E.g. ECONNABORTED or EMFILE: keep serving the next ones, but
+			// don't spin when the error persists
+			fprintf(stderr, _("Error: %s\n"), e.what());
+			sleep(1);
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
+	setlocale (LC_ALL, "");
+	bindtextdomain(PACKAGE, LOCALEDIR);
+	textdomain(PACKAGE);
+
+	unsigned int interval = 0;
+	bool per_worker = false;
+	std::string prometheus_socket;
+
+	{ // Parse options
+		char optstring[] = "hVwi:P:";
+		struct option longopts[] = {
+			{"help",			no_argument, NULL, 'h'},
+			{"version",			no_argument, NULL, 'V'},
+			{"workers",			no_argument, NULL, 'w'},
+			{"interval",		required_argument, NULL, 'i'},
+			{"prometheus",		required_argument, NULL, 'P'},
+			{NULL, 0, 0, 0}
+		};
+		int longindex;
+		int opt;
+		while( (opt = getopt_long(argc, argv, optstring, longopts, &longindex)) != -1 ) {
+			switch(opt) {
+			case 'h':
+			case '?':
+				std::cerr << _(
+				//  >---------------------- Standard terminal width ---------------------------------<
+					"Usage: tcp-intercept-stat [options] metrics-file\n"
+					"Shows the counters of a tcp-intercept started with --metrics metrics-file\n"
+					"Options:\n"
+					"  -h --help                       Displays this help message and exits\n"
+					"  -V --version                    Displays the version and exits\n"
+					"  -w --workers                    Show the counters of every worker\n"
+					"  --interval -i n                 Show the rates every n seconds\n"
+					"  --prometheus -P socket          Serve the counters in the Prometheus text\n"
+					"                                  format over HTTP on a Unix socket\n"
+					);
+				if( opt == '?' ) exit(EX_USAGE);
+				exit(EX_OK);
+			case 'V':
+				printf(_("%1$s version %2$s\n"), "tcp-intercept-stat",
+				       PACKAGE_VERSION " (" PACKAGE_GITREVISION ")");
+				exit(EX_OK);
+			case 'w':
+				per_worker = true;
+				break;
+			case 'i': {
+				char *end;
+				long n = strtol(optarg, &end, 10);
+				if( *end != '\0' || end == optarg || n < 1 ) {
+					fprintf(stderr, _("Invalid value for %1$s: \"%2$s\"\n"), "--interval", optarg);
+					exit(EX_USAGE);
+				}
+				interval = n;
+				break;
+				}
+			case 'P':
+				prometheus_socket = optarg;
+				break;
+			}
+		}
+	}
+	if( optind != argc - 1 ) {
+		fprintf(stderr, _("No metrics file given, see --help\n"));
+		exit(EX_USAGE);
+	}
+
+	std::auto_ptr<MetricsSegment> m;
+	try {
+		m.reset( MetricsSegment::open(argv[optind]) );
+	} catch( Errno &e ) {
+		fprintf(stderr, _("Could not read \"%1$s\": %2$s\n"), argv[optind], e.what());
+		exit(EX_NOINPUT);
+	}
+
+	try {
+		if( ! prometheus_socket.empty() ) {
+			serve_prometheus(m, argv[optind], prometheus_socket);
+		} else if( interval > 0 ) {
+			print_rates(m, argv[optind], interval);
+		} else {
+			print_totals(*m, per_worker);
+		}
+	} catch( Errno &e ) {
+		fprintf(stderr, _("Error: %s\n"), e.what());
+		exit(EX_OSERR);
+	}
+	return EX_OK;
+}
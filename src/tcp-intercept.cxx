@@ -1,35 +1,159 @@
 #include "../config.h"
 
 #include <iostream>
+#include <algorithm>
 #include <fstream>
 #include <getopt.h>
 #include <netinet/in.h>
 #include <ev.h>
 #include <sysexits.h>
-
-#include <boost/ptr_container/ptr_list.hpp>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/intrusive/list.hpp>
 
 #include "gettext.h"
 #define _(String) gettext(String)
 #define N_(String) String
 
 #include "../Socket/Socket.hxx"
+#include "Pipe.hxx"
+#include "Slab.hxx"
+#include "RingBuffer.hxx"
+#include "BufferPool.hxx"
+#include "TimerWheel.hxx"
+#include "LocalAddresses.hxx"
+#include "IoUring.hxx"
+#include "Metrics.hxx"
+#include "AsyncLog.hxx"
+#include "Handoff.hxx"
+#include "SockMap.hxx"
+#include "TokenBucket.hxx"
+#include "TcpInfo.hxx"
 #include <libsimplelog.h>
 #include <libdaemon/daemon.h>
 #include <netinet/tcp.h>
+#if HAVE_LINUX_MPTCP_H
+#include <linux/mptcp.h>
+#endif
+
+#ifndef IPPROTO_MPTCP
+#define IPPROTO_MPTCP 262
+#endif
+#ifndef SOL_MPTCP
+#define SOL_MPTCP 284
+#endif
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24
+#endif
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+#ifndef TCP_NOTSENT_LOWAT
+#define TCP_NOTSENT_LOWAT 25
+#endif
 
 std::string logfilename;
 FILE *logfile;
 
-static const int MAX_CONN_BACKLOG = 32;
+static const int DEFAULT_CONN_BACKLOG = SOMAXCONN;
 
-std::auto_ptr<SockAddr::SockAddr> bind_listen_addr;
-std::auto_ptr<SockAddr::SockAddr> bind_addr_outgoing;
+std::vector< SockAddr::SockAddr > bind_listen_addrs;
+SockAddr::SockAddr bind_addr_outgoing; // unset: connect from the client's address
 bool keepalive = false;
+int keepalive_idle = 0, keepalive_interval = 0; // seconds, 0: system default
+int user_timeout = 0; // TCP_USER_TIMEOUT in ms, 0: system default
 bool nodelay = false;
+bool fastopen = false; // TCP Fast Open towards the client and the server
+bool use_splice = false;
+std::string congestion_client; // empty: system default
+std::string congestion_server;
+bool use_mptcp = false;
+unsigned int accept_batch = 64;
+
+// Relay buffers (one per direction) are taken from the worker's BufferPool
+// when data comes in, and given back when they run empty
+MemoryBudget buffer_budget;
+size_t buffer_size = 65536; // reading stops when a buffer is full
+size_t buffer_low_watermark = 0; // ... and resumes when it drained to this
+int client_rcvbuf = 0, client_sndbuf = 0; // 0: kernel default
+int server_rcvbuf = 0, server_sndbuf = 0;
+// TCP_NOTSENT_LOWAT on both legs, 0: kernel default. When set, a direction
+// reads at most this much at a time, and only once the outgoing socket took
+// everything that was read before, so data waits in the peer's socket
+// instead of in ours.
+size_t notsent_lowat = 0;
+
+// Rate limits in bytes per second, 0: none. Per connection, the kernel paces
+// the sending socket (SO_MAX_PACING_RATE); where it can't, and for all
+// connections together, reading is throttled with a TokenBucket.
+uint64_t rate_limit_c_to_s = 0, rate_limit_s_to_c = 0;
+TokenBucket total_rate_c_to_s, total_rate_s_to_c;
+static const size_t RATE_CHUNK = 16384; // a throttled direction waits for this much
+
+// Timeouts in seconds, 0: none. Every worker keeps them in a TimerWheel, ticking
+// every TIMER_TICK seconds while there are any.
+double connect_timeout = 0;
+double idle_timeout = 0;
+double fin_timeout = 0; // idle timeout once a direction is closed, 0: idle_timeout
+static const double TIMER_TICK = 0.1;
+
+// Hitless upgrade: on SIGUSR2 a new instance is started, and everything is
+// handed over to it
+std::vector<std::string> upgrade_argv; // how to start it
+std::auto_ptr<Handoff> handoff; // to the new instance, or from the previous one
+bool handing_off = false; // the workers stop for a handoff, not to exit
+
+// Relaying in the kernel: once connected, both sockets go in the sockmap
+bool use_sockmap = false;
+std::auto_ptr<SockMap> sockmap; // or the one taken over with the connections
+static const unsigned int SOCKMAP_CONNECTIONS = 65536;
+static const unsigned int SOCKMAP_POLL_MAX = 16; // ticks between polls of idle connections
+
+std::string metrics_filename; // empty: don't share the metrics
+std::auto_ptr<MetricsSegment> metrics;
+std::auto_ptr<AsyncLog> async_log; // messages about connections
+
+// TCP_INFO of both legs, every tcp_info_interval seconds (0: never) and when
+// the connection closes, into the histograms of the metrics and, with a
+// file name, as JSON lines into that file
+double tcp_info_interval = 0;
+std::string tcp_info_filename;
+std::auto_ptr<TcpInfoLog> tcp_info_log;
+
+enum io_engine { ENGINE_LIBEV, ENGINE_IO_URING };
+io_engine engine = ENGINE_LIBEV;
+unsigned int uring_buffer_count = 1024;
+static const unsigned int URING_ENTRIES = 4096;
+static const size_t URING_BUFFER_SIZE = 16384;
+
+/**
+ * With the io_uring engine, the user_data of every submission points to the
+ * connection it is about, with the operation in the lowest bits (connections
+ * are at least 8-byte aligned).
+ */
+enum uring_op {
+	URING_ACCEPT = 0, // points to the listener instead
+	URING_CONNECT,
+	URING_RECV_C,     // C>S direction
+	URING_SEND_S,
+	URING_RECV_S,     // S>C direction
+	URING_SEND_C,
+	URING_POLL,       // readiness poll, linked before a splice
+	URING_IGNORE      // close and cancel, no connection
+};
+static const uintptr_t URING_OP_MASK = 7;
 
-struct connection {
-	std::string id;
+struct connection : public boost::intrusive::list_base_hook<> {
+	ConnectionId id;
 
 	Socket s_client;
 	Socket s_server;
@@ -38,10 +162,359 @@ struct connection {
 	ev_io e_c_read, e_c_write;
 	ev_io e_s_read, e_s_write;
 
-	std::string buf_c_to_s, buf_s_to_c;
+	RingBuffer buf_c_to_s, buf_s_to_c;
+	Pipe *pipe_c_to_s, *pipe_s_to_c; // Only used in splice-mode
 	bool con_open_c_to_s, con_open_s_to_c;
+	bool server_mptcp; // s_server was opened as an MPTCP socket
+
+	// Only used with the io_uring engine
+	SockAddr::SockAddr server_addr;
+	struct uring_direction {
+		int buf_id; // provided buffer holding data to send, or -1
+		unsigned int len, sent;
+	} uring_c_to_s, uring_s_to_c;
+	unsigned int uring_pending; // submissions that still refer to this connection
+	bool uring_dead;
+
+	// Only used when the sockmap relays the connection: the kernel doesn't
+	// tell us anything, the timer polls the counters of the sockets
+	bool sockmap;
+	struct sockmap_direction {
+		uint64_t sent_offset; // what tx counted as sent before relaying started
+		uint64_t relayed;     // sent on to tx since, counted in the metrics
+		bool paused;          // tx has too much queued, rx is out of the sockmap
+		uint64_t paused_at;   // ... since rx had received this much
+		bool refused;         // ... and can't go back in, it got the FIN
+		bool userspace;       // relayed as usual, after it was refused
+		bool draining;        // EOF seen, the FIN waits until the rest went out
+	} sockmap_c_to_s, sockmap_s_to_c;
+	unsigned int sockmap_interval; // ticks until the next poll
+
+	// Per connection rate limits, only when the kernel can't pace the sending socket
+	TokenBucket rate_c_to_s, rate_s_to_c;
+
+	// Timeouts: the timer is not moved on every read or write, it checks
+	// last_active when it expires
+	TimerWheel::Timer timer;
+	TimerWheel::Timer tcp_info_timer; // next TCP_INFO sample, in the same wheel
+	ev_tstamp last_active;
+	bool connected; // to the server
+};
+
+/**
+ * A listening socket of a worker, for one of the --bind-listen addresses
+ */
+struct listener {
+	Socket s_listen;
+	ev_io e_listen;
+	bool uring_accepting; // the multishot accept is armed
+
+	listener() throw() : uring_accepting(false) {}
+};
+
+/**
+ * Every worker thread runs its own event loop, with its own listening socket
+ * for every address (each bound to the same address as the other workers'
+ * with SO_REUSEPORT, the kernel distributes incoming connections over them)
+ * and its own set of connections.
+ * Nothing in here is shared between threads.
+ */
+struct worker {
+	unsigned int number;
+	pthread_t thread;
+	struct ev_loop *loop;
+	struct worker_metrics *metrics; // this worker's slot in the shared segment
+	AsyncLog::Ring *log_ring;
+	TcpInfoLog::Ring *tcp_info_ring; // NULL: samples only go in the metrics
+
+	boost::ptr_vector< struct listener > listeners; // in the order of bind_listen_addrs
+	ev_async e_stop;
+
+	// Only used when listening on the wildcard address
+	std::auto_ptr<LocalAddresses> local_addrs;
+	ev_io e_local_addrs;
+
+	Slab< struct connection > connection_slab;
+	boost::intrusive::list< struct connection > connections;
+	std::vector< struct connection* > connections_by_fd; // indexed by s_client
+	PipePool pipe_pool;
+	BufferPool buffer_pool;
+	// Read watchers that were stopped because the memory budget was exhausted
+	std::vector< ev_io* > memory_starved;
+	ev_timer e_memory_retry;
+	// Read watchers that were stopped by a rate limit
+	std::vector< ev_io* > rate_starved;
+	ev_timer e_rate_retry;
+	TimerWheel timers;
+	std::vector< TimerWheel::Timer* > timers_expired;
+	ev_timer e_timers;
+	// Accepting stops for a while when we run out of file descriptors
+	ev_timer e_accept_retry;
+
+	// Only used with the io_uring engine
+	std::auto_ptr<IoUring> uring;
+	std::auto_ptr<ProvidedBuffers> uring_buffers;
+	int uring_eventfd;
+	ev_io e_uring;
+	ev_prepare e_uring_submit;
+	// Directions that could not receive because all buffers were in use
+	std::vector< std::pair<struct connection*, bool> > uring_starved;
+	// ... or because a rate limit held them back, retried by e_rate_retry
+	std::vector< std::pair<struct connection*, bool> > uring_rate_starved;
+	bool uring_quiescing; // winding down for a handoff, see uring_quiesce()
+
+	worker() throw() : tcp_info_ring(NULL), buffer_pool(buffer_budget, buffer_size), uring_eventfd(-1),
+	                   uring_quiescing(false) {}
+
+	void add_connection(struct connection *con) {
+		int fd = con->s_client;
+		if( fd >= (signed)connections_by_fd.size() ) connections_by_fd.resize(fd + 1, NULL);
+		connections_by_fd[fd] = con;
+		connections.push_back(*con);
+		metrics_add(metrics->active, 1);
+	}
+	void remove_connection(struct connection *con) throw() {
+		timers.cancel(&con->timer);
+		timers.cancel(&con->tcp_info_timer);
+		connections_by_fd[ con->s_client ] = NULL;
+		connections.erase( connections.iterator_to(*con) );
+		put_buffer( con->buf_c_to_s );
+		put_buffer( con->buf_s_to_c );
+		close_async(con->s_client);
+		close_async(con->s_server);
+		connection_slab.free(con);
+		metrics_sub(metrics->active, 1);
+		metrics_add(metrics->closed, 1);
+	}
+	void put_buffer(RingBuffer &buf) throw() {
+		if( ! buf.attached() ) return;
+		size_t size = buf.capacity(); // larger than usual for handed over data
+		buffer_pool.put(buf.detach(), size);
+		metrics_sub(metrics->buffer_bytes, size);
+	}
+	/**
+	 * With io_uring, batch the close() with the other submissions
+	 * Otherwise (or when the ring is full), the Socket closes itself.
+	 */
+	void close_async(Socket &s) throw() {
+		if( uring.get() == NULL || s == -1 ) return;
+		struct io_uring_sqe *sqe = uring->get_sqe();
+		if( sqe == NULL ) return;
+		IoUring::prep_close(sqe, s.release());
+		sqe->user_data = URING_IGNORE;
+	}
+	struct connection* connection_by_fd(int fd) const throw() {
+		if( fd < 0 || fd >= (signed)connections_by_fd.size() ) return NULL;
+		return connections_by_fd[fd];
+	}
+
+	~worker() throw() {
+		// Tear down the ring first, connections are closed synchronously
+		if( uring_buffers.get() != NULL ) {
+			buffer_budget.release( uring_buffer_count * uring_buffers->buffer_size() );
+		}
+		uring_buffers.reset();
+		uring.reset();
+		if( uring_eventfd != -1 ) close(uring_eventfd);
+		while( !connections.empty() ) remove_connection( &connections.front() );
+	}
 };
-boost::ptr_list< struct connection > connections;
+boost::ptr_vector< struct worker > workers;
+ev_async e_worker_failed;
+bool worker_failed = false;
+
+inline static struct worker* this_worker(EV_P) {
+	return reinterpret_cast<struct worker*>( ev_userdata(EV_A) );
+}
+
+/**
+ * Log a message about a connection through the log thread
+ * format is passed untranslated (N_()), it gets the connection ID as %1$s,
+ * arg1 and arg2 as %2$s and %3$s. Those are only translated when translate
+ * says they are N_() strings (AsyncLog::TRANSLATE_ARG1, ...). Nothing is
+ * formatted unless the level is enabled.
+ */
+inline static void log_connection(struct worker *wrk, int const level, struct connection const *con,
+                                  char const *format, char const *arg1 = "", char const *arg2 = "",
+                                  unsigned int const translate = 0) throw() {
+	if( ! log_enabled(level) ) return;
+	wrk->log_ring->push(level, format, con->id, arg1, arg2, translate);
+}
+
+/**
+ * The timeout that applies to con in its current state, 0 if none
+ * what is set to its name, for logging.
+ */
+static double connection_timeout(struct connection const *con, char const **what) throw() {
+	if( ! con->connected ) {
+		*what = N_("connect");
+		return connect_timeout;
+	}
+	if( ( ! con->con_open_c_to_s || ! con->con_open_s_to_c ) && fin_timeout > 0 ) {
+		*what = N_("half-close");
+		return fin_timeout;
+	}
+	*what = N_("idle");
+	return idle_timeout;
+}
+
+/**
+ * Have the timer wheel tick, before something is scheduled in it
+ */
+static void timers_start(struct worker *wrk) throw() {
+	if( ! wrk->timers.empty() ) return;
+	// The wheel wasn't ticking, bring its time up to date first
+	wrk->timers.advance( (uint64_t)(ev_now(wrk->loop) / TIMER_TICK), wrk->timers_expired );
+	ev_timer_again( wrk->loop, &wrk->e_timers );
+}
+
+/**
+ * Sample TCP_INFO of both legs of con
+ * final marks the last sample, when the connection closes: only that one
+ * counts the retransmits, so they are counted once.
+ */
+static void tcp_info_sample(struct worker *wrk, struct connection *con, bool const final) throw() {
+	TcpInfoSample sample;
+	sample.time = ev_now(wrk->loop);
+	sample.id = con->id;
+	sample.final = final;
+	Socket *legs[METRICS_LEGS] = { &con->s_client, &con->s_server };
+	for( unsigned int leg = 0; leg < METRICS_LEGS; leg++ ) {
+		if( leg == TCP_INFO_SERVER && ! con->connected ) break;
+		if( *legs[leg] == -1 || ! sample.read(*legs[leg]) ) continue;
+		sample.leg = leg;
+		if( sample.rtt != 0 ) metrics_observe(wrk->metrics->rtt[leg], sample.rtt);
+		if( sample.delivery_rate != 0 ) metrics_observe(wrk->metrics->delivery_rate[leg], sample.delivery_rate);
+		if( final ) metrics_add(wrk->metrics->retransmits[leg], sample.total_retrans);
+		if( wrk->tcp_info_ring != NULL ) wrk->tcp_info_ring->push(sample);
+	}
+}
+
+/**
+ * Schedule the next periodic TCP_INFO sample of con
+ */
+static void tcp_info_schedule(struct worker *wrk, struct connection *con) throw() {
+	if( tcp_info_interval <= 0 ) return;
+	timers_start(wrk);
+	con->tcp_info_timer.data = con;
+	wrk->timers.schedule( &con->tcp_info_timer,
+		wrk->timers.now() + std::max<uint64_t>(1, (uint64_t)(tcp_info_interval / TIMER_TICK + 0.5)) );
+}
+
+/**
+ * The last TCP_INFO sample of con, just before it is closed
+ */
+static void tcp_info_final(struct worker *wrk, struct connection *con) throw() {
+	if( tcp_info_interval <= 0 && wrk->tcp_info_ring == NULL ) return;
+	wrk->timers.cancel(&con->tcp_info_timer);
+	tcp_info_sample(wrk, con, true);
+}
+
+/**
+ * (Re)schedule the timer of con for the timeout of its current state, or
+ * for its next poll when the sockmap relays it
+ * Only needed when the state changes, not on every bit of activity.
+ */
+static void connection_timer_update(struct worker *wrk, struct connection *con) throw() {
+	char const *what;
+	double timeout = connection_timeout(con, &what);
+	if( timeout <= 0 && ! con->sockmap ) return wrk->timers.cancel(&con->timer);
+	timers_start(wrk);
+	uint64_t expires = (uint64_t)-1;
+	if( timeout > 0 ) expires = (uint64_t)((con->last_active + timeout) / TIMER_TICK) + 1;
+	if( con->sockmap ) expires = std::min( expires, wrk->timers.now() + con->sockmap_interval );
+	con->timer.data = con;
+	wrk->timers.schedule( &con->timer, expires );
+}
+
+void kill_connection(EV_P_ struct connection *con);
+static void uring_kill(struct worker *wrk, struct connection *con) throw();
+static void uring_finish(struct worker *wrk, struct connection *con) throw();
+static void uring_recv(struct worker *wrk, struct connection *con, bool const c_to_s) throw(Errno);
+static bool sockmap_poll(EV_P_ struct connection *con);
+static void client_ready_read(EV_P_ ev_io *w, int revents);
+static void server_ready_read(EV_P_ ev_io *w, int revents);
+
+/**
+ * Take the sample timer of con out of the timers that expired in this tick,
+ * from entry first on, before con may be closed. If it was there, the sample
+ * is taken now.
+ */
+static void timers_forget(struct worker *wrk, size_t const first, struct connection *con) throw() {
+	for( size_t n = first; n < wrk->timers_expired.size(); n++ ) {
+		if( wrk->timers_expired[n] != &con->tcp_info_timer ) continue;
+		wrk->timers_expired[n] = NULL;
+		tcp_info_sample(wrk, con, false);
+		tcp_info_schedule(wrk, con);
+	}
+}
+
+static void timers_tick(EV_P_ ev_timer *w, int revents) {
+	struct worker *wrk = this_worker(EV_A);
+	ev_tstamp now = ev_now(EV_A);
+	wrk->timers.advance( (uint64_t)(now / TIMER_TICK), wrk->timers_expired );
+	for( size_t n = 0; n < wrk->timers_expired.size(); n++ ) {
+		TimerWheel::Timer *t = wrk->timers_expired[n];
+		if( t == NULL ) continue; // its connection was closed
+		struct connection *con = reinterpret_cast<struct connection*>( t->data );
+		if( t == &con->tcp_info_timer ) {
+			tcp_info_sample(wrk, con, false);
+			tcp_info_schedule(wrk, con);
+			continue;
+		}
+		// Closing con below frees it: its sample may still be further down
+		timers_forget(wrk, n + 1, con);
+		if( con->sockmap && ! sockmap_poll(EV_A_ con) ) continue; // it was closed
+		char const *what;
+		double timeout = connection_timeout(con, &what);
+		if( timeout <= 0 || con->last_active + timeout > now ) {
+			// Polled, or there was activity since it was scheduled
+			connection_timer_update(wrk, con);
+			continue;
+		}
+		/* TRANSLATORS: %1$s contains the connection ID,
+		   %2$s which timeout (separately translated) */
+		log_connection(wrk, LEVEL_INFO, con, N_("%1$s: %2$s timeout, closing"), what, "", AsyncLog::TRANSLATE_ARG1);
+		if( wrk->uring.get() != NULL ) {
+			uring_kill(wrk, con);
+		} else {
+			kill_connection(EV_A_ con);
+		}
+	}
+	wrk->timers_expired.clear();
+	if( wrk->timers.empty() ) ev_timer_stop(EV_A_ w);
+}
+
+/**
+ * Set TCP_NOTSENT_LOWAT on s, if asked for
+ * Not all kernels support it on MPTCP sockets; those relay without, which
+ * only makes it less effective.
+ */
+static void set_notsent_lowat(Socket &s) throw() {
+	if( notsent_lowat == 0 ) return;
+	int val = notsent_lowat;
+	setsockopt(s, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &val, sizeof(val));
+}
+
+/**
+ * Set the per-socket keepalive and user timeout options on s
+ */
+static void set_timeout_options(Socket &s) throw(Errno) {
+	//Take care of socks hanging in ESTABLISHED/CLOSE_WAIT/FIN_WAIT2 states
+	if( keepalive ) {
+		int val = 1;
+		s.setsockopt(SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val));
+		if( keepalive_idle > 0 ) {
+			s.setsockopt(IPPROTO_TCP, TCP_KEEPIDLE, &keepalive_idle, sizeof(keepalive_idle));
+		}
+		if( keepalive_interval > 0 ) {
+			s.setsockopt(IPPROTO_TCP, TCP_KEEPINTVL, &keepalive_interval, sizeof(keepalive_interval));
+		}
+	}
+	if( user_timeout > 0 ) {
+		s.setsockopt(IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout));
+	}
+}
 
 
 void received_sigint(EV_P_ ev_signal *w, int revents) throw() {
@@ -56,10 +529,11 @@ void received_sigterm(EV_P_ ev_signal *w, int revents) throw() {
 void received_sighup(EV_P_ ev_signal *w, int revents) throw() {
 	LogInfo(_("Received SIGHUP, closing this logfile"));
 	if( logfilename.size() > 0 ) {
-		fclose(logfile);
-		logfile = fopen(logfilename.c_str(), "a");
+		// freopen() keeps the FILE* valid for the worker threads
+		logfile = freopen(logfilename.c_str(), "a", logfile);
 		LogSetOutputFile(NULL, logfile);
 	} /* else we're still logging to stderr, which doesn't need reopening */
+	if( tcp_info_log.get() != NULL ) tcp_info_log->reopen();
 	LogInfo(_("Received SIGHUP, (re)opening this logfile"));
 }
 
@@ -67,25 +541,305 @@ void received_sigpipe(EV_P_ ev_signal *w, int revents) throw() {
 	LogDebug(_("Received SIGPIPE, ignoring"));
 }
 
+void received_worker_failed(EV_P_ ev_async *w, int revents) throw() {
+	LogError(_("A worker thread failed, exiting"));
+	worker_failed = true;
+	ev_break(EV_A_ EVUNLOOP_ALL);
+}
+
+static void uring_quiesce(EV_P) throw();
+void received_stop(EV_P_ ev_async *w, int revents) throw() {
+	if( handing_off && this_worker(EV_A)->uring.get() != NULL ) {
+		// Operations in flight own part of the state, wait for them first
+		return uring_quiesce(EV_A);
+	}
+	ev_break(EV_A_ EVUNLOOP_ALL);
+}
+
+
+/**
+ * Open the socket towards the server in s: MPTCP if asked for, plain TCP if
+ * not, or if the kernel refuses MPTCP (e.g. net.mptcp.enabled=0)
+ * Returns true if it is an MPTCP socket.
+ */
+static bool open_server_socket(Socket &s, int const family) throw(Errno) {
+	if( use_mptcp ) {
+		try {
+			s = Socket::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_MPTCP);
+			return true;
+		} catch( Errno &e ) {
+			if( e.error_number() != ENOPROTOOPT && e.error_number() != EPROTONOSUPPORT
+			    && e.error_number() != EINVAL ) throw;
+		}
+	}
+	s = Socket::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	return false;
+}
+
+/**
+ * Log whether the connection to the server still runs MPTCP, and over how
+ * many subflows; or whether it fell back to plain TCP (e.g. because the
+ * server doesn't speak MPTCP)
+ */
+static void log_mptcp_status(struct worker *wrk, struct connection *con) throw() {
+	if( ! con->server_mptcp || ! log_enabled(LEVEL_INFO) ) return;
+#if HAVE_LINUX_MPTCP_H
+	struct mptcp_info info;
+	memset(&info, 0, sizeof(info));
+	socklen_t len = sizeof(info);
+	// After a fallback, SOL_MPTCP options are passed to TCP, which refuses them
+	if( getsockopt(con->s_server, SOL_MPTCP, MPTCP_INFO, &info, &len) == 0
+#ifdef MPTCP_INFO_FLAG_FALLBACK
+	    && ! (info.mptcpi_flags & MPTCP_INFO_FLAG_FALLBACK)
+#endif
+	    ) {
+		char subflows[16], addrs[16];
+		snprintf(subflows, sizeof(subflows), "%u", info.mptcpi_subflows + 1);
+		snprintf(addrs, sizeof(addrs), "%u", info.mptcpi_add_addr_accepted);
+		log_connection(wrk, LEVEL_INFO, con,
+			/* TRANSLATORS: %1$s contains the connection ID,
+			   %2$s the number of subflows,
+			   %3$s the number of addresses the server announced
+			 */
+			N_("%1$s: MPTCP with %2$s subflows, %3$s addresses announced by the server"),
+			subflows, addrs);
+		return;
+	}
+#endif
+	/* TRANSLATORS: %1$s contains the connection ID */
+	log_connection(wrk, LEVEL_INFO, con, N_("%1$s: MPTCP fell back to TCP"));
+}
+
+/*
+ * sockmap: the kernel relays the data, only the EOF wakes us up. The timer
+ * of the connection polls the counters of both sockets, to keep the metrics
+ * and the idle timeout going, to pause a direction when more than
+ * buffer_size is queued in the kernel for tx (nothing else limits that), and
+ * to only pass the FIN on once everything before it went out.
+ */
+
+/**
+ * Count what one direction relayed since the last poll
+ * Returns how much of what rx received is not sent on to tx yet.
+ */
+static uint64_t sockmap_count(struct worker *wrk, struct connection *con,
+                              struct connection::sockmap_direction &d, bool const con_open,
+                              SockMap::Counters const &rx, SockMap::Counters const &tx,
+                              uint64_t &bytes_sent) throw() {
+	if( d.userspace ) return 0; // counted as usual
+	if( ! con_open && ! d.draining ) return 0; // done, tx counts our FIN now
+	uint64_t relayed = tx.sent - d.sent_offset;
+	if( relayed != d.relayed ) {
+		metrics_add(bytes_sent, relayed - d.relayed);
+		d.relayed = relayed;
+		con->last_active = ev_now(wrk->loop);
+	}
+	uint64_t received = d.paused ? d.paused_at : rx.received;
+	return received > relayed ? received - relayed : 0;
+}
+
+/**
+ * Pause or resume one direction, depending on how much is queued for tx; or
+ * pass on its EOF once nothing is
+ * The kernel only takes established sockets: when rx got the FIN while
+ * paused, the rest of its data is relayed through userspace, with
+ * rx_ready_read, once tx sent everything before it.
+ */
+static void sockmap_direction(EV_P_ struct connection::sockmap_direction &d, bool const con_open,
+                              Socket &rx, ev_io *e_rx_read, uint64_t const rx_received,
+                              void (*rx_ready_read)(EV_P_ ev_io *w, int revents),
+                              Socket &tx, uint64_t const queued) throw(Errno) {
+	if( d.userspace ) {
+		return;
+	} else if( ! con_open ) {
+		if( d.draining && queued == 0 ) {
+			d.draining = false;
+			tx.shutdown(SHUT_WR);
+		}
+	} else if( ! d.paused && queued > buffer_size ) {
+		sockmap->pause(rx);
+		ev_io_stop( EV_A_ e_rx_read ); // it can't see the EOF while paused
+		d.paused = true;
+		d.paused_at = rx_received;
+	} else if( d.refused ) {
+		if( queued == 0 ) {
+			d.paused = false;
+			d.userspace = true;
+			ev_set_cb( e_rx_read, rx_ready_read );
+			ev_io_start( EV_A_ e_rx_read );
+		}
+	} else if( d.paused && queued <= buffer_low_watermark ) {
+		if( sockmap->resume(rx) ) {
+			ev_io_start( EV_A_ e_rx_read );
+			d.paused = false;
+		} else {
+			d.refused = true;
+		}
+	}
+}
+
+/**
+ * Check on a connection the sockmap relays
+ * Returns false if it was closed.
+ */
+static bool sockmap_poll(EV_P_ struct connection *con) {
+	struct worker *wrk = this_worker(EV_A);
+	uint64_t relayed = con->sockmap_c_to_s.relayed + con->sockmap_s_to_c.relayed;
+	try {
+		SockMap::Counters client, server;
+		SockMap::counters(con->s_client, client);
+		SockMap::counters(con->s_server, server);
+		uint64_t queued_c_to_s = sockmap_count(wrk, con, con->sockmap_c_to_s, con->con_open_c_to_s,
+		                                       client, server, wrk->metrics->bytes_c_to_s);
+		uint64_t queued_s_to_c = sockmap_count(wrk, con, con->sockmap_s_to_c, con->con_open_s_to_c,
+		                                       server, client, wrk->metrics->bytes_s_to_c);
+		sockmap_direction(EV_A_ con->sockmap_c_to_s, con->con_open_c_to_s,
+		                  con->s_client, &con->e_c_read, client.received, client_ready_read,
+		                  con->s_server, queued_c_to_s);
+		sockmap_direction(EV_A_ con->sockmap_s_to_c, con->con_open_s_to_c,
+		                  con->s_server, &con->e_s_read, server.received, server_ready_read,
+		                  con->s_client, queued_s_to_c);
+	} catch( Errno &e ) {
+		/* TRANSLATORS: %1$s contains the connection ID,
+		   %2$s the error */
+		log_connection(wrk, LEVEL_ERROR, con, N_("%1$s: sockmap: %2$s"), e.what());
+		kill_connection(EV_A_ con);
+		return false;
+	}
+
+	if( ! con->con_open_c_to_s && ! con->con_open_s_to_c
+	    && ! con->sockmap_c_to_s.draining && ! con->sockmap_s_to_c.draining
+	    && con->buf_c_to_s.empty() && con->buf_s_to_c.empty()
+	    && con->pipe_c_to_s == NULL && con->pipe_s_to_c == NULL ) {
+		kill_connection(EV_A_ con);
+		return false;
+	}
+	// Every tick while data flows, less often when it doesn't
+	if( relayed != con->sockmap_c_to_s.relayed + con->sockmap_s_to_c.relayed
+	    || con->sockmap_c_to_s.paused || con->sockmap_s_to_c.paused
+	    || con->sockmap_c_to_s.draining || con->sockmap_s_to_c.draining ) {
+		con->sockmap_interval = 1;
+	} else {
+		con->sockmap_interval = std::min(2 * con->sockmap_interval, SOCKMAP_POLL_MAX);
+	}
+	return true;
+}
+
+/**
+ * A socket the sockmap relays became readable: the data itself never gets
+ * here, so it's the EOF (or an error)
+ */
+static void sockmap_ready_read(EV_P_ ev_io *w, int revents) {
+	struct connection* con = reinterpret_cast<struct connection*>( w->data );
+	bool c_to_s = w == &con->e_c_read;
+	char const *dir = c_to_s ? N_("C>S") : N_("S>C");
+	try {
+		char c;
+		ssize_t rv = (c_to_s ? con->s_client : con->s_server).try_recv(&c, 1, MSG_PEEK | MSG_DONTWAIT);
+		if( Socket::is_transient_error(rv) ) {
+			return; // Spurious wakeup, wait for the next one
+		} else if( rv < 0 ) {
+			throw Errno("Could not recv()", -rv);
+		} else if( rv > 0 ) {
+			// Relaying it from here could put it behind what the kernel relays
+			throw Errno("Data went past the sockmap", EPROTO);
+		}
+		log_connection(this_worker(EV_A), LEVEL_INFO, con, N_("%1$s %2$s: EOF"), dir, "", AsyncLog::TRANSLATE_ARG1);
+		ev_io_stop( EV_A_ w );
+		(c_to_s ? con->con_open_c_to_s : con->con_open_s_to_c) = false;
+		(c_to_s ? con->sockmap_c_to_s : con->sockmap_s_to_c).draining = true;
+	} catch( Errno &e ) {
+		log_connection(this_worker(EV_A), LEVEL_ERROR, con, N_("%1$s %2$s: Error: %3$s)"), dir, e.what(), AsyncLog::TRANSLATE_ARG1);
+		kill_connection(EV_A_ con);
+		return;
+	}
+	// Usually everything went out already, and the FIN goes right away
+	if( sockmap_poll(EV_A_ con) ) connection_timer_update(this_worker(EV_A), con);
+}
+
+/**
+ * Let the sockmap relay a connection that just connected to the server,
+ * with libev
+ * Returns false if the kernel refused, then it's relayed as usual.
+ */
+static bool sockmap_start(EV_P_ struct connection *con) {
+	struct worker *wrk = this_worker(EV_A);
+	try {
+		// Nothing was sent on either socket yet, these only count the SYN
+		SockMap::Counters client, server;
+		SockMap::counters(con->s_client, client);
+		SockMap::counters(con->s_server, server);
+		if( ! sockmap->insert(con->s_client, con->s_server) ) return false;
+		con->sockmap_c_to_s.sent_offset = server.sent;
+		con->sockmap_s_to_c.sent_offset = client.sent;
+	} catch( Errno &e ) {
+		log_connection(wrk, LEVEL_ERROR, con, N_("%1$s: sockmap: %2$s"), e.what());
+		kill_connection(EV_A_ con);
+		return true;
+	}
+	con->sockmap = true;
+	con->sockmap_c_to_s.relayed = con->sockmap_s_to_c.relayed = 0;
+	con->sockmap_c_to_s.paused = con->sockmap_s_to_c.paused = false;
+	con->sockmap_c_to_s.refused = con->sockmap_s_to_c.refused = false;
+	con->sockmap_c_to_s.userspace = con->sockmap_s_to_c.userspace = false;
+	con->sockmap_c_to_s.draining = con->sockmap_s_to_c.draining = false;
+	con->sockmap_interval = 1;
+
+	/* TRANSLATORS: %1$s contains the connection ID */
+	log_connection(wrk, LEVEL_INFO, con, N_("%1$s: relaying in the kernel"));
+	ev_set_cb( &con->e_c_read, sockmap_ready_read );
+	ev_set_cb( &con->e_s_read, sockmap_ready_read );
+	ev_io_start( EV_A_ &con->e_c_read );
+	ev_io_start( EV_A_ &con->e_s_read );
+	connection_timer_update(wrk, con);
+	return true;
+}
 
 void kill_connection(EV_P_ struct connection *con) {
+	struct worker *wrk = this_worker(EV_A);
+
 	// Remove from event loops
 	ev_io_stop(EV_A_ &con->e_c_read );
 	ev_io_stop(EV_A_ &con->e_c_write );
 	ev_io_stop(EV_A_ &con->e_s_read );
 	ev_io_stop(EV_A_ &con->e_s_write );
 
-	/* TRANSLATORS: %1$s contains the connection ID that was just closed */
-	LogInfo(_("%1$s: closed"), con->id.c_str());
+	// Pipes that still hold data are closed, empty ones are reused
+	wrk->pipe_pool.put( con->pipe_c_to_s );
+	wrk->pipe_pool.put( con->pipe_s_to_c );
 
-	// Find and erase this connection in the list
-	// TODO scaling issue: this is O(n) with the number of connections.
-	for( typeof(connections.begin()) i = connections.begin(); i != connections.end(); ++i ) {
-		if( &(*i) == con ) {
-			connections.erase(i);
-			break; // Stop searching
+	for( typeof(wrk->memory_starved.begin()) i = wrk->memory_starved.begin(); i != wrk->memory_starved.end(); ) {
+		if( *i == &con->e_c_read || *i == &con->e_s_read ) {
+			i = wrk->memory_starved.erase(i);
+		} else {
+			++i;
+		}
+	}
+	for( typeof(wrk->rate_starved.begin()) i = wrk->rate_starved.begin(); i != wrk->rate_starved.end(); ) {
+		if( *i == &con->e_c_read || *i == &con->e_s_read ) {
+			i = wrk->rate_starved.erase(i);
+		} else {
+			++i;
 		}
 	}
+
+	if( con->sockmap ) {
+		// Count what was relayed since the last poll
+		try {
+			SockMap::Counters client, server;
+			SockMap::counters(con->s_client, client);
+			SockMap::counters(con->s_server, server);
+			sockmap_count(wrk, con, con->sockmap_c_to_s, con->con_open_c_to_s, client, server, wrk->metrics->bytes_c_to_s);
+			sockmap_count(wrk, con, con->sockmap_s_to_c, con->con_open_s_to_c, server, client, wrk->metrics->bytes_s_to_c);
+		} catch( Errno & ) {}
+	}
+
+	tcp_info_final(wrk, con);
+	log_mptcp_status(wrk, con);
+	/* TRANSLATORS: %1$s contains the connection ID that was just closed */
+	log_connection(wrk, LEVEL_INFO, con, N_("%1$s: closed"));
+
+	wrk->remove_connection(con);
 }
 
 static void server_socket_connect_done(EV_P_ ev_io *w, int revents) {
@@ -95,84 +849,380 @@ static void server_socket_connect_done(EV_P_ ev_io *w, int revents) {
 
 	Errno connect_error("connect()", con->s_server.getsockopt_so_error());
 	if( connect_error.error_number() != 0 ) {
+		metrics_add(this_worker(EV_A)->metrics->connect_failed[ metrics_connect_errno_index(connect_error.error_number()) ], 1);
 		/* TRANSLATORS: %1$s contains the connection ID,
 		   %2$s the error message */
-		LogWarn(_("%1$s: connect to server failed: %2$s"),
-			con->id.c_str(),
-			connect_error.what() );
+		log_connection(this_worker(EV_A), LEVEL_WARN, con,
+			N_("%1$s: connect to server failed: %2$s"), connect_error.what());
 		kill_connection(EV_A_ con);
 		return;
 	}
 
 	/* TRANSLATORS: %1$s contains the connection ID */
-	LogInfo(_("%1$s: server accepted connection, splicing"), con->id.c_str());
+	log_connection(this_worker(EV_A), LEVEL_INFO, con, N_("%1$s: server accepted connection, splicing"));
+	log_mptcp_status(this_worker(EV_A), con);
+	con->connected = true;
+	con->last_active = ev_now(EV_A);
+	if( use_sockmap && sockmap_start(EV_A_ con) ) return;
+	connection_timer_update(this_worker(EV_A), con);
 	ev_io_start(EV_A_ &con->e_c_write);
 	ev_io_start(EV_A_ &con->e_s_write);
 }
 
+/**
+ * Called when one direction has seen EOF and has nothing buffered anymore:
+ * pass the EOF on to the other side, and clean up when both directions are
+ * done.
+ * Returns true if the connection was killed.
+ */
+inline static bool direction_done(EV_P_ struct connection* con,
+                                  Socket &tx, ev_io *e_tx_write ) throw(Errno) {
+	ev_io_stop( EV_A_ e_tx_write );
+	tx.shutdown(SHUT_WR); // shutdown() does not block
+	if( !con->con_open_s_to_c && !con->con_open_c_to_s
+	    && con->buf_c_to_s.empty() && con->buf_s_to_c.empty()
+	    && con->pipe_c_to_s == NULL && con->pipe_s_to_c == NULL
+	    && ! ( con->sockmap && (con->sockmap_c_to_s.draining || con->sockmap_s_to_c.draining) ) ) {
+		// Connection fully closed, clean up
+		kill_connection(EV_A_ con);
+		return true;
+	}
+	connection_timer_update(this_worker(EV_A), con); // half-closed now
+	return false;
+}
+
+/**
+ * Give the memory of an empty buffer back to the pool, and let a direction
+ * that was waiting for memory have a go
+ */
+inline static void release_buffer(EV_P_ RingBuffer &buf) throw() {
+	struct worker *wrk = this_worker(EV_A);
+	wrk->put_buffer( buf );
+	if( ! wrk->memory_starved.empty() ) {
+		ev_io_start( EV_A_ wrk->memory_starved.back() );
+		wrk->memory_starved.pop_back();
+	}
+}
+
+/**
+ * Memory may have been given back by another worker in the mean time, retry
+ * all directions that are waiting for it
+ */
+static void memory_retry(EV_P_ ev_timer *w, int revents) {
+	struct worker *wrk = this_worker(EV_A);
+	for( typeof(wrk->memory_starved.begin()) i = wrk->memory_starved.begin(); i != wrk->memory_starved.end(); ++i ) {
+		ev_io_start( EV_A_ *i );
+	}
+	wrk->memory_starved.clear();
+}
+
+/**
+ * How much one direction reads at once, with space room for it
+ */
+static inline size_t read_chunk(size_t const space) throw() {
+	return notsent_lowat != 0 && notsent_lowat < space ? notsent_lowat : space;
+}
+
+/**
+ * How much one direction may read now, at most max
+ * Returns 0 when a rate limit holds it back, and sets the retry timer for
+ * when it can go on.
+ */
+static size_t rate_check(EV_P_ TokenBucket &rate, TokenBucket &total_rate, size_t const max) throw() {
+	if( ! rate.limited() && ! total_rate.limited() ) return max;
+	uint64_t now = ev_now(EV_A) * 1e9;
+	size_t allowed = std::min( rate.available(now, max), total_rate.available(now, max) );
+	size_t chunk = std::min(max, RATE_CHUNK); // rather than many small reads
+	if( allowed >= chunk ) return allowed;
+
+	struct worker *wrk = this_worker(EV_A);
+	// Other workers take from total_rate as well, so this is a guess
+	ev_tstamp wait = std::max( rate.wait(now, chunk), total_rate.wait(now, chunk) ) / 1e9;
+	wait = std::max(wait, 0.001);
+	if( ! ev_is_active(&wrk->e_rate_retry) || ev_timer_remaining(EV_A_ &wrk->e_rate_retry) > wait ) {
+		ev_timer_stop( EV_A_ &wrk->e_rate_retry );
+		ev_timer_set( &wrk->e_rate_retry, wait, 0. );
+		ev_timer_start( EV_A_ &wrk->e_rate_retry );
+	}
+	return 0;
+}
+
+/**
+ * rate_check() for the libev engine: reading stops until enough is
+ * available again
+ */
+static size_t rate_allowance(EV_P_ ev_io *e_rx_read, TokenBucket &rate, TokenBucket &total_rate,
+                             size_t const max) throw() {
+	size_t allowed = rate_check(EV_A_ rate, total_rate, max);
+	if( allowed > 0 ) return allowed;
+
+	struct worker *wrk = this_worker(EV_A);
+	ev_io_stop( EV_A_ e_rx_read );
+	if( std::find(wrk->rate_starved.begin(), wrk->rate_starved.end(), e_rx_read) == wrk->rate_starved.end() ) {
+		wrk->rate_starved.push_back( e_rx_read );
+	}
+	return 0;
+}
+inline static void rate_consume(EV_P_ TokenBucket &rate, TokenBucket &total_rate, size_t const len) throw() {
+	if( ! rate.limited() && ! total_rate.limited() ) return;
+	uint64_t now = ev_now(EV_A) * 1e9;
+	rate.consume(now, len);
+	total_rate.consume(now, len);
+}
+
+/**
+ * Retry all directions a rate limit held back; the ones that still can't
+ * read stop again, and set the timer for the next try
+ */
+static void rate_retry(EV_P_ ev_timer *w, int revents) {
+	struct worker *wrk = this_worker(EV_A);
+	std::vector< ev_io* > starved;
+	starved.swap( wrk->rate_starved );
+	for( typeof(starved.begin()) i = starved.begin(); i != starved.end(); ++i ) {
+		ev_io_start( EV_A_ *i );
+	}
+
+	std::vector< std::pair<struct connection*, bool> > uring_starved;
+	uring_starved.swap( wrk->uring_rate_starved );
+	for( typeof(uring_starved.begin()) i = uring_starved.begin(); i != uring_starved.end(); ++i ) {
+		struct connection *con = i->first;
+		con->uring_pending--; // the starved entry counted as pending
+		if( con->uring_dead ) {
+			// Killed by an earlier entry, after this one was taken out
+			if( con->uring_pending == 0 ) uring_finish(wrk, con);
+			continue;
+		}
+		try {
+			uring_recv(wrk, con, i->second);
+		} catch( Errno &e ) {
+			log_connection(wrk, LEVEL_ERROR, con, N_("%1$s %2$s: Error: %3$s)"),
+				i->second ? N_("C>S") : N_("S>C"), e.what(), AsyncLog::TRANSLATE_ARG1);
+			uring_kill(wrk, con);
+		}
+	}
+}
+
 inline static void peer_ready_write(EV_P_ struct connection* con,
-                                    std::string const &dir,
+                                    char const *dir,
                                     bool &con_open,
                                     Socket &rx, ev_io *e_rx_read,
-                                    std::string &buf,
-                                    Socket &tx, ev_io *e_tx_write ) {
-	if( buf.length() == 0 ) {
-		// All is written, and we're still ready to write, read some more
-		ev_io_start( EV_A_ e_rx_read );
-		ev_io_stop( EV_A_ e_tx_write );
-		return;
-	}
-	// buf.length() > 0
+                                    RingBuffer &buf,
+                                    Socket &tx, ev_io *e_tx_write,
+                                    uint64_t &bytes_sent ) {
+	con->last_active = ev_now(EV_A);
 	try {
-		ssize_t rv = tx.send(buf.data(), buf.length());
-		if( rv == 0 ) {
-			// Weird situation. FD was ready for write, but send() returned 0
-			// anyway... Retry later
-			LogWarn(_("%1$s %2$s: could not send(), but was ready for write"),
-				con->id.c_str(), dir.c_str());
-			return;
+		if( ! buf.empty() ) {
+			struct iovec iov[2];
+			ssize_t rv = tx.try_writev(iov, buf.data_iov(iov));
+			if( Socket::is_transient_error(rv) ) {
+				// Spurious wakeup (e.g. TCP_NOTSENT_LOWAT), retry later
+				return;
+			} else if( rv == 0 ) {
+				// Weird situation. FD was ready for write, but writev() returned
+				// 0 anyway... Retry later
+				log_connection(this_worker(EV_A), LEVEL_WARN, con,
+					N_("%1$s %2$s: could not send(), but was ready for write"), dir, "", AsyncLog::TRANSLATE_ARG1);
+				return;
+			} else if( rv < 0 ) {
+				throw Errno("Could not send()", -rv);
+			}
+			buf.consume( rv );
+			metrics_add(bytes_sent, rv);
+		}
+
+		if( con_open && (notsent_lowat != 0 ? buf.empty() : buf.length() <= buffer_low_watermark) ) {
+			// Drained below the low watermark, keep reading
+			ev_io_start( EV_A_ e_rx_read );
+		}
+		if( buf.empty() ) {
+			// All is written
+			release_buffer(EV_A_ buf);
+			if( con_open ) {
+				ev_io_stop( EV_A_ e_tx_write );
+			} else {
+				direction_done(EV_A_ con, tx, e_tx_write);
+			}
 		}
-		buf = buf.substr( rv );
 	} catch( Errno &e ) {
 		/* TRANSLATORS: %1$s contains the connection ID,
 		   %2$s contains the direction (separately translated),
 		   %3$s contains the error
 		 */
-		LogError(_("%1$s %2$s: Error: %3$s)"), con->id.c_str(), dir.c_str(), e.what());
+		log_connection(this_worker(EV_A), LEVEL_ERROR, con, N_("%1$s %2$s: Error: %3$s)"), dir, e.what(), AsyncLog::TRANSLATE_ARG1);
 		kill_connection(EV_A_ con);
 	}
 }
 inline static void peer_ready_read(EV_P_ struct connection* con,
-                                   std::string const &dir,
+                                   char const *dir,
                                    bool &con_open,
                                    Socket &rx, ev_io *e_rx_read,
-                                   std::string &buf,
-                                   Socket &tx, ev_io *e_tx_write ) {
-	// TODO allow read when we still have data in the buffer to streamline things
-	assert( buf.length() == 0 );
+                                   RingBuffer &buf,
+                                   Socket &tx, ev_io *e_tx_write,
+                                   TokenBucket &rate, TokenBucket &total_rate ) {
+	assert( ! buf.full() );
+	con->last_active = ev_now(EV_A);
 	try {
-		buf = rx.recv();
-		ev_io_stop( EV_A_ e_rx_read );
-		if( buf.length() == 0 ) { // EOF has been read
+		size_t allowed = rate_allowance(EV_A_ e_rx_read, rate, total_rate,
+		                                read_chunk(buf.attached() ? buf.space() : buffer_size));
+		if( allowed == 0 ) return;
+
+		if( ! buf.attached() ) {
+			struct worker *wrk = this_worker(EV_A);
+			char *mem = wrk->buffer_pool.get();
+			if( mem == NULL ) {
+				// Memory budget exhausted, stop reading until some is freed
+				ev_io_stop( EV_A_ e_rx_read );
+				if( std::find(wrk->memory_starved.begin(), wrk->memory_starved.end(), e_rx_read)
+				    == wrk->memory_starved.end() ) {
+					wrk->memory_starved.push_back( e_rx_read );
+				}
+				if( ! ev_is_active(&wrk->e_memory_retry) ) {
+					ev_timer_set( &wrk->e_memory_retry, 0.1, 0. );
+					ev_timer_start( EV_A_ &wrk->e_memory_retry );
+				}
+				return;
+			}
+			buf.attach( mem, wrk->buffer_pool.buffer_size() );
+			metrics_add(wrk->metrics->buffer_bytes, wrk->buffer_pool.buffer_size());
+		}
+
+		struct iovec iov[2];
+		int iovcnt = buf.space_iov(iov);
+		if( iov[0].iov_len >= allowed ) {
+			iov[0].iov_len = allowed;
+			iovcnt = 1;
+		} else if( iovcnt == 2 && iov[0].iov_len + iov[1].iov_len > allowed ) {
+			iov[1].iov_len = allowed - iov[0].iov_len;
+		}
+		ssize_t rv = rx.try_readv(iov, iovcnt);
+		if( Socket::is_transient_error(rv) ) {
+			return; // Spurious wakeup, wait for the next one
+		} else if( rv < 0 ) {
+			throw Errno("Could not recv()", -rv);
+		} else if( rv == 0 ) { // EOF has been read
 			/* TRANSLATORS: %1$s contains the connection ID,
 			   %2$s contains the direction (separately translated)
 			 */
-			LogInfo(_("%1$s %2$s: EOF"), con->id.c_str(), dir.c_str());
-			tx.shutdown(SHUT_WR); // shutdown() does not block
+			log_connection(this_worker(EV_A), LEVEL_INFO, con, N_("%1$s %2$s: EOF"), dir, "", AsyncLog::TRANSLATE_ARG1);
+			ev_io_stop( EV_A_ e_rx_read );
 			con_open = false;
-			if( !con->con_open_s_to_c && !con->con_open_c_to_s ) {
-				// Connection fully closed, clean up
-				kill_connection(EV_A_ con);
-			}
-		} else { // data has been read
-			ev_io_start( EV_A_ e_tx_write );
+			if( buf.empty() ) {
+				release_buffer(EV_A_ buf);
+				direction_done(EV_A_ con, tx, e_tx_write);
+			} // else: shutdown() when the buffer is written out
+			return;
+		}
+		// data has been read
+		rate_consume(EV_A_ rate, total_rate, rv);
+		buf.commit( rv );
+		ev_io_start( EV_A_ e_tx_write );
+		if( buf.full() || notsent_lowat != 0 ) {
+			// Stop reading until the buffer drained to the low watermark
+			// (with notsent_lowat: until it is written out)
+			ev_io_stop( EV_A_ e_rx_read );
 		}
 	} catch( Errno &e ) {
 		/* TRANSLATORS: %1$s contains the connection ID,
 		   %2$s contains the direction (separately translated),
 		   %3$s contains the error
 		 */
-		LogError(_("%1$s %2$s: Error: %3$s)"), con->id.c_str(), dir.c_str(), e.what());
+		log_connection(this_worker(EV_A), LEVEL_ERROR, con, N_("%1$s %2$s: Error: %3$s)"), dir, e.what(), AsyncLog::TRANSLATE_ARG1);
+		kill_connection(EV_A_ con);
+	}
+}
+
+inline static void peer_ready_write_splice(EV_P_ struct connection* con,
+                                           char const *dir,
+                                           bool &con_open,
+                                           Socket &rx, ev_io *e_rx_read,
+                                           Pipe *&pipe,
+                                           Socket &tx, ev_io *e_tx_write,
+                                           uint64_t &bytes_sent ) {
+	con->last_active = ev_now(EV_A);
+	try {
+		if( pipe != NULL && ! pipe->empty() ) {
+			ssize_t rv = pipe->splice_to(tx, pipe->bytes());
+			if( Socket::is_transient_error(rv) ) {
+				// Spurious wakeup (e.g. TCP_NOTSENT_LOWAT), retry later
+				return;
+			} else if( rv == 0 ) {
+				// Weird situation. FD was ready for write, but splice() wrote
+				// nothing anyway... Retry later
+				log_connection(this_worker(EV_A), LEVEL_WARN, con,
+					N_("%1$s %2$s: could not send(), but was ready for write"), dir, "", AsyncLog::TRANSLATE_ARG1);
+				return;
+			} else if( rv < 0 ) {
+				throw Errno("Could not splice() from pipe", -rv);
+			}
+			metrics_add(bytes_sent, rv);
+		}
+
+		if( con_open && (notsent_lowat == 0 || pipe == NULL || pipe->empty()) ) {
+			// There is room in the pipe (again), keep reading
+			ev_io_start( EV_A_ e_rx_read );
+		}
+		if( pipe == NULL || pipe->empty() ) {
+			// All is written, give back the pipe
+			this_worker(EV_A)->pipe_pool.put( pipe );
+			pipe = NULL;
+			if( con_open ) {
+				ev_io_stop( EV_A_ e_tx_write );
+			} else {
+				direction_done(EV_A_ con, tx, e_tx_write);
+			}
+		}
+	} catch( Errno &e ) {
+		log_connection(this_worker(EV_A), LEVEL_ERROR, con, N_("%1$s %2$s: Error: %3$s)"), dir, e.what(), AsyncLog::TRANSLATE_ARG1);
+		kill_connection(EV_A_ con);
+	}
+}
+inline static void peer_ready_read_splice(EV_P_ struct connection* con,
+                                          char const *dir,
+                                          bool &con_open,
+                                          Socket &rx, ev_io *e_rx_read,
+                                          Pipe *&pipe,
+                                          Socket &tx, ev_io *e_tx_write,
+                                          TokenBucket &rate, TokenBucket &total_rate ) {
+	con->last_active = ev_now(EV_A);
+	try {
+		if( pipe == NULL ) pipe = this_worker(EV_A)->pipe_pool.get();
+		size_t allowed = rate_allowance(EV_A_ e_rx_read, rate, total_rate, read_chunk(pipe->space()));
+		if( allowed == 0 ) {
+			if( pipe->empty() ) {
+				this_worker(EV_A)->pipe_pool.put( pipe );
+				pipe = NULL;
+			}
+			return;
+		}
+		ssize_t rv = pipe->splice_from(rx, allowed);
+		if( Socket::is_transient_error(rv) ) {
+			if( ! pipe->empty() ) {
+				// The pipe is full (it can run out of slots before it runs
+				// out of bytes), wait until some data is written out
+				ev_io_stop( EV_A_ e_rx_read );
+			} // else: spurious wakeup, wait for the next one
+			return;
+		} else if( rv < 0 ) {
+			throw Errno("Could not splice() into pipe", -rv);
+		} else if( rv == 0 ) { // EOF has been read
+			log_connection(this_worker(EV_A), LEVEL_INFO, con, N_("%1$s %2$s: EOF"), dir, "", AsyncLog::TRANSLATE_ARG1);
+			ev_io_stop( EV_A_ e_rx_read );
+			con_open = false;
+			if( pipe->empty() ) {
+				this_worker(EV_A)->pipe_pool.put( pipe );
+				pipe = NULL;
+				direction_done(EV_A_ con, tx, e_tx_write);
+			} // else: shutdown() when the pipe is written out
+			return;
+		}
+		// data is in the pipe
+		rate_consume(EV_A_ rate, total_rate, rv);
+		ev_io_start( EV_A_ e_tx_write );
+		if( pipe->space() == 0 || notsent_lowat != 0 ) {
+			ev_io_stop( EV_A_ e_rx_read );
+		}
+	} catch( Errno &e ) {
+		log_connection(this_worker(EV_A), LEVEL_ERROR, con, N_("%1$s %2$s: Error: %3$s)"), dir, e.what(), AsyncLog::TRANSLATE_ARG1);
 		kill_connection(EV_A_ con);
 	}
 }
@@ -180,177 +1230,1214 @@ inline static void peer_ready_read(EV_P_ struct connection* con,
 static void client_ready_write(EV_P_ ev_io *w, int revents) {
 	struct connection* con = reinterpret_cast<struct connection*>( w->data );
 	assert( w == &con->e_c_write );
-	return peer_ready_write(EV_A_ con, _("S>C"), con->con_open_s_to_c,
+	if( use_splice ) {
+		return peer_ready_write_splice(EV_A_ con, N_("S>C"), con->con_open_s_to_c,
+		                               con->s_server, &con->e_s_read,
+		                               con->pipe_s_to_c,
+		                               con->s_client, &con->e_c_write,
+		                               this_worker(EV_A)->metrics->bytes_s_to_c);
+	}
+	return peer_ready_write(EV_A_ con, N_("S>C"), con->con_open_s_to_c,
 	                        con->s_server, &con->e_s_read,
 	                        con->buf_s_to_c,
-	                        con->s_client, &con->e_c_write);
+	                        con->s_client, &con->e_c_write,
+	                        this_worker(EV_A)->metrics->bytes_s_to_c);
 }
 static void server_ready_write(EV_P_ ev_io *w, int revents) {
 	struct connection* con = reinterpret_cast<struct connection*>( w->data );
 	assert( w == &con->e_s_write );
-	return peer_ready_write(EV_A_ con, _("C>S"), con->con_open_c_to_s,
+	if( use_splice ) {
+		return peer_ready_write_splice(EV_A_ con, N_("C>S"), con->con_open_c_to_s,
+		                               con->s_client, &con->e_c_read,
+		                               con->pipe_c_to_s,
+		                               con->s_server, &con->e_s_write,
+		                               this_worker(EV_A)->metrics->bytes_c_to_s);
+	}
+	return peer_ready_write(EV_A_ con, N_("C>S"), con->con_open_c_to_s,
 	                        con->s_client, &con->e_c_read,
 	                        con->buf_c_to_s,
-	                        con->s_server, &con->e_s_write);
+	                        con->s_server, &con->e_s_write,
+	                        this_worker(EV_A)->metrics->bytes_c_to_s);
 }
 
 static void client_ready_read(EV_P_ ev_io *w, int revents) {
 	struct connection* con = reinterpret_cast<struct connection*>( w->data );
 	assert( w == &con->e_c_read );
-	return peer_ready_read(EV_A_ con, _("C>S"), con->con_open_c_to_s,
+	if( use_splice ) {
+		return peer_ready_read_splice(EV_A_ con, N_("C>S"), con->con_open_c_to_s,
+		                              con->s_client, &con->e_c_read,
+		                              con->pipe_c_to_s,
+		                              con->s_server, &con->e_s_write,
+		                              con->rate_c_to_s, total_rate_c_to_s);
+	}
+	return peer_ready_read(EV_A_ con, N_("C>S"), con->con_open_c_to_s,
 	                       con->s_client, &con->e_c_read,
 	                       con->buf_c_to_s,
-	                       con->s_server, &con->e_s_write);
+	                       con->s_server, &con->e_s_write,
+	                       con->rate_c_to_s, total_rate_c_to_s);
 }
 static void server_ready_read(EV_P_ ev_io *w, int revents) {
 	struct connection* con = reinterpret_cast<struct connection*>( w->data );
 	assert( w == &con->e_s_read );
-	return peer_ready_read(EV_A_ con, _("S>C"), con->con_open_s_to_c,
+	if( use_splice ) {
+		return peer_ready_read_splice(EV_A_ con, N_("S>C"), con->con_open_s_to_c,
+		                              con->s_server, &con->e_s_read,
+		                              con->pipe_s_to_c,
+		                              con->s_client, &con->e_c_write,
+		                              con->rate_s_to_c, total_rate_s_to_c);
+	}
+	return peer_ready_read(EV_A_ con, N_("S>C"), con->con_open_s_to_c,
 	                       con->s_server, &con->e_s_read,
 	                       con->buf_s_to_c,
-	                       con->s_client, &con->e_c_write);
+	                       con->s_client, &con->e_c_write,
+	                       con->rate_s_to_c, total_rate_s_to_c);
+}
+
+
+static void local_addresses_changed(EV_P_ ev_io *w, int revents) {
+	LocalAddresses *local_addrs = reinterpret_cast<LocalAddresses*>( w->data );
+	try {
+		local_addrs->process();
+	} catch( Errno &e ) {
+		LogError(_("Error: %s"), e.what());
+	}
+}
+
+static bool our_sockaddr(EV_P_ SockAddr::SockAddr const &destination) throw() {
+	return our_sockaddr(bind_listen_addrs, this_worker(EV_A)->local_addrs.get(), destination);
+}
+
+
+static void uring_connect(EV_P_ struct connection *con) throw(Errno);
+
+/**
+ * Have the kernel pace what goes out on tx to rate bytes per second; when it
+ * can't (e.g. on an MPTCP socket), reading for it is throttled with the
+ * fallback bucket instead, by either engine
+ */
+static void pace(Socket &tx, uint64_t const rate, TokenBucket &fallback) throw() {
+	fallback.set_rate(0, 0);
+	if( rate == 0 ) return;
+	if( setsockopt(tx, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate)) != 0 ) {
+		// Bursts of a tenth of a second
+		fallback.set_rate(rate, std::max<uint64_t>(rate / 10, 4 * RATE_CHUNK));
+	}
+}
+static void set_rate_limits(struct connection *con) throw() {
+	pace(con->s_server, rate_limit_c_to_s, con->rate_c_to_s);
+	pace(con->s_client, rate_limit_s_to_c, con->rate_s_to_c);
+}
+
+/**
+ * Set up the libev watchers of a connection, without starting them
+ */
+static void init_watchers(struct connection *con) throw() {
+	ev_io_init( &con->e_s_connect, server_socket_connect_done, con->s_server, EV_WRITE );
+	ev_io_init( &con->e_c_read,  client_ready_read,  con->s_client, EV_READ );
+	ev_io_init( &con->e_c_write, client_ready_write, con->s_client, EV_WRITE );
+	ev_io_init( &con->e_s_read,  server_ready_read,  con->s_server, EV_READ );
+	ev_io_init( &con->e_s_write, server_ready_write, con->s_server, EV_WRITE );
+	con->e_s_connect.data =
+		con->e_c_read.data =
+		con->e_c_write.data =
+		con->e_s_read.data =
+		con->e_s_write.data =
+			con;
+}
+
+static void accept_connection(EV_P_ Socket &s_client, struct sockaddr_storage const &client_sa) {
+	struct worker *wrk = this_worker(EV_A);
+
+	metrics_add(wrk->metrics->accepted, 1);
+
+	Slab< struct connection >::Ptr new_con( wrk->connection_slab );
+	new_con->s_client.reset( s_client.release() );
+
+	SockAddr::SockAddr client_addr;
+	SockAddr::SockAddr server_addr;
+	try {
+		client_addr = SockAddr::SockAddr(&client_sa);
+		//We do not want to buffer small packets, which could increase latency/jitter
+		//for real time applications. Let them go out as they came in!!
+		if(nodelay){
+			int val = 1;
+			new_con->s_client.setsockopt(IPPROTO_TCP, TCP_NODELAY, (char *) &val, sizeof(val));
+		}
+		set_timeout_options(new_con->s_client);
+		set_notsent_lowat(new_con->s_client);
+		if( ! congestion_client.empty() ) {
+			new_con->s_client.setsockopt(IPPROTO_TCP, TCP_CONGESTION, congestion_client.data(), congestion_client.size());
+		}
+
+		server_addr = new_con->s_client.getsockname();
+
+		new_con->id.set( client_addr, server_addr );
+
+		if( our_sockaddr(EV_A_ server_addr) ) {
+			/* TRANSLATORS: %1$s contains the connection ID
+			 */
+			log_connection(wrk, LEVEL_WARN, new_con.get(), N_("%1$s: Connection directly to us, dropping"));
+			return;
+			// Sockets will go out of scope, and close() themselves
+		}
+
+		/* TRANSLATORS: %1$s contains the connection ID
+		 */
+		log_connection(wrk, LEVEL_INFO, new_con.get(), N_("%1$s: Connection intercepted"));
+
+		new_con->server_mptcp = open_server_socket(new_con->s_server, server_addr.addr_family());
+		if(nodelay){
+			int val = 1;
+			new_con->s_server.setsockopt(IPPROTO_TCP, TCP_NODELAY, (char *) &val, sizeof(val));
+		}
+		set_timeout_options(new_con->s_server);
+		set_notsent_lowat(new_con->s_server);
+		if( ! congestion_server.empty() ) {
+			new_con->s_server.setsockopt(IPPROTO_TCP, TCP_CONGESTION, congestion_server.data(), congestion_server.size());
+		}
+		// Before connect(), so the window scale is chosen accordingly
+		if( server_rcvbuf > 0 ) {
+			new_con->s_server.setsockopt(SOL_SOCKET, SO_RCVBUF, &server_rcvbuf, sizeof(server_rcvbuf));
+		}
+		if( server_sndbuf > 0 ) {
+			new_con->s_server.setsockopt(SOL_SOCKET, SO_SNDBUF, &server_sndbuf, sizeof(server_sndbuf));
+		}
+		
+		if( fastopen ) {
+			// When the client sent something already, hold back the SYN
+			// until it is relayed, so it goes out with the data in it.
+			// Not when it didn't: the server may have to speak first.
+			int pending = 0;
+			if( ioctl(new_con->s_client, FIONREAD, &pending) == 0 && pending > 0 ) {
+				int value = 1;
+				setsockopt(new_con->s_server, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &value, sizeof(value));
+			}
+		}
+
+		if( bind_addr_outgoing.is_set() && bind_addr_outgoing.addr_family() != server_addr.addr_family()
+		    && bind_addr_outgoing.is_any() && bind_addr_outgoing.port_number() == 0 ) {
+			// A wildcard of the other family, what an unbound socket does anyway
+			// (the default, when listening on IPv4 and IPv6)
+		} else if( bind_addr_outgoing.is_set() ) {
+			if( bind_addr_outgoing.port_number() == 0 ) {
+				// Pick the port at connect(), so it only has to be unique per
+				// server instead of across all outgoing connections (which
+				// would cap us at one ephemeral port range worth of them)
+				int value = 1;
+				setsockopt(new_con->s_server, SOL_IP, IP_BIND_ADDRESS_NO_PORT, &value, sizeof(value));
+			}
+			new_con->s_server.bind( bind_addr_outgoing );
+		} else {
+#if HAVE_DECL_IP_TRANSPARENT
+			int value = 1;
+			new_con->s_server.setsockopt(SOL_IP, IP_TRANSPARENT, &value, sizeof(value));
+#endif
+			new_con->s_server.bind( client_addr );
+		}
+		set_rate_limits(new_con.get());
+	} catch( Errno &e ) {
+		LogError(_("Error: %s"), e.what());
+		return;
+		// Sockets will go out of scope, and close() themselves
+	}
+
+	new_con->con_open_c_to_s = new_con->con_open_s_to_c = true;
+	new_con->pipe_c_to_s = new_con->pipe_s_to_c = NULL;
+	new_con->connected = false;
+	new_con->sockmap = false;
+	new_con->last_active = ev_now(EV_A);
+
+	if( wrk->uring.get() != NULL ) {
+		new_con->server_addr = server_addr;
+		new_con->uring_c_to_s.buf_id = new_con->uring_s_to_c.buf_id = -1;
+		new_con->uring_pending = 0;
+		new_con->uring_dead = false;
+		try {
+			uring_connect(EV_A_ new_con.get());
+		} catch( Errno &e ) {
+			LogError(_("Error: %s"), e.what());
+			return;
+		}
+	} else {
+		init_watchers(new_con.get());
+
+		try {
+			new_con->s_server.connect( server_addr );
+			// Connection succeeded right away, flag the callback right away
+			ev_feed_event(EV_A_ &new_con->e_s_connect, 0);
+
+		} catch( Errno &e ) {
+			if( e.error_number() == EINPROGRESS ) {
+				// connect() is started, wait for socket to become write-ready
+				// Have libev call the callback
+				ev_io_start( EV_A_ &new_con->e_s_connect );
+
+			} else {
+				metrics_add(wrk->metrics->connect_failed[ metrics_connect_errno_index(e.error_number()) ], 1);
+				LogError(_("Error: %s"), e.what());
+				return;
+				// Sockets will go out of scope, and close() themselves
+			}
+		}
+	}
+
+	if( log_enabled(LEVEL_INFO) ) {
+		char my_addr[SockAddr::SockAddr::STRLEN], server_str[SockAddr::SockAddr::STRLEN];
+		new_con->s_server.getsockname().format(my_addr, sizeof(my_addr));
+		/* TRANSLATORS: %1$s contains the connection ID,
+		   %2$s the source address of the new connection,
+		   %3$s the destination address of the new connection
+		 */
+		log_connection(wrk, LEVEL_INFO, new_con.get(), N_("%1$s: Connecting %2$s-->%3$s"),
+			my_addr, server_addr.format(server_str, sizeof(server_str)));
+	}
+
+	connection_timer_update(wrk, new_con.get());
+	tcp_info_schedule(wrk, new_con.get());
+	wrk->add_connection( new_con.release() );
+}
+
+/**
+ * Out of file descriptors (or kernel memory): the connection stays in the
+ * accept queue, so accepting again right away would spin. Wait until some
+ * connections are closed.
+ */
+static bool accept_must_wait(EV_P_ int const err) throw() {
+	if( err != EMFILE && err != ENFILE && err != ENOBUFS && err != ENOMEM ) return false;
+	struct worker *wrk = this_worker(EV_A);
+	if( wrk->uring.get() == NULL ) {
+		for( typeof(wrk->listeners.begin()) i = wrk->listeners.begin(); i != wrk->listeners.end(); ++i ) {
+			ev_io_stop( EV_A_ &i->e_listen );
+		}
+	}
+	if( ! ev_is_active(&wrk->e_accept_retry) ) {
+		ev_timer_set( &wrk->e_accept_retry, 0.1, 0. );
+		ev_timer_start( EV_A_ &wrk->e_accept_retry );
+	}
+	return true;
+}
+
+static void listening_socket_ready_for_read(EV_P_ ev_io *w, int revents) {
+	Socket* s_listen = reinterpret_cast<Socket*>( w->data );
+
+	// Drain the accept queue, but give the other connections a chance
+	// after accept_batch new ones
+	for( unsigned int i = 0; i < accept_batch; i++ ) {
+		struct sockaddr_storage client_sa;
+		int fd = s_listen->try_accept(&client_sa);
+		if( Socket::is_transient_error(fd) ) {
+			return; // Queue is empty
+		} else if( fd < 0 ) {
+			Errno e("Could not accept()", -fd);
+			LogError(_("Error: %s"), e.what());
+			accept_must_wait(EV_A_ -fd);
+			return;
+		}
+		Socket s_client(fd);
+		accept_connection(EV_A_ s_client, client_sa);
+	}
+}
+
+
+/*
+ * io_uring engine
+ * Instead of waiting for readiness and doing the syscalls ourselves, every
+ * step is submitted to the ring and handled when its completion comes in.
+ * All submissions made while handling a batch of completions go to the kernel
+ * in a single io_uring_enter(), from the ev_prepare watcher. The eventfd that
+ * the kernel signals on every completion hooks the ring into the event loop.
+ * Receives pick a buffer from the worker's provided buffers only when data
+ * arrives, so idle connections don't hold on to any memory.
+ */
+
+static struct io_uring_sqe* uring_sqe(struct worker *wrk, struct connection *con, uring_op const op,
+                                      unsigned int const needed = 1) throw(Errno) {
+	if( wrk->uring->sq_space() < needed ) wrk->uring->submit();
+	struct io_uring_sqe *sqe = wrk->uring->get_sqe();
+	if( sqe == NULL ) throw Errno("io_uring submission queue full", EBUSY);
+	sqe->user_data = reinterpret_cast<uintptr_t>(con) | op;
+	if( con != NULL ) con->uring_pending++;
+	return sqe;
+}
+
+static void uring_arm_accept(struct worker *wrk, struct listener *l) throw(Errno) {
+	struct io_uring_sqe *sqe = uring_sqe(wrk, NULL, URING_ACCEPT);
+	IoUring::prep_accept_multishot(sqe, l->s_listen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	sqe->user_data = reinterpret_cast<uintptr_t>(l) | URING_ACCEPT;
+	l->uring_accepting = true;
+}
+static void uring_arm_accept(struct worker *wrk) throw(Errno) {
+	for( typeof(wrk->listeners.begin()) i = wrk->listeners.begin(); i != wrk->listeners.end(); ++i ) {
+		if( ! i->uring_accepting ) uring_arm_accept(wrk, &(*i));
+	}
+}
+
+/**
+ * Start accepting again after accept_must_wait()
+ */
+static void accept_retry(EV_P_ ev_timer *w, int revents) {
+	struct worker *wrk = this_worker(EV_A);
+	if( wrk->uring.get() == NULL ) {
+		for( typeof(wrk->listeners.begin()) i = wrk->listeners.begin(); i != wrk->listeners.end(); ++i ) {
+			ev_io_start( EV_A_ &i->e_listen );
+		}
+		return;
+	}
+	try {
+		uring_arm_accept(wrk);
+	} catch( Errno &e ) {
+		LogError(_("Error: %s"), e.what());
+		ev_timer_set( w, 0.1, 0. );
+		ev_timer_start( EV_A_ w );
+	}
+}
+
+static void uring_connect(EV_P_ struct connection *con) throw(Errno) {
+	if( this_worker(EV_A)->uring_quiescing ) {
+		// Accepted while handing off: connect the plain way, the new
+		// process waits for it to complete
+		try {
+			con->s_server.connect( con->server_addr );
+		} catch( Errno &e ) {
+			if( e.error_number() != EINPROGRESS ) throw;
+		}
+		return;
+	}
+	struct io_uring_sqe *sqe = uring_sqe(this_worker(EV_A), con, URING_CONNECT);
+	IoUring::prep_connect(sqe, con->s_server,
+	                      con->server_addr, con->server_addr.addr_len());
+}
+
+/**
+ * The state of one direction of a connection, as seen by the io_uring engine
+ */
+struct uring_leg {
+	char const *dir;
+	Socket &rx, &tx;
+	bool &con_open;
+	struct connection::uring_direction &state;
+	RingBuffer &buf; // data handed over by a previous process, sent first
+	Pipe *&pipe;
+	TokenBucket &rate, &total_rate;
+	uring_op recv_op, send_op;
+
+	uring_leg(struct connection *con, bool const c_to_s) throw()
+		: dir( c_to_s ? N_("C>S") : N_("S>C") ),
+		  rx( c_to_s ? con->s_client : con->s_server ),
+		  tx( c_to_s ? con->s_server : con->s_client ),
+		  con_open( c_to_s ? con->con_open_c_to_s : con->con_open_s_to_c ),
+		  state( c_to_s ? con->uring_c_to_s : con->uring_s_to_c ),
+		  buf( c_to_s ? con->buf_c_to_s : con->buf_s_to_c ),
+		  pipe( c_to_s ? con->pipe_c_to_s : con->pipe_s_to_c ),
+		  rate( c_to_s ? con->rate_c_to_s : con->rate_s_to_c ),
+		  total_rate( c_to_s ? total_rate_c_to_s : total_rate_s_to_c ),
+		  recv_op( c_to_s ? URING_RECV_C : URING_RECV_S ),
+		  send_op( c_to_s ? URING_SEND_S : URING_SEND_C ) {}
+};
+
+static void uring_recv(struct worker *wrk, struct connection *con, bool const c_to_s) throw(Errno) {
+	if( wrk->uring_quiescing ) return; // the state is handed over as it is
+	uring_leg leg(con, c_to_s);
+	if( use_splice && leg.pipe == NULL ) leg.pipe = wrk->pipe_pool.get();
+	// Only limited when the kernel can't pace tx, see pace()
+	size_t allowed = rate_check(wrk->loop, leg.rate, leg.total_rate,
+	                            use_splice ? leg.pipe->space() : wrk->uring_buffers->buffer_size());
+	if( allowed == 0 ) {
+		con->uring_pending++; // keeps it around until rate_retry()
+		wrk->uring_rate_starved.push_back( std::make_pair(con, c_to_s) );
+		return;
+	}
+	if( use_splice ) {
+		// splice() itself can't wait for data: poll first, linked to the splice
+		struct io_uring_sqe *sqe = uring_sqe(wrk, con, URING_POLL, 2);
+		IoUring::prep_poll(sqe, leg.rx, POLLIN | POLLRDHUP);
+		sqe->flags |= IOSQE_IO_LINK;
+		sqe = uring_sqe(wrk, con, leg.recv_op);
+		IoUring::prep_splice(sqe, leg.rx, leg.pipe->write_end(), allowed,
+		                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	} else {
+		struct io_uring_sqe *sqe = uring_sqe(wrk, con, leg.recv_op);
+		IoUring::prep_recv_select(sqe, leg.rx, allowed, wrk->uring_buffers->group());
+	}
+}
+
+static void uring_send(struct worker *wrk, struct connection *con, bool const c_to_s) throw(Errno) {
+	if( wrk->uring_quiescing ) return;
+	uring_leg leg(con, c_to_s);
+	if( ! leg.buf.empty() ) {
+		struct iovec iov[2];
+		leg.buf.data_iov(iov);
+		struct io_uring_sqe *sqe = uring_sqe(wrk, con, leg.send_op);
+		IoUring::prep_send(sqe, leg.tx, iov[0].iov_base, iov[0].iov_len, MSG_NOSIGNAL);
+	} else if( use_splice ) {
+		struct io_uring_sqe *sqe = uring_sqe(wrk, con, URING_POLL, 2);
+		IoUring::prep_poll(sqe, leg.tx, POLLOUT);
+		sqe->flags |= IOSQE_IO_LINK;
+		sqe = uring_sqe(wrk, con, leg.send_op);
+		IoUring::prep_splice(sqe, leg.pipe->read_end(), leg.tx, leg.pipe->bytes(),
+		                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	} else {
+		struct io_uring_sqe *sqe = uring_sqe(wrk, con, leg.send_op);
+		IoUring::prep_send(sqe, leg.tx, wrk->uring_buffers->buffer(leg.state.buf_id) + leg.state.sent,
+		                   leg.state.len - leg.state.sent, MSG_NOSIGNAL);
+	}
+}
+
+/**
+ * Give a buffer back to the kernel, and let a starved direction use it
+ */
+static void uring_recycle(struct worker *wrk, int const buf_id) throw(Errno) {
+	wrk->uring_buffers->recycle(buf_id);
+	metrics_sub(wrk->metrics->buffer_bytes, wrk->uring_buffers->buffer_size());
+	if( wrk->uring_starved.empty() ) return;
+	std::pair<struct connection*, bool> s = wrk->uring_starved.back();
+	wrk->uring_starved.pop_back();
+	s.first->uring_pending--; // the starved entry counted as pending
+	uring_recv(wrk, s.first, s.second);
+}
+
+/**
+ * Release everything once no submission refers to the connection anymore
+ */
+static void uring_finish(struct worker *wrk, struct connection *con) throw() {
+	if( con->uring_c_to_s.buf_id >= 0 ) {
+		wrk->uring_buffers->recycle(con->uring_c_to_s.buf_id);
+		metrics_sub(wrk->metrics->buffer_bytes, wrk->uring_buffers->buffer_size());
+	}
+	if( con->uring_s_to_c.buf_id >= 0 ) {
+		wrk->uring_buffers->recycle(con->uring_s_to_c.buf_id);
+		metrics_sub(wrk->metrics->buffer_bytes, wrk->uring_buffers->buffer_size());
+	}
+	wrk->pipe_pool.put( con->pipe_c_to_s );
+	wrk->pipe_pool.put( con->pipe_s_to_c );
+	wrk->remove_connection(con);
+}
+
+static void uring_kill(struct worker *wrk, struct connection *con) throw() {
+	if( con->uring_dead ) return;
+	con->uring_dead = true;
+	wrk->timers.cancel(&con->timer);
+
+	tcp_info_final(wrk, con);
+	log_mptcp_status(wrk, con);
+	log_connection(wrk, LEVEL_INFO, con, N_("%1$s: closed"));
+
+	for( typeof(wrk->uring_starved.begin()) i = wrk->uring_starved.begin(); i != wrk->uring_starved.end(); ) {
+		if( i->first == con ) {
+			con->uring_pending--;
+			i = wrk->uring_starved.erase(i);
+		} else {
+			++i;
+		}
+	}
+	for( typeof(wrk->uring_rate_starved.begin()) i = wrk->uring_rate_starved.begin(); i != wrk->uring_rate_starved.end(); ) {
+		if( i->first == con ) {
+			con->uring_pending--;
+			i = wrk->uring_rate_starved.erase(i);
+		} else {
+			++i;
+		}
+	}
+	if( con->uring_pending == 0 ) return uring_finish(wrk, con);
+
+	// Wait for the cancelled operations to complete
+	try {
+		IoUring::prep_cancel_fd( uring_sqe(wrk, NULL, URING_IGNORE), con->s_client );
+		if( con->s_server != -1 ) {
+			IoUring::prep_cancel_fd( uring_sqe(wrk, NULL, URING_IGNORE), con->s_server );
+		}
+	} catch( Errno &e ) {
+		// Shutting down the sockets makes the operations complete as well
+		::shutdown(con->s_client, SHUT_RDWR);
+		::shutdown(con->s_server, SHUT_RDWR);
+	}
+}
+
+/**
+ * Leave the event loop once no operation is in flight anymore
+ */
+static void uring_check_quiesced(EV_P) throw() {
+	struct worker *wrk = this_worker(EV_A);
+	for( typeof(wrk->listeners.begin()) i = wrk->listeners.begin(); i != wrk->listeners.end(); ++i ) {
+		if( i->uring_accepting ) return;
+	}
+	for( typeof(wrk->connections.begin()) i = wrk->connections.begin(); i != wrk->connections.end(); ++i ) {
+		if( i->uring_pending > 0 ) return;
+	}
+	ev_break(EV_A_ EVUNLOOP_ALL);
+}
+
+/**
+ * Wind down for a handoff: cancel every operation, and don't submit new ones
+ * What was received but not sent yet stays in the buffers and pipes of the
+ * connections, and is handed over with them.
+ */
+static void uring_quiesce(EV_P) throw() {
+	struct worker *wrk = this_worker(EV_A);
+	wrk->uring_quiescing = true;
+	ev_timer_stop(EV_A_ &wrk->e_accept_retry);
+	for( typeof(wrk->uring_starved.begin()) i = wrk->uring_starved.begin(); i != wrk->uring_starved.end(); ++i ) {
+		i->first->uring_pending--;
+	}
+	wrk->uring_starved.clear();
+	for( typeof(wrk->uring_rate_starved.begin()) i = wrk->uring_rate_starved.begin(); i != wrk->uring_rate_starved.end(); ++i ) {
+		i->first->uring_pending--;
+	}
+	wrk->uring_rate_starved.clear();
+	try {
+		for( typeof(wrk->listeners.begin()) i = wrk->listeners.begin(); i != wrk->listeners.end(); ++i ) {
+			if( i->uring_accepting ) {
+				IoUring::prep_cancel_fd( uring_sqe(wrk, NULL, URING_IGNORE), i->s_listen );
+			}
+		}
+		for( typeof(wrk->connections.begin()) i = wrk->connections.begin(); i != wrk->connections.end(); ++i ) {
+			if( i->uring_pending == 0 || i->uring_dead ) continue;
+			if( wrk->uring->sq_space() < 2 ) wrk->uring->submit();
+			IoUring::prep_cancel_fd( uring_sqe(wrk, NULL, URING_IGNORE), i->s_client );
+			IoUring::prep_cancel_fd( uring_sqe(wrk, NULL, URING_IGNORE), i->s_server );
+		}
+	} catch( Errno &e ) {
+		LogError(_("Error: %s"), e.what());
+	}
+	uring_check_quiesced(EV_A);
+}
+
+/**
+ * A direction saw EOF and has nothing left to send
+ * Returns true if the connection was killed.
+ */
+static bool uring_direction_done(struct worker *wrk, struct connection *con, uring_leg &leg) throw(Errno) {
+	leg.tx.shutdown(SHUT_WR);
+	if( !con->con_open_c_to_s && !con->con_open_s_to_c
+	    && con->uring_c_to_s.buf_id < 0 && con->uring_s_to_c.buf_id < 0
+	    && con->buf_c_to_s.empty() && con->buf_s_to_c.empty()
+	    && con->pipe_c_to_s == NULL && con->pipe_s_to_c == NULL ) {
+		uring_kill(wrk, con);
+		return true;
+	}
+	connection_timer_update(wrk, con); // half-closed now
+	return false;
+}
+
+static void uring_received(struct worker *wrk, struct connection *con, bool const c_to_s,
+                           int const res, unsigned int const flags) throw(Errno) {
+	uring_leg leg(con, c_to_s);
+	con->last_active = ev_now(wrk->loop);
+	if( res == -ENOBUFS ) {
+		// All buffers are in use, wait until one comes back
+		con->uring_pending++;
+		wrk->uring_starved.push_back( std::make_pair(con, c_to_s) );
+		return;
+	} else if( res == -EAGAIN || res == -EINTR ) {
+		return uring_recv(wrk, con, c_to_s);
+	} else if( res < 0 ) {
+		throw Errno("Could not recv()", -res);
+	} else if( res == 0 ) {
+		log_connection(wrk, LEVEL_INFO, con, N_("%1$s %2$s: EOF"), leg.dir, "", AsyncLog::TRANSLATE_ARG1);
+		leg.con_open = false;
+		if( flags & IORING_CQE_F_BUFFER ) wrk->uring_buffers->recycle(flags >> IORING_CQE_BUFFER_SHIFT);
+		wrk->pipe_pool.put( leg.pipe );
+		leg.pipe = NULL;
+		uring_direction_done(wrk, con, leg);
+		return;
+	}
+
+	rate_consume(wrk->loop, leg.rate, leg.total_rate, res);
+	if( use_splice ) {
+		leg.pipe->added(res);
+	} else {
+		leg.state.buf_id = flags >> IORING_CQE_BUFFER_SHIFT;
+		metrics_add(wrk->metrics->buffer_bytes, wrk->uring_buffers->buffer_size());
+		leg.state.len = res;
+		leg.state.sent = 0;
+	}
+	uring_send(wrk, con, c_to_s);
+}
+
+static void uring_sent(struct worker *wrk, struct connection *con, bool const c_to_s,
+                       int const res) throw(Errno) {
+	uring_leg leg(con, c_to_s);
+	con->last_active = ev_now(wrk->loop);
+	if( res == -EAGAIN || res == -EINTR ) {
+		return uring_send(wrk, con, c_to_s);
+	} else if( res <= 0 ) {
+		throw Errno("Could not send()", res == 0 ? EPIPE : -res);
+	}
+	metrics_add(c_to_s ? wrk->metrics->bytes_c_to_s : wrk->metrics->bytes_s_to_c, res);
+
+	if( ! leg.buf.empty() ) {
+		leg.buf.consume(res);
+		if( ! leg.buf.empty() ) return uring_send(wrk, con, c_to_s);
+		wrk->put_buffer( leg.buf );
+		if( ! leg.con_open ) {
+			uring_direction_done(wrk, con, leg);
+			return;
+		}
+	} else if( use_splice ) {
+		leg.pipe->removed(res);
+		if( ! leg.pipe->empty() ) return uring_send(wrk, con, c_to_s);
+		// All is written, the next receive reuses the pipe
+	} else {
+		leg.state.sent += res;
+		if( leg.state.sent < leg.state.len ) return uring_send(wrk, con, c_to_s);
+		int buf_id = leg.state.buf_id;
+		leg.state.buf_id = -1;
+		uring_recycle(wrk, buf_id);
+	}
+	uring_recv(wrk, con, c_to_s);
+}
+
+static void uring_accepted(EV_P_ struct worker *wrk, struct listener *l,
+                           int const res, unsigned int const flags) {
+	bool wait = false;
+	if( ! (flags & IORING_CQE_F_MORE) ) l->uring_accepting = false;
+	if( res == -ECANCELED && wrk->uring_quiescing ) {
+		return;
+	} else if( res < 0 ) {
+		Errno e("Could not accept()", -res);
+		LogError(_("Error: %s"), e.what());
+		// Only when the multishot accept stopped, or there'd be two of them
+		wait = ! (flags & IORING_CQE_F_MORE) && accept_must_wait(EV_A_ -res);
+	} else {
+		Socket s_client(res);
+		struct sockaddr_storage client_sa;
+		socklen_t client_sa_len = sizeof(client_sa);
+		if( getpeername(s_client, reinterpret_cast<struct sockaddr*>(&client_sa), &client_sa_len) == 0 ) {
+			accept_connection(EV_A_ s_client, client_sa);
+		} // else: the client is gone already, and the Socket closes itself
+	}
+	if( ! (flags & IORING_CQE_F_MORE) && ! wait && ! wrk->uring_quiescing ) {
+		// The multishot accept stopped, start it again
+		uring_arm_accept(wrk, l);
+	}
+}
+
+static void uring_completion(EV_P_ struct worker *wrk, __u64 const user_data,
+                             int const res, unsigned int const flags) {
+	uring_op op = static_cast<uring_op>( user_data & URING_OP_MASK );
+	if( op == URING_ACCEPT ) {
+		struct listener *l = reinterpret_cast<struct listener*>( user_data & ~URING_OP_MASK );
+		return uring_accepted(EV_A_ wrk, l, res, flags);
+	}
+	if( op == URING_IGNORE ) return;
+
+	struct connection *con = reinterpret_cast<struct connection*>( user_data & ~URING_OP_MASK );
+	con->uring_pending--;
+	if( con->uring_dead ) {
+		if( flags & IORING_CQE_F_BUFFER ) wrk->uring_buffers->recycle(flags >> IORING_CQE_BUFFER_SHIFT);
+		if( con->uring_pending == 0 ) uring_finish(wrk, con);
+		return;
+	}
+	if( res == -ECANCELED && wrk->uring_quiescing ) return; // see uring_quiesce()
+
+	char const *dir = "";
+	try {
+		switch( op ) {
+		case URING_CONNECT: {
+			// A connect that was handed over is waited for with a poll
+			int error = res > 0 ? con->s_server.getsockopt_so_error() : -res;
+			if( error != 0 ) {
+				Errno connect_error("connect()", error);
+				metrics_add(wrk->metrics->connect_failed[ metrics_connect_errno_index(error) ], 1);
+				log_connection(wrk, LEVEL_WARN, con,
+					N_("%1$s: connect to server failed: %2$s"), connect_error.what());
+				return uring_kill(wrk, con);
+			}
+			log_connection(wrk, LEVEL_INFO, con, N_("%1$s: server accepted connection, splicing"));
+			log_mptcp_status(wrk, con);
+			con->connected = true;
+			con->last_active = ev_now(EV_A);
+			connection_timer_update(wrk, con);
+			uring_recv(wrk, con, true);
+			uring_recv(wrk, con, false);
+			break;
+		}
+		case URING_RECV_C:
+		case URING_RECV_S:
+			dir = uring_leg(con, op == URING_RECV_C).dir;
+			uring_received(wrk, con, op == URING_RECV_C, res, flags);
+			break;
+		case URING_SEND_S:
+		case URING_SEND_C:
+			dir = uring_leg(con, op == URING_SEND_S).dir;
+			uring_sent(wrk, con, op == URING_SEND_S, res);
+			break;
+		default:
+			// Poll results are handled by the splice linked to them
+			break;
+		}
+	} catch( Errno &e ) {
+		log_connection(wrk, LEVEL_ERROR, con, N_("%1$s %2$s: Error: %3$s)"), dir, e.what(), AsyncLog::TRANSLATE_ARG1);
+		uring_kill(wrk, con);
+	}
+}
+
+static void uring_ready(EV_P_ ev_io *w, int revents) {
+	struct worker *wrk = this_worker(EV_A);
+
+	uint64_t count;
+	if( read(wrk->uring_eventfd, &count, sizeof(count)) < 0 ) {
+		// Spurious wakeup, but have a look at the ring anyway
+	}
+
+	struct io_uring_cqe *cqe;
+	while( (cqe = wrk->uring->peek_cqe()) != NULL ) {
+		__u64 user_data = cqe->user_data;
+		int res = cqe->res;
+		unsigned int flags = cqe->flags;
+		wrk->uring->cqe_seen();
+		uring_completion(EV_A_ wrk, user_data, res, flags);
+	}
+	if( wrk->uring_quiescing ) uring_check_quiesced(EV_A);
+}
+
+static void uring_submit(EV_P_ ev_prepare *w, int revents) {
+	struct worker *wrk = this_worker(EV_A);
+	if( wrk->uring->unsubmitted() == 0 ) return;
+	int rv = wrk->uring->submit();
+	if( rv < 0 && rv != -EAGAIN && rv != -EBUSY && rv != -EINTR ) {
+		throw Errno("Could not submit to io_uring", -rv);
+	}
+}
+
+static void* worker_main(void *arg) {
+	struct worker *wrk = reinterpret_cast<struct worker*>( arg );
+	try {
+		ev_run(wrk->loop, 0);
+	} catch( std::exception &e ) {
+		/* TRANSLATORS: %1$u contains the number of the worker thread,
+		   %2$s the error message */
+		LogError(_("Worker %1$u: %2$s"), wrk->number, e.what());
+		ev_async_send(EV_DEFAULT_ &e_worker_failed);
+	}
+	return NULL;
+}
+
+/**
+ * Parse a numeric command line argument, exit with a usage error if it's not
+ * a number of at least min
+ */
+static long parse_number(char const *option, char const *value, long const min) {
+	char *end;
+	long n = strtol(value, &end, 10);
+	if( *end != '\0' || end == value || n < min ) {
+		/* TRANSLATORS: %1$s contains the name of the option,
+		   %2$s the string passed as option
+		 */
+		fprintf(stderr, _("Invalid value for %1$s: \"%2$s\"\n"), option, value);
+		exit(EX_USAGE);
+	}
+	return n;
+}
+
+/**
+ * Check that the kernel can use the congestion control algorithm, exit with a
+ * usage error listing the available ones otherwise
+ * Trying it on a socket also loads the module for it, if needed.
+ */
+static void check_congestion_control(char const *option, std::string const &name) {
+	try {
+		Socket s( Socket::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0) );
+		s.setsockopt(IPPROTO_TCP, TCP_CONGESTION, name.data(), name.size());
+	} catch( Errno &e ) {
+		std::string available;
+		std::ifstream f("/proc/sys/net/ipv4/tcp_available_congestion_control");
+		std::getline(f, available);
+		/* TRANSLATORS: %1$s contains the name of the option,
+		   %2$s the algorithm passed as option,
+		   %3$s the error message,
+		   %4$s the list of algorithms the kernel has
+		 */
+		fprintf(stderr, _("Invalid value for %1$s: \"%2$s\": %3$s\n"
+		                  "Available congestion control algorithms: %4$s\n"),
+		        option, name.c_str(), e.what(), available.c_str());
+		exit(EX_USAGE);
+	}
 }
 
-
-static bool our_sockaddr(SockAddr::SockAddr const *destination) throw(Errno) {
-	// Begin with quick checks
-	if( destination->port_number() != bind_listen_addr->port_number() ) {
-		return false;
+/**
+ * Parse a size in bytes, optionally followed by k, M or G (powers of 1024),
+ * exit with a usage error if it's invalid or not between min and max
+ */
+static size_t parse_size(char const *option, char const *value, size_t const min, size_t const max) {
+	char *end;
+	unsigned long long n = strtoull(value, &end, 10);
+	switch( *end ) {
+	case 'k': case 'K': n <<= 10; end++; break;
+	case 'm': case 'M': n <<= 20; end++; break;
+	case 'g': case 'G': n <<= 30; end++; break;
+	}
+	if( *end != '\0' || end == value || value[0] == '-' || n < min || n > max ) {
+		fprintf(stderr, _("Invalid value for %1$s: \"%2$s\"\n"), option, value);
+		exit(EX_USAGE);
 	}
+	return n;
+}
 
-	if( ! bind_listen_addr->is_any() ) {
-		if( *destination == *bind_listen_addr ) {
-			// We've "intercepted" a connection that was directed to us
-			return true;
-		}
-	} else {
-		// Iterate over all local IPs
-		// This can't be cached, since local IPs change over time
-		std::auto_ptr< boost::ptr_vector< SockAddr::SockAddr> > local_addrs
-			= SockAddr::getifaddrs();
-		for( typeof(local_addrs->begin()) i = local_addrs->begin(); i != local_addrs->end(); i++ ) {
-			if( destination->address_equal(*i) ) return true;
-		}
+/**
+ * Parse a duration in seconds (fractions allowed), exit with a usage error if
+ * it's not a number between 0 and max
+ */
+static double parse_seconds(char const *option, char const *value, double const max) {
+	char *end;
+	double n = strtod(value, &end);
+	if( *end != '\0' || end == value || !(n >= 0) || n > max ) {
+		fprintf(stderr, _("Invalid value for %1$s: \"%2$s\"\n"), option, value);
+		exit(EX_USAGE);
 	}
-	return false;
+	return n;
 }
 
+const char* pidfile = NULL;
+const char* return_pidfile() {
+	return pidfile;
+}
 
-static void listening_socket_ready_for_read(EV_P_ ev_io *w, int revents) {
-	Socket* s_listen = reinterpret_cast<Socket*>( w->data );
 
-	std::auto_ptr<struct connection> new_con( new struct connection );
+/*
+ * Hitless upgrade
+ * SIGUSR2 starts a new instance of ourselves (from the binary on disk, which
+ * may have been replaced), with --inherit-fd pointing at a socketpair. It
+ * gets the listening sockets first, so no incoming connection is refused.
+ * Once it reports it is ready, the workers stop, and every connection is
+ * handed over with whatever was buffered for it. The new instance adopts
+ * them all before its workers start, and the old one exits.
+ */
+
+/**
+ * Send con over the handoff channel, with its unsent data
+ * The workers have stopped, nothing else touches the connection.
+ */
+static void handoff_connection(struct worker *wrk, struct connection *con) throw(Errno) {
+	Handoff::Record r;
+	memset(&r, 0, sizeof(r));
+	r.type = Handoff::CONNECTION;
+	r.flags = (con->con_open_c_to_s ? Handoff::C_TO_S_OPEN : 0)
+	        | (con->con_open_s_to_c ? Handoff::S_TO_C_OPEN : 0)
+	        | (con->connected ? Handoff::CONNECTED : 0);
+	int fds[2] = { con->s_client, con->s_server };
+	r.fds = 2;
+	if( con->sockmap ) {
+		r.flags |= Handoff::SOCKMAP
+		         | (con->sockmap_c_to_s.draining ? Handoff::C_TO_S_DRAINING : 0)
+		         | (con->sockmap_s_to_c.draining ? Handoff::S_TO_C_DRAINING : 0)
+		         | (con->sockmap_c_to_s.paused ? Handoff::C_TO_S_PAUSED : 0)
+		         | (con->sockmap_s_to_c.paused ? Handoff::S_TO_C_PAUSED : 0)
+		         | (con->sockmap_c_to_s.userspace ? Handoff::C_TO_S_USERSPACE : 0)
+		         | (con->sockmap_s_to_c.userspace ? Handoff::S_TO_C_USERSPACE : 0);
+		r.sent_offset_c_to_s = con->sockmap_c_to_s.sent_offset;
+		r.sent_offset_s_to_c = con->sockmap_s_to_c.sent_offset;
+		r.paused_at_c_to_s = con->sockmap_c_to_s.paused_at;
+		r.paused_at_s_to_c = con->sockmap_s_to_c.paused_at;
+	}
 
-	std::auto_ptr<SockAddr::SockAddr> client_addr;
-	std::auto_ptr<SockAddr::SockAddr> server_addr;
-	try {
-		new_con->s_client = s_listen->accept(&client_addr);
-		//We do not want to buffer small packets, which could increase latency/jitter
-		//for real time applications. Let them go out as they came in!!
-		if(nodelay){
-			int val = 1;
-			new_con->s_client.setsockopt(IPPROTO_TCP, TCP_NODELAY, (char *) &val, sizeof(val));
+	struct iovec iov[8];
+	int iovcnt = 0;
+	std::string pipe_data[2];
+	for( int d = 0; d < 2; d++ ) {
+		bool c_to_s = d == 0;
+		RingBuffer &buf = c_to_s ? con->buf_c_to_s : con->buf_s_to_c;
+		struct connection::uring_direction &state = c_to_s ? con->uring_c_to_s : con->uring_s_to_c;
+		Pipe *pipe = c_to_s ? con->pipe_c_to_s : con->pipe_s_to_c;
+		int first = iovcnt;
+
+		iovcnt += buf.data_iov(&iov[iovcnt]);
+		if( wrk->uring_buffers.get() != NULL && state.buf_id >= 0 ) {
+			iov[iovcnt].iov_base = wrk->uring_buffers->buffer(state.buf_id) + state.sent;
+			iov[iovcnt].iov_len = state.len - state.sent;
+			iovcnt++;
 		}
-		//Take care of socks hanging in ESTABLISHED/CLOSE_WAIT/FIN_WAIT2 states		
-		if(keepalive){
-			int val = 1;
-			new_con->s_client.setsockopt(SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val));
-			//LogInfo(_("%1$s: Enabling keepalive on s_client"), new_con->id.c_str());
+		if( pipe != NULL && ! pipe->empty() ) {
+			pipe_data[d].resize(pipe->bytes());
+			ssize_t rv = read(pipe->read_end(), &pipe_data[d][0], pipe_data[d].size());
+			if( rv != (ssize_t)pipe_data[d].size() ) {
+				throw Errno("Could not read pipe", rv == -1 ? errno : EIO);
+			}
+			iov[iovcnt].iov_base = &pipe_data[d][0];
+			iov[iovcnt].iov_len = pipe_data[d].size();
+			iovcnt++;
 		}
 
-		server_addr = new_con->s_client.getsockname();
-
-		new_con->id.assign( client_addr->string() );
-		new_con->id.append( "-->" );
-		new_con->id.append( server_addr->string() );
+		uint32_t &len = c_to_s ? r.len_c_to_s : r.len_s_to_c;
+		for( int i = first; i < iovcnt; i++ ) len += iov[i].iov_len;
+	}
+	handoff->send(r, fds, iov, iovcnt);
+}
 
-		new_con->s_client.non_blocking(true);
+/**
+ * Hand over the connections of all workers, after they stopped
+ */
+static void handoff_connections() throw() {
+	size_t count = 0;
+	try {
+		for( typeof(workers.begin()) i = workers.begin(); i != workers.end(); ++i ) {
+			for( typeof(i->connections.begin()) c = i->connections.begin(); c != i->connections.end(); ++c ) {
+				handoff_connection(&(*i), &(*c));
+				count++;
+			}
+		}
+		handoff->send(Handoff::END);
+	} catch( Errno &e ) {
+		LogError(_("Could not hand over the connections: %s"), e.what());
+	}
+	handoff.reset();
+	/* TRANSLATORS: %1$zu contains the number of connections */
+	LogInfo(_("Handed over %1$zu connections"), count);
+}
 
-		if( our_sockaddr(server_addr.get()) ) {
-			/* TRANSLATORS: %1$s contains the connection ID
-			 */
-			LogWarn(_("%1$s: Connection directly to us, dropping"), new_con->id.c_str());
-			return;
-			// Sockets will go out of scope, and close() themselves
+/**
+ * Put data that was handed over in the buffer (or pipe) of a direction
+ * The previous instance may have had more queued than fits in one buffer or
+ * pipe (a larger --buffer-size, or io_uring's buffers on top), then this
+ * one is made large enough to hold it all.
+ */
+static void adopt_data(struct worker *wrk, struct connection *con, bool const c_to_s,
+                       std::string const &data) throw(Errno) {
+	if( data.empty() ) return;
+	if( use_splice ) {
+		Pipe *&pipe = c_to_s ? con->pipe_c_to_s : con->pipe_s_to_c;
+		pipe = wrk->pipe_pool.get();
+		if( data.size() > pipe->capacity() ) pipe->grow(data.size());
+		ssize_t rv = write(pipe->write_end(), data.data(), data.size());
+		if( rv > 0 ) pipe->added(rv);
+		if( rv != (ssize_t)data.size() ) {
+			throw Errno("Handed over data does not fit in a pipe", rv == -1 ? errno : ENOBUFS);
 		}
+	} else {
+		RingBuffer &buf = c_to_s ? con->buf_c_to_s : con->buf_s_to_c;
+		size_t size = std::max(data.size(), wrk->buffer_pool.buffer_size());
+		char *mem = data.size() > wrk->buffer_pool.buffer_size() ? wrk->buffer_pool.get(size)
+		                                                        : wrk->buffer_pool.get();
+		if( mem == NULL ) throw Errno("No memory for handed over data", ENOMEM);
+		buf.attach( mem, size );
+		metrics_add(wrk->metrics->buffer_bytes, size);
+		struct iovec iov[2];
+		buf.space_iov(iov); // an empty buffer starts at the beginning
+		memcpy(iov[0].iov_base, data.data(), data.size());
+		buf.commit(data.size());
+	}
+}
 
-		/* TRANSLATORS: %1$s contains the connection ID
-		 */
-		LogInfo(_("%1$s: Connection intercepted"), new_con->id.c_str());
+/**
+ * Take over a connection that was handed over, and get it going in wrk
+ * The worker threads haven't started yet.
+ */
+static void adopt_connection(struct worker *wrk, Handoff::Record const &r, std::vector<int> const &fds,
+                             std::string const &c_to_s, std::string const &s_to_c) throw(Errno) {
+	struct ev_loop *loop = wrk->loop;
+
+	Slab< struct connection >::Ptr con( wrk->connection_slab );
+	con->s_client.reset( fds[0] );
+	con->s_server.reset( fds[1] );
+	con->con_open_c_to_s = (r.flags & Handoff::C_TO_S_OPEN) != 0;
+	con->con_open_s_to_c = (r.flags & Handoff::S_TO_C_OPEN) != 0;
+	con->connected = (r.flags & Handoff::CONNECTED) != 0;
+	con->sockmap = (r.flags & Handoff::SOCKMAP) != 0;
+	con->pipe_c_to_s = con->pipe_s_to_c = NULL;
+	con->last_active = ev_now(EV_A);
+	con->uring_c_to_s.buf_id = con->uring_s_to_c.buf_id = -1;
+	con->uring_pending = 0;
+	con->uring_dead = false;
+
+	int protocol = 0;
+	socklen_t protocol_len = sizeof(protocol);
+	con->server_mptcp = getsockopt(con->s_server, SOL_SOCKET, SO_PROTOCOL, &protocol, &protocol_len) == 0
+	                    && protocol == IPPROTO_MPTCP;
+	set_rate_limits(con.get());
 
-		new_con->s_server = Socket::socket(server_addr->addr_family(), SOCK_STREAM, 0);
-		if(nodelay){
-			int val = 1;
-			new_con->s_server.setsockopt(IPPROTO_TCP, TCP_NODELAY, (char *) &val, sizeof(val));
-		}
-		if(keepalive){
-			int val = 1;
-			new_con->s_server.setsockopt(SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val));
-			//LogInfo(_("%1$s: Enabling keepalive on s_server"), new_con->id.c_str());		
-		}
-		
-		if( bind_addr_outgoing.get() != NULL ) {
-			new_con->s_server.bind( *bind_addr_outgoing );
+	try {
+		con->id.set( con->s_client.getpeername(), con->s_client.getsockname() );
+		adopt_data(wrk, con.get(), true, c_to_s);
+		adopt_data(wrk, con.get(), false, s_to_c);
+
+		if( con->sockmap ) {
+			if( sockmap.get() == NULL || wrk->uring.get() != NULL ) {
+				throw Errno("Can not take over a connection the sockmap relays", EPROTO);
+			}
+			SockMap::Counters client, server;
+			SockMap::counters(con->s_client, client);
+			SockMap::counters(con->s_server, server);
+			init_watchers(con.get());
+			con->sockmap_interval = 1;
+			for( int i = 0; i < 2; i++ ) {
+				bool c_to_s = i == 0;
+				struct connection::sockmap_direction &d = c_to_s ? con->sockmap_c_to_s : con->sockmap_s_to_c;
+				d.sent_offset = c_to_s ? r.sent_offset_c_to_s : r.sent_offset_s_to_c;
+				// What was relayed before is in the metrics of the previous instance
+				d.relayed = (c_to_s ? server : client).sent - d.sent_offset;
+				d.paused = (r.flags & (c_to_s ? Handoff::C_TO_S_PAUSED : Handoff::S_TO_C_PAUSED)) != 0;
+				d.paused_at = c_to_s ? r.paused_at_c_to_s : r.paused_at_s_to_c;
+				d.refused = false; // found out again when resuming
+				d.userspace = (r.flags & (c_to_s ? Handoff::C_TO_S_USERSPACE : Handoff::S_TO_C_USERSPACE)) != 0;
+				d.draining = (r.flags & (c_to_s ? Handoff::C_TO_S_DRAINING : Handoff::S_TO_C_DRAINING)) != 0;
+
+				ev_io *e_rx_read = c_to_s ? &con->e_c_read : &con->e_s_read;
+				bool con_open = c_to_s ? con->con_open_c_to_s : con->con_open_s_to_c;
+				if( d.userspace ) {
+					// Write out what was buffered first, that resumes reading
+					if( ! (c_to_s ? con->buf_c_to_s : con->buf_s_to_c).empty()
+					    || (c_to_s ? con->pipe_c_to_s : con->pipe_s_to_c) != NULL ) {
+						ev_io_start( EV_A_ c_to_s ? &con->e_s_write : &con->e_c_write );
+					} else if( con_open ) {
+						ev_io_start( EV_A_ e_rx_read );
+					}
+				} else {
+					ev_set_cb( e_rx_read, sockmap_ready_read );
+					if( con_open && ! d.paused ) ev_io_start( EV_A_ e_rx_read );
+				}
+			}
+		} else if( wrk->uring.get() != NULL ) {
+			if( wrk->uring->sq_space() < 4 ) wrk->uring->submit();
+			if( ! con->connected ) {
+				IoUring::prep_poll( uring_sqe(wrk, con.get(), URING_CONNECT), con->s_server, POLLOUT );
+			} else {
+				for( int d = 0; d < 2; d++ ) {
+					uring_leg leg(con.get(), d == 0);
+					if( ! leg.buf.empty() || ( leg.pipe != NULL && ! leg.pipe->empty() ) ) {
+						uring_send(wrk, con.get(), d == 0);
+					} else if( leg.con_open ) {
+						uring_recv(wrk, con.get(), d == 0);
+					}
+				}
+			}
 		} else {
-#if HAVE_DECL_IP_TRANSPARENT
-			int value = 1;
-			new_con->s_server.setsockopt(SOL_IP, IP_TRANSPARENT, &value, sizeof(value));
-#endif
-			new_con->s_server.bind( *client_addr );
+			init_watchers(con.get());
+			if( ! con->connected ) {
+				ev_io_start( EV_A_ &con->e_s_connect );
+			} else {
+				// Write out what was buffered first, that resumes reading
+				if( ! con->buf_c_to_s.empty() || con->pipe_c_to_s != NULL ) {
+					ev_io_start( EV_A_ &con->e_s_write );
+				} else if( con->con_open_c_to_s ) {
+					ev_io_start( EV_A_ &con->e_c_read );
+				}
+				if( ! con->buf_s_to_c.empty() || con->pipe_s_to_c != NULL ) {
+					ev_io_start( EV_A_ &con->e_c_write );
+				} else if( con->con_open_s_to_c ) {
+					ev_io_start( EV_A_ &con->e_s_read );
+				}
+			}
 		}
-		new_con->s_server.non_blocking(true);
 	} catch( Errno &e ) {
-		LogError(_("Error: %s"), e.what());
-		return;
-		// Sockets will go out of scope, and close() themselves
+		wrk->pipe_pool.put( con->pipe_c_to_s );
+		wrk->pipe_pool.put( con->pipe_s_to_c );
+		wrk->put_buffer( con->buf_c_to_s );
+		wrk->put_buffer( con->buf_s_to_c );
+		throw;
 	}
 
-	ev_io_init( &new_con->e_s_connect, server_socket_connect_done, new_con->s_server, EV_WRITE );
-	ev_io_init( &new_con->e_c_read,  client_ready_read,  new_con->s_client, EV_READ );
-	ev_io_init( &new_con->e_c_write, client_ready_write, new_con->s_client, EV_WRITE );
-	ev_io_init( &new_con->e_s_read,  server_ready_read,  new_con->s_server, EV_READ );
-	ev_io_init( &new_con->e_s_write, server_ready_write, new_con->s_server, EV_WRITE );
-	new_con->e_s_connect.data =
-		new_con->e_c_read.data =
-		new_con->e_c_write.data =
-		new_con->e_s_read.data =
-		new_con->e_s_write.data =
-			new_con.get();
-	new_con->con_open_c_to_s = new_con->con_open_s_to_c = true;
+	/* TRANSLATORS: %1$s contains the connection ID */
+	log_connection(wrk, LEVEL_INFO, con.get(), N_("%1$s: taken over from the previous instance"));
+	connection_timer_update(wrk, con.get());
+	tcp_info_schedule(wrk, con.get());
+	wrk->add_connection( con.release() );
+}
 
+/**
+ * Tell the previous instance we're ready, and adopt its connections
+ */
+static void adopt_connections() throw() {
+	size_t count = 0;
 	try {
-		new_con->s_server.connect( *server_addr );
-		// Connection succeeded right away, flag the callback right away
-		ev_feed_event(EV_A_ &new_con->e_s_connect, 0);
-
+		handoff->send(Handoff::READY);
+		Handoff::Record r;
+		std::vector<int> fds;
+		std::string c_to_s, s_to_c;
+		while( handoff->receive(r, fds, c_to_s, s_to_c) && r.type == Handoff::CONNECTION ) {
+			if( fds.size() != 2 ) {
+				for( typeof(fds.begin()) i = fds.begin(); i != fds.end(); ++i ) close(*i);
+				throw Errno("Connection handed over without its sockets", EPROTO);
+			}
+			try {
+				adopt_connection(&workers[count % workers.size()], r, fds, c_to_s, s_to_c);
+				count++;
+			} catch( Errno &e ) {
+				LogError(_("Could not take over a connection: %s"), e.what());
+			}
+		}
 	} catch( Errno &e ) {
-		if( e.error_number() == EINPROGRESS ) {
-			// connect() is started, wait for socket to become write-ready
-			// Have libev call the callback
-			ev_io_start( EV_A_ &new_con->e_s_connect );
+		LogError(_("Could not take over the connections: %s"), e.what());
+	}
+	handoff.reset();
+	/* TRANSLATORS: %1$zu contains the number of connections */
+	LogInfo(_("Took over %1$zu connections"), count);
+}
+
+void received_sigusr2(EV_P_ ev_signal *w, int revents) throw() {
+	if( handing_off ) return;
+	LogInfo(_("Received SIGUSR2, starting a new instance to take over"));
+
+	// Everything the child needs is prepared before fork()
+	int sv[2];
+	if( socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1 ) {
+		LogError(_("Upgrade failed: %s"), strerror(errno));
+		return;
+	}
+	char fd_str[16];
+	snprintf(fd_str, sizeof(fd_str), "%d", sv[1]);
+	std::vector<std::string> args(upgrade_argv);
+	args.push_back("--inherit-fd");
+	args.push_back(fd_str);
+	std::vector<char*> argv_c;
+	for( typeof(args.begin()) i = args.begin(); i != args.end(); ++i ) {
+		argv_c.push_back( const_cast<char*>(i->c_str()) );
+	}
+	argv_c.push_back(NULL);
 
+	pid_t child = -1;
+	try {
+		handoff.reset( new Handoff(sv[0]) );
+		if( pidfile != NULL ) daemon_pid_file_remove(); // the new instance writes its own
+		child = fork();
+		if( child == 0 ) {
+			sigset_t none;
+			sigemptyset(&none);
+			sigprocmask(SIG_SETMASK, &none, NULL);
+			fcntl(sv[1], F_SETFD, 0); // keep it across exec()
+			execvp(argv_c[0], &argv_c[0]);
+			_exit(EX_OSERR);
+		}
+		close(sv[1]);
+		sv[1] = -1;
+		if( child == -1 ) throw Errno("Could not fork()", errno);
+
+		// Give it the listening sockets, and wait until it's set up
+		handoff->set_timeout(60);
+		std::vector<int> fds;
+		for( typeof(workers.begin()) i = workers.begin(); i != workers.end(); ++i ) {
+			for( typeof(i->listeners.begin()) l = i->listeners.begin(); l != i->listeners.end(); ++l ) {
+				fds.push_back( l->s_listen );
+			}
+		}
+		if( sockmap.get() != NULL ) {
+			int maps[2] = { sockmap->targets_fd(), sockmap->sockets_fd() };
+			handoff->send_listeners(fds, maps);
 		} else {
-			LogError(_("Error: %s"), e.what());
-			return;
-			// Sockets will go out of scope, and close() themselves
+			handoff->send_listeners(fds, NULL);
+		}
+		Handoff::Record r;
+		std::string c_to_s, s_to_c;
+		if( ! handoff->receive(r, fds, c_to_s, s_to_c) || r.type != Handoff::READY ) {
+			throw Errno("The new instance did not start", ECHILD);
 		}
+	} catch( Errno &e ) {
+		LogError(_("Upgrade failed: %s"), e.what());
+		if( sv[1] != -1 ) close(sv[1]);
+		handoff.reset();
+		if( child > 0 ) {
+			kill(child, SIGTERM);
+			waitpid(child, NULL, 0);
+		}
+		if( pidfile != NULL && daemon_pid_file_create() ) {
+			LogError(_("Could not write the PID file again"));
+		}
+		return;
 	}
 
-	std::auto_ptr<SockAddr::SockAddr> my_addr;
-	my_addr = new_con->s_server.getsockname();
-	/* TRANSLATORS: %1$s contains the connection ID,
-	   %2$s the source address of the new connection,
-	   %3$s the destination address of the new connection
-	 */
-	LogInfo(_("%1$s: Connecting %2$s-->%3$s"), new_con->id.c_str(),
-			my_addr->string().c_str(), server_addr->string().c_str());
-
-	connections.push_back( new_con.release() );
-}
-
-const char* pidfile = NULL;
-const char* return_pidfile() {
-	return pidfile;
+	/* TRANSLATORS: %1$d contains the PID of the new instance */
+	LogInfo(_("New instance [%1$d] is ready, handing over"), child);
+	handing_off = true;
+	ev_break(EV_A_ EVUNLOOP_ALL);
 }
 
 int main(int argc, char* argv[]) {
@@ -361,26 +2448,123 @@ int main(int argc, char* argv[]) {
 	// Default options
 	struct {
 		bool fork;
-		std::string bind_addr_listen;
+		std::vector<std::string> bind_addrs_listen;
 		std::string bind_addr_outgoing;
+		long workers;
+		int backlog;
+		long low_watermark;
+		long defer_accept;
+		long inherit_fd;
 	} options = {
 		/* fork = */ true,
-		/* bind_addr_listen = */ "[0.0.0.0]:[5000]",
-		/* bind_addr_outgoing = */ "[0.0.0.0]:[0]"
+		/* bind_addrs_listen = */ std::vector<std::string>(), // [0.0.0.0]:[5000] if none given
+		/* bind_addr_outgoing = */ "[0.0.0.0]:[0]",
+		/* workers = */ sysconf(_SC_NPROCESSORS_ONLN),
+		/* backlog = */ DEFAULT_CONN_BACKLOG,
+		/* low_watermark = */ -1, // half of the buffer size
+		/* defer_accept = */ -1, // 1 second with --fastopen, off otherwise
+		/* inherit_fd = */ -1
 		};
+	if( options.workers < 1 ) options.workers = 1;
+
+	// An upgrade starts the binary the same way, but with its own --inherit-fd
+	for( int i = 0; i < argc; i++ ) {
+		if( strcmp(argv[i], "--inherit-fd") == 0 ) {
+			i++;
+		} else if( strncmp(argv[i], "--inherit-fd=", 13) != 0 ) {
+			upgrade_argv.push_back(argv[i]);
+		}
+	}
+	{
+		char path[PATH_MAX];
+		// daemon_fork() changes to /, so relative paths won't do
+		if( strchr(argv[0], '/') != NULL && realpath(argv[0], path) != NULL ) upgrade_argv[0] = path;
+	}
 
 	{ // Parse options
-		char optstring[] = "hVknfp:b:B:l:";
+		// Options without a short equivalent
+		enum {
+			OPT_BACKLOG = 256,
+			OPT_ACCEPT_BATCH,
+			OPT_IO_ENGINE,
+			OPT_URING_BUFFERS,
+			OPT_CONGESTION_CLIENT,
+			OPT_CONGESTION_SERVER,
+			OPT_MPTCP,
+			OPT_BUFFER_SIZE,
+			OPT_BUFFER_LOW_WATERMARK,
+			OPT_BUFFER_MEMORY,
+			OPT_CLIENT_RCVBUF,
+			OPT_CLIENT_SNDBUF,
+			OPT_SERVER_RCVBUF,
+			OPT_SERVER_SNDBUF,
+			OPT_NOTSENT_LOWAT,
+			OPT_METRICS,
+			OPT_TCP_INFO_INTERVAL,
+			OPT_TCP_INFO_LOG,
+			OPT_LOG_LEVEL,
+			OPT_CONNECT_TIMEOUT,
+			OPT_IDLE_TIMEOUT,
+			OPT_FIN_TIMEOUT,
+			OPT_KEEPALIVE_IDLE,
+			OPT_KEEPALIVE_INTERVAL,
+			OPT_USER_TIMEOUT,
+			OPT_FASTOPEN,
+			OPT_DEFER_ACCEPT,
+			OPT_INHERIT_FD,
+			OPT_SOCKMAP,
+			OPT_RATE_TO_SERVER,
+			OPT_RATE_TO_CLIENT,
+			OPT_TOTAL_RATE_TO_SERVER,
+			OPT_TOTAL_RATE_TO_CLIENT
+		};
+		uint64_t total_rate_to_server = 0, total_rate_to_client = 0;
+		char optstring[] = "hVknsfp:b:B:l:w:";
 		struct option longopts[] = {
 			{"help",			no_argument, NULL, 'h'},
 			{"version",			no_argument, NULL, 'V'},
 			{"keepalive",		no_argument, NULL, 'k'},
 			{"tcp_nodelay",		no_argument, NULL, 'n'},
+			{"splice",			no_argument, NULL, 's'},
 			{"foreground",		no_argument, NULL, 'f'},
 			{"pid-file",		required_argument, NULL, 'p'},
 			{"bind-listen",		required_argument, NULL, 'b'},
 			{"bind-outgoing",	required_argument, NULL, 'B'},
 			{"log",				required_argument, NULL, 'l'},
+			{"workers",			required_argument, NULL, 'w'},
+			{"backlog",			required_argument, NULL, OPT_BACKLOG},
+			{"accept-batch",	required_argument, NULL, OPT_ACCEPT_BATCH},
+			{"io-engine",		required_argument, NULL, OPT_IO_ENGINE},
+			{"uring-buffers",	required_argument, NULL, OPT_URING_BUFFERS},
+			{"congestion-client",	required_argument, NULL, OPT_CONGESTION_CLIENT},
+			{"congestion-server",	required_argument, NULL, OPT_CONGESTION_SERVER},
+			{"mptcp",			no_argument, NULL, OPT_MPTCP},
+			{"buffer-size",		required_argument, NULL, OPT_BUFFER_SIZE},
+			{"buffer-low-watermark",	required_argument, NULL, OPT_BUFFER_LOW_WATERMARK},
+			{"buffer-memory",	required_argument, NULL, OPT_BUFFER_MEMORY},
+			{"client-rcvbuf",	required_argument, NULL, OPT_CLIENT_RCVBUF},
+			{"client-sndbuf",	required_argument, NULL, OPT_CLIENT_SNDBUF},
+			{"server-rcvbuf",	required_argument, NULL, OPT_SERVER_RCVBUF},
+			{"server-sndbuf",	required_argument, NULL, OPT_SERVER_SNDBUF},
+			{"notsent-lowat",	required_argument, NULL, OPT_NOTSENT_LOWAT},
+			{"metrics",			required_argument, NULL, OPT_METRICS},
+			{"tcp-info-interval",	required_argument, NULL, OPT_TCP_INFO_INTERVAL},
+			{"tcp-info-log",	required_argument, NULL, OPT_TCP_INFO_LOG},
+			{"log-level",		required_argument, NULL, OPT_LOG_LEVEL},
+			{"connect-timeout",	required_argument, NULL, OPT_CONNECT_TIMEOUT},
+			{"idle-timeout",	required_argument, NULL, OPT_IDLE_TIMEOUT},
+			{"fin-timeout",		required_argument, NULL, OPT_FIN_TIMEOUT},
+			{"keepalive-idle",	required_argument, NULL, OPT_KEEPALIVE_IDLE},
+			{"keepalive-interval",	required_argument, NULL, OPT_KEEPALIVE_INTERVAL},
+			{"user-timeout",	required_argument, NULL, OPT_USER_TIMEOUT},
+			{"fastopen",		no_argument, NULL, OPT_FASTOPEN},
+			{"defer-accept",	required_argument, NULL, OPT_DEFER_ACCEPT},
+			{"inherit-fd",		required_argument, NULL, OPT_INHERIT_FD},
+			{"sockmap",			no_argument, NULL, OPT_SOCKMAP},
+			{"rate-to-server",	required_argument, NULL, OPT_RATE_TO_SERVER},
+			{"rate-to-client",	required_argument, NULL, OPT_RATE_TO_CLIENT},
+			{"total-rate-to-server",	required_argument, NULL, OPT_TOTAL_RATE_TO_SERVER},
+			{"total-rate-to-client",	required_argument, NULL, OPT_TOTAL_RATE_TO_CLIENT},
 			{NULL, 0, 0, 0}
 		};
 		int longindex;
@@ -395,7 +2579,27 @@ int main(int argc, char* argv[]) {
 					"  -h --help                       Displays this help message and exits\n"
 					"  -V --version                    Displays the version and exits\n"
 					"  -k --keepalive                  Enable keepalive on the sockets\n"
+					"  --keepalive-idle s              Idle time before the first keepalive probe,\n"
+					"  --keepalive-interval s          and time between probes (default: system\n"
+					"                                  wide settings). Both imply --keepalive\n"
+					"  --user-timeout s                Close a connection when sent data is not\n"
+					"                                  acknowledged for s seconds (TCP_USER_TIMEOUT)\n"
+					"  --connect-timeout s             Give up connecting to the server after s\n"
+					"                                  seconds (default: when the kernel gives up)\n"
+					"  --idle-timeout s                Close connections that relayed nothing for\n"
+					"                                  s seconds (default: never)\n"
+					"  --fin-timeout s                 Idle timeout for connections that are closed\n"
+					"                                  in one direction (default: --idle-timeout)\n"
 					"  -n --tcp_nodelay                Disable Nagel's Algorithm on the sockets\n"
+					"  -s --splice                     Relay data with splice() through a pipe,\n"
+					"                                  without copying it to userspace\n"
+					"  --sockmap                       Relay established connections inside the\n"
+					"                                  kernel with an eBPF sockmap (needs root)\n"
+					"  --fastopen                      TCP Fast Open: accept data in the client's\n"
+					"                                  SYN, and send the client's first data in the\n"
+					"                                  SYN to the server. Implies --defer-accept 1\n"
+					"  --defer-accept s                Only hand over connections once the client\n"
+					"                                  sent data, or after s seconds\n"
 					"  -f --foreground                 Don't fork and detach\n"
 					"  --pid-file -p file              The file to write the PID to, especially\n"
 					"                                  usefull when running as a daemon. Must be an\n"
@@ -404,6 +2608,8 @@ int main(int argc, char* argv[]) {
 					"                                  connections.\n"
 					"                                  host and port resolving can be bypassed by\n"
 					"                                  placing [] around them\n"
+					"                                  Can be given more than once; every address\n"
+					"                                  a host resolves to is listened on\n"
 					"  --bind-outgoing -B host:port    Bind to the specified address for outgoing\n"
 					"                                  connections.\n"
 					"                                  host and port resolving can be bypassed by\n"
@@ -413,6 +2619,57 @@ int main(int argc, char* argv[]) {
 					"                                  you should take care that the return packets\n"
 					"                                  pass through this process again!\n"
 					"  --log -l file                   Log to file\n"
+					"  --log-level debug|info|warn|error\n"
+					"                                  Only log messages about connections of at\n"
+					"                                  least this level (default info)\n"
+					"  --workers -w n                  Number of worker threads, each with their\n"
+					"                                  own event loop. Defaults to the number of\n"
+					"                                  online CPUs\n"
+					"  --backlog n                     Length of the queue of connections waiting\n"
+					"                                  to be accepted\n"
+					"  --accept-batch n                Accept at most n connections in one go,\n"
+					"                                  before handling other events (default 64)\n"
+					"  --io-engine libev|io_uring      How to do the I/O: wait for readiness with\n"
+					"                                  libev (default), or submit the operations in\n"
+					"                                  batches to io_uring\n"
+					"  --uring-buffers n               Number of receive buffers of 16kB per worker\n"
+					"                                  for io_uring, a power of 2 (default 1024)\n"
+					"  --congestion-client algo        TCP congestion control algorithm (e.g. bbr,\n"
+					"                                  cubic, reno) on the connection to the client\n"
+					"  --congestion-server algo        TCP congestion control algorithm on the\n"
+					"                                  connection to the server\n"
+					"  --mptcp                         Connect to the server with Multipath TCP,\n"
+					"                                  falling back to TCP if it is refused\n"
+					"  --buffer-size n                 Size of the relay buffer per direction; a\n"
+					"                                  direction stops reading when it is full\n"
+					"                                  (default 64k)\n"
+					"  --buffer-low-watermark n        Resume reading when the buffer drained to n\n"
+					"                                  bytes (default half of the buffer size)\n"
+					"  --buffer-memory n               Upper limit on the memory for relay buffers\n"
+					"                                  of all connections together; directions\n"
+					"                                  wait for memory when it is reached (default\n"
+					"                                  unlimited)\n"
+					"  --client-rcvbuf n               SO_RCVBUF/SO_SNDBUF for the sockets towards\n"
+					"  --client-sndbuf n               the client and towards the server (default:\n"
+					"  --server-rcvbuf n               kernel autotuning)\n"
+					"  --server-sndbuf n               Sizes can have a k, M or G suffix\n"
+					"  --notsent-lowat n               TCP_NOTSENT_LOWAT on both legs: keep at\n"
+					"                                  most about n bytes queued unsent per\n"
+					"                                  direction, to keep latency low (default\n"
+					"                                  unlimited)\n"
+					"  --rate-to-server rate           Limit every connection to rate bytes per\n"
+					"  --rate-to-client rate           second towards the server or the client,\n"
+					"                                  paced by the kernel (default unlimited)\n"
+					"  --total-rate-to-server rate     Limit all connections together, by\n"
+					"  --total-rate-to-client rate     throttling reads (libev engine only)\n"
+					"  --metrics file                  Keep the counters in file, for\n"
+					"                                  tcp-intercept-stat. Must be an absolute path\n"
+					"  --tcp-info-interval s           Sample TCP_INFO (RTT, cwnd, retransmits,\n"
+					"                                  delivery rate, ...) of both legs of every\n"
+					"                                  connection every s seconds, and when it\n"
+					"                                  closes, into histograms in the metrics\n"
+					"  --tcp-info-log file             Append every sample to file as a line of\n"
+					"                                  JSON. Must be an absolute path\n"
 					);
 				if( opt == '?' ) exit(EX_USAGE);
 				exit(EX_OK);
@@ -439,6 +2696,9 @@ int main(int argc, char* argv[]) {
 			case 'n':
 				nodelay = true;
 				break;
+			case 's':
+				use_splice = true;
+				break;
 			case 'f':
 				options.fork = false;
 				break;
@@ -446,7 +2706,7 @@ int main(int argc, char* argv[]) {
 				pidfile = optarg;
 				break;
 			case 'b':
-				options.bind_addr_listen = optarg;
+				options.bind_addrs_listen.push_back( optarg );
 				break;
 			case 'B':
 				options.bind_addr_outgoing = optarg;
@@ -456,8 +2716,182 @@ int main(int argc, char* argv[]) {
 				logfile = fopen(logfilename.c_str(), "a");
 				LogSetOutputFile(NULL, logfile);
 				break;
+			case 'w':
+				options.workers = parse_number("--workers", optarg, 1);
+				break;
+			case OPT_BACKLOG:
+				options.backlog = parse_number("--backlog", optarg, 1);
+				break;
+			case OPT_ACCEPT_BATCH:
+				accept_batch = parse_number("--accept-batch", optarg, 1);
+				break;
+			case OPT_IO_ENGINE:
+				if( strcmp(optarg, "libev") == 0 ) {
+					engine = ENGINE_LIBEV;
+				} else if( strcmp(optarg, "io_uring") == 0 ) {
+#if HAVE_LINUX_IO_URING_H
+					engine = ENGINE_IO_URING;
+#else
+					fprintf(stderr, _("--io-engine io_uring is not available: built without the io_uring kernel headers\n"));
+					exit(EX_USAGE);
+#endif
+				} else {
+					fprintf(stderr, _("Invalid value for %1$s: \"%2$s\"\n"), "--io-engine", optarg);
+					exit(EX_USAGE);
+				}
+				break;
+			case OPT_URING_BUFFERS:
+				uring_buffer_count = parse_number("--uring-buffers", optarg, 1);
+				if( (uring_buffer_count & (uring_buffer_count - 1)) != 0 || uring_buffer_count > 32768 ) {
+					fprintf(stderr, _("Invalid value for %1$s: \"%2$s\"\n"), "--uring-buffers", optarg);
+					exit(EX_USAGE);
+				}
+				break;
+			case OPT_CONGESTION_CLIENT:
+				congestion_client = optarg;
+				check_congestion_control("--congestion-client", congestion_client);
+				break;
+			case OPT_CONGESTION_SERVER:
+				congestion_server = optarg;
+				check_congestion_control("--congestion-server", congestion_server);
+				break;
+			case OPT_MPTCP:
+				use_mptcp = true;
+				break;
+			case OPT_SOCKMAP:
+				use_sockmap = true;
+				break;
+			case OPT_RATE_TO_SERVER:
+				rate_limit_c_to_s = parse_size("--rate-to-server", optarg, 1, (size_t)-1);
+				break;
+			case OPT_RATE_TO_CLIENT:
+				rate_limit_s_to_c = parse_size("--rate-to-client", optarg, 1, (size_t)-1);
+				break;
+			case OPT_TOTAL_RATE_TO_SERVER:
+				total_rate_to_server = parse_size("--total-rate-to-server", optarg, 1, (size_t)-1);
+				break;
+			case OPT_TOTAL_RATE_TO_CLIENT:
+				total_rate_to_client = parse_size("--total-rate-to-client", optarg, 1, (size_t)-1);
+				break;
+			case OPT_BUFFER_SIZE:
+				buffer_size = parse_size("--buffer-size", optarg, 4096, 1UL << 30);
+				break;
+			case OPT_BUFFER_LOW_WATERMARK:
+				options.low_watermark = parse_size("--buffer-low-watermark", optarg, 0, 1UL << 30);
+				break;
+			case OPT_BUFFER_MEMORY:
+				buffer_budget.set_limit( parse_size("--buffer-memory", optarg, 1, (size_t)-1) );
+				break;
+			case OPT_CLIENT_RCVBUF:
+				client_rcvbuf = parse_size("--client-rcvbuf", optarg, 1, INT_MAX);
+				break;
+			case OPT_CLIENT_SNDBUF:
+				client_sndbuf = parse_size("--client-sndbuf", optarg, 1, INT_MAX);
+				break;
+			case OPT_SERVER_RCVBUF:
+				server_rcvbuf = parse_size("--server-rcvbuf", optarg, 1, INT_MAX);
+				break;
+			case OPT_SERVER_SNDBUF:
+				server_sndbuf = parse_size("--server-sndbuf", optarg, 1, INT_MAX);
+				break;
+			case OPT_NOTSENT_LOWAT:
+				notsent_lowat = parse_size("--notsent-lowat", optarg, 1, INT_MAX);
+				break;
+			case OPT_METRICS:
+				metrics_filename = optarg;
+				break;
+			case OPT_TCP_INFO_INTERVAL:
+				tcp_info_interval = parse_seconds("--tcp-info-interval", optarg, 1e7);
+				break;
+			case OPT_TCP_INFO_LOG:
+				tcp_info_filename = optarg;
+				break;
+			case OPT_CONNECT_TIMEOUT:
+				connect_timeout = parse_seconds("--connect-timeout", optarg, 1e7);
+				break;
+			case OPT_IDLE_TIMEOUT:
+				idle_timeout = parse_seconds("--idle-timeout", optarg, 1e7);
+				break;
+			case OPT_FIN_TIMEOUT:
+				fin_timeout = parse_seconds("--fin-timeout", optarg, 1e7);
+				break;
+			case OPT_KEEPALIVE_IDLE:
+				keepalive = true;
+				keepalive_idle = parse_number("--keepalive-idle", optarg, 1);
+				break;
+			case OPT_KEEPALIVE_INTERVAL:
+				keepalive = true;
+				keepalive_interval = parse_number("--keepalive-interval", optarg, 1);
+				break;
+			case OPT_USER_TIMEOUT:
+				user_timeout = parse_seconds("--user-timeout", optarg, INT_MAX / 1000) * 1000;
+				break;
+			case OPT_FASTOPEN:
+				fastopen = true;
+				break;
+			case OPT_DEFER_ACCEPT:
+				options.defer_accept = parse_number("--defer-accept", optarg, 0);
+				break;
+			case OPT_INHERIT_FD:
+				// Started by an upgrade: already detached, don't fork
+				options.inherit_fd = parse_number("--inherit-fd", optarg, 0);
+				options.fork = false;
+				break;
+			case OPT_LOG_LEVEL:
+				if( strcmp(optarg, "debug") == 0 ) {
+					log_level = LEVEL_DEBUG;
+				} else if( strcmp(optarg, "info") == 0 ) {
+					log_level = LEVEL_INFO;
+				} else if( strcmp(optarg, "warn") == 0 ) {
+					log_level = LEVEL_WARN;
+				} else if( strcmp(optarg, "error") == 0 ) {
+					log_level = LEVEL_ERROR;
+				} else {
+					fprintf(stderr, _("Invalid value for %1$s: \"%2$s\"\n"), "--log-level", optarg);
+					exit(EX_USAGE);
+				}
+				break;
 			}
 		}
+
+		if( (total_rate_to_server != 0 || total_rate_to_client != 0)
+		    && (engine == ENGINE_IO_URING || use_sockmap) ) {
+			fprintf(stderr, _("--total-rate-to-server and --total-rate-to-client only work with --io-engine libev, without --sockmap\n"));
+			exit(EX_USAGE);
+		}
+		// Bursts of a tenth of a second
+		if( total_rate_to_server != 0 ) {
+			total_rate_c_to_s.set_rate(total_rate_to_server, std::max<uint64_t>(total_rate_to_server / 10, 4 * RATE_CHUNK));
+		}
+		if( total_rate_to_client != 0 ) {
+			total_rate_s_to_c.set_rate(total_rate_to_client, std::max<uint64_t>(total_rate_to_client / 10, 4 * RATE_CHUNK));
+		}
+	}
+
+	if( options.defer_accept < 0 ) options.defer_accept = fastopen ? 1 : 0;
+	if( options.bind_addrs_listen.empty() ) options.bind_addrs_listen.push_back("[0.0.0.0]:[5000]");
+
+	if( use_sockmap && engine == ENGINE_IO_URING ) {
+		fprintf(stderr, _("--sockmap only works with --io-engine libev\n"));
+		exit(EX_USAGE);
+	}
+
+	if( options.inherit_fd >= 0 ) {
+		try {
+			handoff.reset( new Handoff(options.inherit_fd) );
+		} catch( Errno &e ) {
+			LogError(_("Could not take over: %s"), e.what());
+			exit(EX_OSERR);
+		}
+	}
+
+	if( options.low_watermark < 0 ) {
+		buffer_low_watermark = buffer_size / 2;
+	} else if( (size_t)options.low_watermark >= buffer_size ) {
+		fprintf(stderr, _("The buffer low watermark must be below the buffer size\n"));
+		exit(EX_USAGE);
+	} else {
+		buffer_low_watermark = options.low_watermark;
 	}
 
 	/* Set indetification string for the daemon for both syslog and PID file */
@@ -465,58 +2899,135 @@ int main(int argc, char* argv[]) {
 
 	LogInfo(_("%1$s version %2$s starting up"), PACKAGE_NAME, PACKAGE_VERSION " (" PACKAGE_GITREVISION ")");
 
-	Socket s_listen;
-	{ // Open listening socket
-		std::string host, port;
+	{ // Open listening sockets, one per worker and address
+		for( typeof(options.bind_addrs_listen.begin()) b = options.bind_addrs_listen.begin();
+		     b != options.bind_addrs_listen.end(); ++b ) {
+			std::string host, port;
 
-		/* Address format is
-		 *   - hostname:portname
-		 *   - [numeric ip]:portname
-		 *   - hostname:[portnumber]
-		 *   - [numeric ip]:[portnumber]
-		 */
-		size_t c = options.bind_addr_listen.rfind(":");
-		if( c == std::string::npos ) {
-			/* TRANSLATORS: %1$s contains the string passed as option
+			/* Address format is
+			 *   - hostname:portname
+			 *   - [numeric ip]:portname
+			 *   - hostname:[portnumber]
+			 *   - [numeric ip]:[portnumber]
 			 */
-			fprintf(stderr, _("Invalid bind string \"%1$s\": could not find ':'\n"), options.bind_addr_listen.c_str());
-			exit(EX_DATAERR);
+			size_t c = b->rfind(":");
+			if( c == std::string::npos ) {
+				/* TRANSLATORS: %1$s contains the string passed as option
+				 */
+				fprintf(stderr, _("Invalid bind string \"%1$s\": could not find ':'\n"), b->c_str());
+				exit(EX_DATAERR);
+			}
+			host = b->substr(0, c);
+			port = b->substr(c+1);
+
+			std::vector< SockAddr::SockAddr > bind_sa
+				= SockAddr::resolve( host, port, 0, SOCK_STREAM, 0);
+			if( bind_sa.size() == 0 ) {
+				fprintf(stderr, _("Can not bind to \"%1$s\": Could not resolve\n"), b->c_str());
+				exit(EX_DATAERR);
+			}
+			// Every address it resolves to (e.g. both IPv4 and IPv6), once
+			for( typeof(bind_sa.begin()) i = bind_sa.begin(); i != bind_sa.end(); ++i ) {
+				if( std::find(bind_listen_addrs.begin(), bind_listen_addrs.end(), *i) == bind_listen_addrs.end() ) {
+					bind_listen_addrs.push_back( *i );
+				}
+			}
 		}
-		host = options.bind_addr_listen.substr(0, c);
-		port = options.bind_addr_listen.substr(c+1);
 
-		std::auto_ptr< boost::ptr_vector< SockAddr::SockAddr> > bind_sa
-			= SockAddr::resolve( host, port, 0, SOCK_STREAM, 0);
-		if( bind_sa->size() == 0 ) {
-			fprintf(stderr, _("Can not bind to \"%1$s\": Could not resolve\n"), options.bind_addr_listen.c_str());
-			exit(EX_DATAERR);
-		} else if( bind_sa->size() > 1 ) {
-			// TODO: allow this
-			fprintf(stderr, _("Can not bind to \"%1$s\": Resolves to multiple entries:\n"), options.bind_addr_listen.c_str());
-			for( typeof(bind_sa->begin()) i = bind_sa->begin(); i != bind_sa->end(); i++ ) {
-				std::cerr << "  " << i->string() << "\n";
+		// The listening sockets of the previous instance are used as they
+		// are: closing one would reset the connections in its queue
+		std::vector< std::vector<int> > inherited( bind_listen_addrs.size() ); // per address
+		if( handoff.get() != NULL ) {
+			std::vector<int> fds;
+			try {
+				int maps[2];
+				handoff->receive_listeners(fds, maps);
+				if( maps[0] != -1 ) sockmap.reset( new SockMap(maps[0], maps[1]) );
+			} catch( Errno &e ) {
+				LogError(_("Could not take over: %s"), e.what());
+				exit(EX_OSERR);
+			}
+			for( typeof(fds.begin()) i = fds.begin(); i != fds.end(); ++i ) {
+				Socket s( *i );
+				SockAddr::SockAddr addr = s.getsockname();
+				size_t a = std::find(bind_listen_addrs.begin(), bind_listen_addrs.end(), addr) - bind_listen_addrs.begin();
+				if( a == bind_listen_addrs.size() ) {
+					/* TRANSLATORS: %1$s contains the address of the listening socket */
+					LogWarn(_("Not taking over the listening socket on %1$s, it is not bound to a --bind-listen address"),
+						addr.string().c_str());
+					continue; // and the Socket closes it
+				}
+				inherited[a].push_back( s.release() );
+			}
+			size_t most = 0;
+			for( typeof(inherited.begin()) i = inherited.begin(); i != inherited.end(); ++i ) {
+				most = std::max(most, i->size());
+			}
+			if( (long)most > options.workers ) {
+				/* TRANSLATORS: %1$zu contains the number of worker threads */
+				LogInfo(_("Keeping %1$zu workers, one per listening socket taken over"), most);
+				options.workers = most;
 			}
-			exit(EX_DATAERR);
 		}
-		s_listen = Socket::socket( (*bind_sa)[0].proto_family() , SOCK_STREAM, 0);
-		s_listen.set_reuseaddr();
-		s_listen.bind((*bind_sa)[0]);
-		s_listen.listen(MAX_CONN_BACKLOG);
+
+		for( long i = 0; i < options.workers; i++ ) {
+			std::auto_ptr<struct worker> wrk( new struct worker );
+			wrk->number = i;
+			for( size_t a = 0; a < bind_listen_addrs.size(); a++ ) {
+				SockAddr::SockAddr const &addr = bind_listen_addrs[a];
+				std::auto_ptr<struct listener> l( new struct listener );
+				if( i < (long)inherited[a].size() ) {
+					l->s_listen.reset( inherited[a][i] );
+					wrk->listeners.push_back( l.release() );
+					continue;
+				}
+				l->s_listen = Socket::socket( addr.proto_family() , SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+				l->s_listen.set_reuseaddr();
+				l->s_listen.set_reuseport();
+				if( addr.proto_family() == PF_INET6 && bind_listen_addrs.size() > 1 ) {
+					// Leave IPv4 to the IPv4 addresses, instead of getting it
+					// here as v4-mapped addresses (or failing to bind)
+					int value = 1;
+					l->s_listen.setsockopt(IPPROTO_IPV6, IPV6_V6ONLY, &value, sizeof(value));
+				}
+				// Accepted sockets inherit these; setting them before listen()
+				// gets the window scale right
+				if( client_rcvbuf > 0 ) {
+					l->s_listen.setsockopt(SOL_SOCKET, SO_RCVBUF, &client_rcvbuf, sizeof(client_rcvbuf));
+				}
+				if( client_sndbuf > 0 ) {
+					l->s_listen.setsockopt(SOL_SOCKET, SO_SNDBUF, &client_sndbuf, sizeof(client_sndbuf));
+				}
+				l->s_listen.bind(addr);
+				l->s_listen.listen(options.backlog);
+				if( fastopen ) {
+					int qlen = options.backlog; // connections with data in the SYN
+					l->s_listen.setsockopt(IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen));
+				}
+				if( options.defer_accept > 0 ) {
+					int value = options.defer_accept;
+					l->s_listen.setsockopt(IPPROTO_TCP, TCP_DEFER_ACCEPT, &value, sizeof(value));
+				}
 
 #if HAVE_DECL_IP_TRANSPARENT
-		int value = 1;
-		s_listen.setsockopt(SOL_IP, IP_TRANSPARENT, &value, sizeof(value));
+				int value = 1;
+				l->s_listen.setsockopt(SOL_IP, IP_TRANSPARENT, &value, sizeof(value));
 #endif
+				wrk->listeners.push_back( l.release() );
+			}
+			workers.push_back( wrk.release() );
+		}
 
-		/* TRANSLATORS: %1$s contains the listening address
-		 */
-		LogInfo(_("Listening on %s"), (*bind_sa)[0].string().c_str());
-
-		bind_listen_addr.reset( bind_sa->release(bind_sa->begin()).release() ); // Transfer ownership; TODO: this should be simpeler that double release()
+		for( typeof(bind_listen_addrs.begin()) i = bind_listen_addrs.begin(); i != bind_listen_addrs.end(); ++i ) {
+			/* TRANSLATORS: %1$s contains the listening address,
+			   %2$ld the number of worker threads
+			 */
+			LogInfo(_("Listening on %1$s with %2$ld workers"), i->string().c_str(), options.workers);
+		}
 	}
 
 	if( options.bind_addr_outgoing == "client" ) {
-		bind_addr_outgoing.reset(NULL);
+		bind_addr_outgoing = SockAddr::SockAddr();
 		LogInfo(_("Outgoing connections will connect from original source address"));
 	} else { // Resolve client address
 		std::string host, port;
@@ -537,21 +3048,74 @@ int main(int argc, char* argv[]) {
 		host = options.bind_addr_outgoing.substr(0, c);
 		port = options.bind_addr_outgoing.substr(c+1);
 
-		std::auto_ptr< boost::ptr_vector< SockAddr::SockAddr> > bind_sa
+		std::vector< SockAddr::SockAddr > bind_sa
 			= SockAddr::resolve( host, port, 0, SOCK_STREAM, 0);
-		if( bind_sa->size() == 0 ) {
+		if( bind_sa.size() == 0 ) {
 			fprintf(stderr, _("Can not bind to \"%1$s\": Could not resolve\n"), options.bind_addr_outgoing.c_str());
 			exit(EX_DATAERR);
-		} else if( bind_sa->size() > 1 ) {
+		} else if( bind_sa.size() > 1 ) {
 			fprintf(stderr, _("Can not bind to \"%1$s\": Resolves to multiple entries:\n"), options.bind_addr_outgoing.c_str());
-			for( typeof(bind_sa->begin()) i = bind_sa->begin(); i != bind_sa->end(); i++ ) {
+			for( typeof(bind_sa.begin()) i = bind_sa.begin(); i != bind_sa.end(); i++ ) {
 				std::cerr << "  " << i->string() << "\n";
 			}
 			exit(EX_DATAERR);
 		}
-		bind_addr_outgoing.reset( bind_sa->release(bind_sa->begin()).release() ); // Transfer ownership; TODO: this should be simpeler that double release()
+		bind_addr_outgoing = bind_sa[0];
+
+		LogInfo(_("Outgoing connections will connect from %1$s"), bind_addr_outgoing.string().c_str());
+	}
 
-		LogInfo(_("Outgoing connections will connect from %1$s"), bind_addr_outgoing->string().c_str());
+	if( use_splice ) {
+		LogInfo(_("Relaying data with splice(), without copying to userspace"));
+	}
+	if( engine == ENGINE_IO_URING ) {
+		LogInfo(_("Doing I/O through io_uring"));
+	}
+	if( rate_limit_c_to_s != 0 || rate_limit_s_to_c != 0 ) {
+		/* TRANSLATORS: %1$llu and %2$llu contain the rates in bytes per second,
+		   0 for unlimited */
+		LogInfo(_("Connections limited to %1$llu bytes/s towards the server, %2$llu bytes/s towards the client"),
+			(unsigned long long)rate_limit_c_to_s, (unsigned long long)rate_limit_s_to_c);
+	}
+	if( total_rate_c_to_s.limited() || total_rate_s_to_c.limited() ) {
+		LogInfo(_("All connections together limited to %1$llu bytes/s towards the server, %2$llu bytes/s towards the client"),
+			(unsigned long long)total_rate_c_to_s.rate(), (unsigned long long)total_rate_s_to_c.rate());
+	}
+	if( tcp_info_interval > 0 ) {
+		/* TRANSLATORS: %1$g contains the interval in seconds */
+		LogInfo(_("Sampling TCP_INFO of every connection every %1$g seconds"), tcp_info_interval);
+	}
+	if( notsent_lowat != 0 ) {
+		/* TRANSLATORS: %1$zu contains a size in bytes */
+		LogInfo(_("Keeping at most about %1$zu bytes unsent per socket"), notsent_lowat);
+	}
+	if( buffer_budget.limit() != 0 ) {
+		/* TRANSLATORS: %1$zu contains the memory limit in bytes,
+		   %2$zu the size of one buffer */
+		LogInfo(_("Relay buffers limited to %1$zu bytes in total, %2$zu bytes per direction"),
+			buffer_budget.limit(), buffer_size);
+	}
+	if( use_mptcp ) {
+		try {
+			Socket s;
+			if( open_server_socket(s, AF_INET) ) {
+				LogInfo(_("Connecting to servers with MPTCP"));
+			} else {
+				LogWarn(_("The kernel does not support MPTCP, connecting to servers with TCP"));
+				use_mptcp = false;
+			}
+		} catch( Errno &e ) {
+			LogError(_("Error: %s"), e.what());
+			exit(EX_OSERR);
+		}
+	}
+	if( ! congestion_client.empty() || ! congestion_server.empty() ) {
+		/* TRANSLATORS: %1$s and %2$s contain the names of the congestion
+		   control algorithms, or "default"
+		 */
+		LogInfo(_("Congestion control: %1$s towards the client, %2$s towards the server"),
+			congestion_client.empty() ? _("default") : congestion_client.c_str(),
+			congestion_server.empty() ? _("default") : congestion_server.c_str());
 	}
 
 	if( options.fork ) {
@@ -580,7 +3144,15 @@ int main(int argc, char* argv[]) {
 
 		/* Close all FDs; 0, 1 and 2 are kept open anyway and point to
 		 * /dev/null (done by daemon_fork()) */
-		daemon_close_all(s_listen, fileno(logfile), -1);
+		std::vector<int> keep_fds;
+		for( typeof(workers.begin()) i = workers.begin(); i != workers.end(); ++i ) {
+			for( typeof(i->listeners.begin()) l = i->listeners.begin(); l != i->listeners.end(); ++l ) {
+				keep_fds.push_back( l->s_listen );
+			}
+		}
+		if( logfile != NULL ) keep_fds.push_back( fileno(logfile) );
+		keep_fds.push_back( -1 );
+		daemon_close_allv(&keep_fds[0]);
 	}
 
 	if( pidfile != NULL ) { // PID-file
@@ -591,6 +3163,71 @@ int main(int argc, char* argv[]) {
 		}
 	}
 
+	try {
+		metrics.reset( MetricsSegment::create(metrics_filename, workers.size()) );
+	} catch( Errno &e ) {
+		LogError(_("Could not set up the metrics: %s"), e.what());
+		daemon_retval_send(EX_OSERR);
+		exit(EX_OSERR);
+	}
+	metrics->header()->buffer_memory_limit = buffer_budget.limit();
+	metrics->header()->buffer_size = buffer_size;
+	for( size_t i = 0; i < workers.size(); i++ ) {
+		workers[i].metrics = metrics->worker(i);
+	}
+
+	bool listen_any = false;
+	for( typeof(bind_listen_addrs.begin()) i = bind_listen_addrs.begin(); i != bind_listen_addrs.end(); ++i ) {
+		if( i->is_any() ) listen_any = true;
+	}
+	if( listen_any ) {
+		// Every worker keeps its own copy of the local addresses
+		try {
+			for( typeof(workers.begin()) i = workers.begin(); i != workers.end(); ++i ) {
+				i->local_addrs.reset( new LocalAddresses );
+			}
+		} catch( Errno &e ) {
+			LogError(_("Could not get the local addresses: %s"), e.what());
+			daemon_retval_send(EX_OSERR);
+			exit(EX_OSERR);
+		}
+	}
+
+	if( engine == ENGINE_IO_URING ) {
+		try {
+			for( typeof(workers.begin()) i = workers.begin(); i != workers.end(); ++i ) {
+				i->uring.reset( new IoUring(URING_ENTRIES) );
+				if( ! use_splice ) {
+					// These are allocated up front, charge them to the budget right away
+					if( ! buffer_budget.reserve(uring_buffer_count * URING_BUFFER_SIZE) ) {
+						throw Errno("Receive buffers exceed --buffer-memory", ENOMEM);
+					}
+					i->uring_buffers.reset( new ProvidedBuffers(*i->uring, 0, uring_buffer_count, URING_BUFFER_SIZE) );
+				}
+				i->uring_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+				if( i->uring_eventfd == -1 ) throw Errno("Could not create eventfd", errno);
+				i->uring->register_eventfd(i->uring_eventfd);
+				uring_arm_accept(&(*i));
+			}
+		} catch( Errno &e ) {
+			LogError(_("Could not set up io_uring: %s"), e.what());
+			daemon_retval_send(EX_OSERR);
+			exit(EX_OSERR);
+		}
+	}
+
+	if( use_sockmap && sockmap.get() == NULL ) {
+		try {
+			sockmap.reset( new SockMap(SOCKMAP_CONNECTIONS) );
+			LogInfo(_("Relaying established connections in the kernel with a sockmap"));
+		} catch( Errno &e ) {
+			LogWarn(_("Could not set up the sockmap, relaying in userspace: %s"), e.what());
+			use_sockmap = false;
+		}
+	} else if( use_sockmap ) {
+		LogInfo(_("Relaying established connections in the kernel with the sockmap taken over"));
+	}
+
 	// Let our parent know that we're doing fine
 	daemon_retval_send(0);
 
@@ -611,22 +3248,106 @@ int main(int argc, char* argv[]) {
 		ev_signal_init( &ev_sigpipe_watcher, received_sigpipe, SIGPIPE);
 		ev_signal_start( EV_DEFAULT_ &ev_sigpipe_watcher);
 
+		ev_signal ev_sigusr2_watcher;
+		ev_signal_init( &ev_sigusr2_watcher, received_sigusr2, SIGUSR2);
+		ev_signal_start( EV_DEFAULT_ &ev_sigusr2_watcher);
+
+
+		ev_async_init( &e_worker_failed, received_worker_failed );
+		ev_async_start( EV_DEFAULT_ &e_worker_failed );
+
+		// Signals are handled by the main thread only
+		sigset_t all_signals, old_signals;
+		sigfillset(&all_signals);
+		pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+		async_log.reset( new AsyncLog(workers.size()) );
+		try {
+			async_log->start();
+		} catch( Errno &e ) {
+			LogError(_("Could not start log thread: %s"), e.what());
+			exit(EX_OSERR);
+		}
+		if( ! tcp_info_filename.empty() ) {
+			try {
+				tcp_info_log.reset( new TcpInfoLog(tcp_info_filename, workers.size()) );
+				tcp_info_log->start();
+			} catch( Errno &e ) {
+				LogError(_("Could not set up the TCP_INFO log: %s"), e.what());
+				exit(EX_OSERR);
+			}
+		}
+
+		for( typeof(workers.begin()) i = workers.begin(); i != workers.end(); ++i ) {
+			i->loop = ev_loop_new(EVFLAG_AUTO);
+			ev_set_userdata(i->loop, &(*i));
+			i->log_ring = async_log->ring(i->number);
+			if( tcp_info_log.get() != NULL ) i->tcp_info_ring = tcp_info_log->ring(i->number);
+
+			if( i->uring.get() != NULL ) {
+				// Accepting is done by io_uring as well
+				ev_io_init( &i->e_uring, uring_ready, i->uring_eventfd, EV_READ );
+				ev_io_start( i->loop, &i->e_uring );
+				ev_prepare_init( &i->e_uring_submit, uring_submit );
+				ev_prepare_start( i->loop, &i->e_uring_submit );
+			} else {
+				for( typeof(i->listeners.begin()) l = i->listeners.begin(); l != i->listeners.end(); ++l ) {
+					l->e_listen.data = &l->s_listen;
+					ev_io_init( &l->e_listen, listening_socket_ready_for_read, l->s_listen, EV_READ );
+					ev_io_start( i->loop, &l->e_listen );
+				}
+			}
+
+			ev_timer_init( &i->e_memory_retry, memory_retry, 0.1, 0. );
+			ev_timer_init( &i->e_rate_retry, rate_retry, 0.1, 0. );
+			ev_timer_init( &i->e_accept_retry, accept_retry, 0.1, 0. );
+			ev_timer_init( &i->e_timers, timers_tick, 0., TIMER_TICK );
+
+			ev_async_init( &i->e_stop, received_stop );
+			ev_async_start( i->loop, &i->e_stop );
+
+			if( i->local_addrs.get() != NULL ) {
+				i->e_local_addrs.data = i->local_addrs.get();
+				ev_io_init( &i->e_local_addrs, local_addresses_changed, i->local_addrs->fd(), EV_READ );
+				ev_io_start( i->loop, &i->e_local_addrs );
+			}
+		}
+
+		// Connections of the previous instance go in before anything runs
+		if( handoff.get() != NULL ) adopt_connections();
+
+		for( typeof(workers.begin()) i = workers.begin(); i != workers.end(); ++i ) {
+			int rv = pthread_create(&i->thread, NULL, worker_main, &(*i));
+			if( rv != 0 ) {
+				LogError(_("Could not start worker thread: %s"), strerror(rv));
+				exit(EX_OSERR);
+			}
+		}
 
-		ev_io e_listen;
-		e_listen.data = &s_listen;
-		ev_io_init( &e_listen, listening_socket_ready_for_read, s_listen, EV_READ );
-		ev_io_start( EV_DEFAULT_ &e_listen );
+		pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
 
 		LogInfo(_("Setup done, starting event loop"));
 		try {
 			ev_run(EV_DEFAULT_ 0);
 		} catch( std::exception &e ) {
 			std::cerr << e.what() << "\n";
-			return EX_SOFTWARE;
+			worker_failed = true;
+		}
+
+		for( typeof(workers.begin()) i = workers.begin(); i != workers.end(); ++i ) {
+			ev_async_send( i->loop, &i->e_stop );
+			pthread_join( i->thread, NULL );
+			ev_loop_destroy( i->loop );
 		}
+		if( handing_off ) handoff_connections();
+		workers.clear();
+		async_log->stop(); // Write out what the workers left behind
+		if( tcp_info_log.get() != NULL ) tcp_info_log->stop();
+
+		if( worker_failed ) return EX_SOFTWARE;
 	}
 
 	LogInfo(_("Exiting cleanly..."));
-	daemon_pid_file_remove();
+	if( ! handing_off ) daemon_pid_file_remove(); // it's the new instance's now
 	return EX_OK;
 }
@@ -0,0 +1,677 @@
+#include "../config.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <getopt.h>
+#include <sysexits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
+
+#include "../Socket/Socket.hxx"
+
+/*
+ * Load generator for "make bench" (see bench.sh)
+ * Runs either as the server, or as a client that drives one workload against
+ * it and prints the results as a single JSON object on stdout.
+ * The soak workload also watches the memory, file descriptors and CPU time of
+ * the tcp-intercept process, and fails if they grow too much per connection.
+ *
+ * The first byte on every connection tells the server what to do:
+ *  'E': echo everything back, until EOF
+ *  'S': read and discard everything, until EOF
+ */
+
+static double now() throw() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static SockAddr::SockAddr parse_address(std::string const &s) {
+	size_t c = s.rfind(":");
+	if( c == std::string::npos ) {
+		fprintf(stderr, "Invalid address \"%s\": could not find ':'\n", s.c_str());
+		exit(EX_USAGE);
+	}
+	std::vector<SockAddr::SockAddr> a = SockAddr::resolve(s.substr(0, c), s.substr(c+1), 0, SOCK_STREAM, 0);
+	if( a.empty() ) {
+		fprintf(stderr, "Could not resolve \"%s\"\n", s.c_str());
+		exit(EX_USAGE);
+	}
+	return a[0];
+}
+
+/**
+ * Allow as many file descriptors as we're allowed to
+ */
+static void raise_fd_limit() throw() {
+	struct rlimit rl;
+	if( getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max ) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+static void sleep_for(double const seconds) throw() {
+	struct timespec ts;
+	ts.tv_sec = (time_t)seconds;
+	ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+	while( nanosleep(&ts, &ts) == -1 && errno == EINTR ) {}
+}
+
+static bool send_all(Socket &s, char const *buf, size_t len) throw() {
+	while( len > 0 ) {
+		ssize_t rv = s.try_send(buf, len, MSG_NOSIGNAL);
+		if( rv == -EINTR ) continue;
+		if( rv <= 0 ) return false;
+		buf += rv;
+		len -= rv;
+	}
+	return true;
+}
+
+static bool recv_all(Socket &s, char *buf, size_t len) throw() {
+	while( len > 0 ) {
+		ssize_t rv = s.try_recv(buf, len);
+		if( rv == -EINTR ) continue;
+		if( rv <= 0 ) return false;
+		buf += rv;
+		len -= rv;
+	}
+	return true;
+}
+
+/**
+ * The same address with the port number moved up by offset
+ */
+static SockAddr::SockAddr port_offset(SockAddr::SockAddr const &a, unsigned int const offset) {
+	struct sockaddr_storage sa;
+	memcpy(&sa, static_cast<struct sockaddr const*>(a), a.addr_len());
+	if( a.addr_family() == AF_INET6 ) {
+		reinterpret_cast<struct sockaddr_in6*>(&sa)->sin6_port = htons(a.port_number() + offset);
+	} else {
+		reinterpret_cast<struct sockaddr_in*>(&sa)->sin_port = htons(a.port_number() + offset);
+	}
+	return SockAddr::SockAddr(&sa);
+}
+
+static Socket open_connection(SockAddr::SockAddr const &target, char const mode) throw(Errno) {
+	Socket s( Socket::socket(target.proto_family(), SOCK_STREAM | SOCK_CLOEXEC, 0) );
+	int val = 1;
+	s.setsockopt(IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val));
+	s.connect(target);
+	if( ! send_all(s, &mode, 1) ) throw Errno("Could not send()", errno);
+	return s;
+}
+
+
+/*
+ * Server
+ */
+
+struct server_connection {
+	char mode;        // 0 until the first byte arrived
+	std::string pending; // echo data the socket didn't take yet
+};
+
+static void* server_thread(void *arg) {
+	Socket &s_listen = *reinterpret_cast<Socket*>(arg);
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	if( ep == -1 ) { perror("epoll_create1"); exit(EX_OSERR); }
+	std::vector<server_connection*> cons;
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = s_listen;
+	epoll_ctl(ep, EPOLL_CTL_ADD, s_listen, &ev);
+
+	struct epoll_event events[256];
+	char buf[65536];
+	while( true ) {
+		int n = epoll_wait(ep, events, 256, -1);
+		for( int i = 0; i < n; i++ ) {
+			int fd = events[i].data.fd;
+			if( fd == s_listen ) {
+				int c;
+				while( (c = s_listen.try_accept(NULL)) >= 0 ) {
+					if( c >= (signed)cons.size() ) cons.resize(c + 1, NULL);
+					cons[c] = new server_connection;
+					cons[c]->mode = 0;
+					ev.events = EPOLLIN;
+					ev.data.fd = c;
+					epoll_ctl(ep, EPOLL_CTL_ADD, c, &ev);
+				}
+				continue;
+			}
+
+			server_connection *con = cons[fd];
+			bool closed = false;
+			if( ! con->pending.empty() ) {
+				ssize_t rv = send(fd, con->pending.data(), con->pending.size(), MSG_NOSIGNAL);
+				if( rv > 0 ) con->pending.erase(0, rv);
+				else if( errno != EAGAIN ) closed = true;
+			}
+			while( ! closed && con->pending.empty() ) {
+				ssize_t rv = recv(fd, buf, sizeof(buf), 0);
+				if( rv < 0 && errno == EAGAIN ) break;
+				if( rv <= 0 ) { closed = true; break; }
+				char *data = buf;
+				if( con->mode == 0 ) {
+					con->mode = *data++;
+					rv--;
+				}
+				if( con->mode != 'E' || rv == 0 ) continue;
+				ssize_t sent = send(fd, data, rv, MSG_NOSIGNAL);
+				if( sent < 0 && errno != EAGAIN ) { closed = true; break; }
+				if( sent < 0 ) sent = 0;
+				con->pending.assign(data + sent, rv - sent);
+			}
+			if( closed ) {
+				close(fd);
+				delete con;
+				cons[fd] = NULL;
+				continue;
+			}
+			ev.events = con->pending.empty() ? EPOLLIN : EPOLLOUT;
+			ev.data.fd = fd;
+			epoll_ctl(ep, EPOLL_CTL_MOD, fd, &ev);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Listen on ports consecutive ports, with threads threads on each
+ */
+static void run_server(SockAddr::SockAddr const &listen_addr, unsigned int const threads, unsigned int const ports) {
+	std::vector<pthread_t> tids(threads * ports);
+	for( unsigned int i = 0; i < tids.size(); i++ ) {
+		Socket *s = new Socket( Socket::socket(listen_addr.proto_family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0) );
+		s->set_reuseaddr();
+		s->set_reuseport();
+		s->bind( port_offset(listen_addr, i % ports) );
+		s->listen(SOMAXCONN);
+		pthread_create(&tids[i], NULL, server_thread, s);
+	}
+	for( unsigned int i = 0; i < tids.size(); i++ ) pthread_join(tids[i], NULL);
+}
+
+
+/*
+ * Clients
+ */
+
+struct client_job {
+	SockAddr::SockAddr target;
+	double deadline;
+	size_t size;
+
+	// results
+	std::vector<double> latencies; // seconds
+	unsigned long long operations, failures, bytes;
+	double finished;
+};
+
+/**
+ * Connect, exchange one byte, close; as often as possible
+ */
+static void* cps_thread(void *arg) {
+	client_job &job = *reinterpret_cast<client_job*>(arg);
+	while( now() < job.deadline ) {
+		double start = now();
+		try {
+			Socket s( open_connection(job.target, 'E') );
+			char c = 'x';
+			if( ! send_all(s, &c, 1) || ! recv_all(s, &c, 1) ) throw Errno("Echo failed", EPIPE);
+			job.latencies.push_back( now() - start );
+			job.operations++;
+		} catch( Errno &e ) {
+			job.failures++;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Send as much as possible until the deadline, then wait until the server
+ * has seen all of it
+ */
+static void* throughput_thread(void *arg) {
+	client_job &job = *reinterpret_cast<client_job*>(arg);
+	std::vector<char> buf(job.size, 'x');
+	try {
+		Socket s( open_connection(job.target, 'S') );
+		while( now() < job.deadline ) {
+			if( ! send_all(s, &buf[0], buf.size()) ) throw Errno("Could not send()", EPIPE);
+			job.bytes += buf.size();
+		}
+		s.shutdown(SHUT_WR);
+		while( s.try_recv(&buf[0], buf.size()) > 0 ) {}
+		job.operations++;
+	} catch( Errno &e ) {
+		job.failures++;
+	}
+	job.finished = now();
+	return NULL;
+}
+
+/**
+ * Request/response over one connection: send size bytes, wait for the echo
+ */
+static void* latency_thread(void *arg) {
+	client_job &job = *reinterpret_cast<client_job*>(arg);
+	std::vector<char> buf(job.size, 'x');
+	try {
+		Socket s( open_connection(job.target, 'E') );
+		while( now() < job.deadline ) {
+			double start = now();
+			if( ! send_all(s, &buf[0], buf.size()) || ! recv_all(s, &buf[0], buf.size()) ) {
+				throw Errno("Echo failed", EPIPE);
+			}
+			job.latencies.push_back( now() - start );
+			job.operations++;
+		}
+	} catch( Errno &e ) {
+		job.failures++;
+	}
+	return NULL;
+}
+
+static void run_threads(void *(*fn)(void*), std::vector<client_job> &jobs) {
+	std::vector<pthread_t> tids(jobs.size());
+	for( size_t i = 0; i < jobs.size(); i++ ) {
+		int rv = pthread_create(&tids[i], NULL, fn, &jobs[i]);
+		if( rv != 0 ) {
+			fprintf(stderr, "Could not start thread: %s\n", strerror(rv));
+			exit(EX_OSERR);
+		}
+	}
+	for( size_t i = 0; i < jobs.size(); i++ ) pthread_join(tids[i], NULL);
+}
+
+static void print_percentiles(std::vector<double> &v) {
+	std::sort(v.begin(), v.end());
+	double const q[] = { 0.5, 0.9, 0.99, 0.999 };
+	char const * const name[] = { "p50", "p90", "p99", "p999" };
+	printf("\"latency_us\": {");
+	for( unsigned int i = 0; i < 4; i++ ) {
+		double val = v.empty() ? 0 : v[ std::min(v.size() - 1, (size_t)(q[i] * v.size())) ] * 1e6;
+		printf("\"%s\": %.1f, ", name[i], val);
+	}
+	printf("\"max\": %.1f}", v.empty() ? 0 : v.back() * 1e6);
+}
+
+/**
+ * Open connections connections, keep them idle for hold seconds, and check
+ * that they all still work
+ */
+static void run_idle(SockAddr::SockAddr const &target, unsigned int const connections, double const hold) {
+	std::vector<Socket*> cons;
+	unsigned long long failures = 0, alive = 0;
+	double start = now();
+	for( unsigned int i = 0; i < connections; i++ ) {
+		try {
+			cons.push_back( new Socket( open_connection(target, 'E') ) );
+		} catch( Errno &e ) {
+			failures++;
+		}
+	}
+	double setup = now() - start;
+
+	sleep_for(hold);
+
+	for( size_t i = 0; i < cons.size(); i++ ) {
+		char c = 'x';
+		struct pollfd p;
+		p.fd = *cons[i];
+		p.events = POLLIN;
+		if( send_all(*cons[i], &c, 1) && poll(&p, 1, 5000) == 1 && recv_all(*cons[i], &c, 1) ) {
+			alive++;
+		}
+		delete cons[i];
+	}
+
+	printf("{\"workload\": \"idle\", \"connections\": %u, \"hold_s\": %.1f, "
+	       "\"established\": %zu, \"failures\": %llu, \"alive_after_hold\": %llu, "
+	       "\"setup_s\": %.3f, \"setup_per_s\": %.1f}\n",
+	       connections, hold, cons.size(), failures, alive,
+	       setup, setup > 0 ? cons.size() / setup : 0.);
+}
+
+
+/*
+ * Soak test
+ */
+
+struct process_sample {
+	unsigned long long rss; // bytes
+	unsigned long fds;
+	double cpu;             // seconds, user + system
+};
+
+static process_sample sample_process(pid_t const pid) {
+	process_sample p;
+	memset(&p, 0, sizeof(p));
+	char path[64];
+
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	FILE *f = fopen(path, "r");
+	if( f == NULL ) {
+		fprintf(stderr, "Could not read %s: %s\n", path, strerror(errno));
+		exit(EX_NOINPUT);
+	}
+	char line[256];
+	while( fgets(line, sizeof(line), f) != NULL ) {
+		unsigned long long kb;
+		if( sscanf(line, "VmRSS: %llu kB", &kb) == 1 ) p.rss = kb * 1024;
+	}
+	fclose(f);
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	f = fopen(path, "r");
+	if( f != NULL ) {
+		// The command name can contain spaces, skip past its closing ')'
+		if( fgets(line, sizeof(line), f) != NULL && strrchr(line, ')') != NULL ) {
+			unsigned long utime, stime;
+			if( sscanf(strrchr(line, ')') + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+			           &utime, &stime) == 2 ) {
+				p.cpu = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+			}
+		}
+		fclose(f);
+	}
+
+	snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+	DIR *d = opendir(path);
+	if( d != NULL ) {
+		struct dirent *e;
+		while( (e = readdir(d)) != NULL ) {
+			if( e->d_name[0] != '.' ) p.fds++;
+		}
+		closedir(d);
+	}
+	return p;
+}
+
+struct soak_limits {
+	double rss_per_flow;  // bytes
+	double fds_per_flow;
+	double cpu_per_flow;  // microseconds to set up a connection
+};
+
+/**
+ * Ramp up to every plateau in turn, with slow_percent of the connections
+ * reading nothing while size bytes are relayed to them, the rest idle
+ * Returns false if a limit was exceeded.
+ */
+static bool run_soak(SockAddr::SockAddr const &target, unsigned int const ports, pid_t const pid,
+                     std::vector<unsigned long> const &plateaus, double const hold,
+                     unsigned int const slow_percent, size_t const size, soak_limits const &limits) {
+	std::vector<int> cons;
+	std::vector<bool> slow;
+	std::vector<char> buf(size, 'x');
+	unsigned long long failures = 0;
+	bool passed = true;
+
+	process_sample base = sample_process(pid);
+	printf("{\"workload\": \"soak\", \"slow_readers_percent\": %u, \"hold_s\": %.1f, "
+	       "\"base\": {\"rss_bytes\": %llu, \"fds\": %lu}, \"plateaus\": [",
+	       slow_percent, hold, base.rss, base.fds);
+
+	for( size_t p = 0; p < plateaus.size(); p++ ) {
+		process_sample before = sample_process(pid);
+		size_t start_count = cons.size();
+		double start = now();
+		while( cons.size() < plateaus[p] ) {
+			try {
+				unsigned int i = cons.size() + failures;
+				Socket s( open_connection(port_offset(target, i % ports), 'E') );
+				slow.push_back( cons.size() % 100 < slow_percent );
+				if( slow.back() ) {
+					// Fill whatever buffers there are on the way back
+					size_t sent = 0;
+					while( sent < size ) {
+						ssize_t rv = s.try_send(&buf[sent], size - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+						if( rv <= 0 ) break;
+						sent += rv;
+					}
+				}
+				cons.push_back( s.release() );
+			} catch( Errno &e ) {
+				failures++;
+				if( failures > plateaus[p] / 10 + 100 ) {
+					fprintf(stderr, "Too many failed connections, last: %s\n", e.what());
+					break;
+				}
+			}
+		}
+		double ramp = now() - start;
+		sleep_for(1); // Let the relaying settle
+		process_sample at = sample_process(pid);
+		sleep_for(hold);
+		process_sample after = sample_process(pid);
+
+		size_t n = cons.size();
+		size_t added = n - start_count;
+		double rss_per_flow = n ? (double)((long long)at.rss - (long long)base.rss) / n : 0;
+		double fds_per_flow = n ? (double)((long)at.fds - (long)base.fds) / n : 0;
+		double cpu_per_flow = added ? (at.cpu - before.cpu) * 1e6 / added : 0;
+		double idle_cpu = hold > 0 ? (after.cpu - at.cpu) / hold * 100 : 0;
+		bool ok = rss_per_flow <= limits.rss_per_flow && fds_per_flow <= limits.fds_per_flow
+		          && cpu_per_flow <= limits.cpu_per_flow;
+		passed = passed && ok && n == plateaus[p];
+
+		printf("%s{\"connections\": %zu, \"ramp_s\": %.2f, \"rss_bytes\": %llu, \"fds\": %lu, "
+		       "\"rss_per_flow\": %.0f, \"fds_per_flow\": %.2f, \"cpu_us_per_flow\": %.1f, "
+		       "\"idle_cpu_percent\": %.2f, \"within_limits\": %s}",
+		       p ? ", " : "", n, ramp, at.rss, at.fds,
+		       rss_per_flow, fds_per_flow, cpu_per_flow, idle_cpu, ok ? "true" : "false");
+		fflush(stdout);
+		if( n < plateaus[p] ) break;
+	}
+
+	// Check that the idle connections still work, on a sample of them
+	unsigned long checked = 0, alive = 0;
+	for( size_t i = 0; i < cons.size(); i += 97 ) {
+		if( slow[i] ) continue;
+		Socket s( cons[i] );
+		cons[i] = -1;
+		char c = 'x';
+		struct pollfd p;
+		p.fd = s;
+		p.events = POLLIN;
+		checked++;
+		if( send_all(s, &c, 1) && poll(&p, 1, 5000) == 1 && recv_all(s, &c, 1) ) alive++;
+	}
+	for( size_t i = 0; i < cons.size(); i++ ) {
+		if( cons[i] != -1 ) close(cons[i]);
+	}
+	passed = passed && alive == checked;
+
+	printf("], \"failures\": %llu, \"checked\": %lu, \"alive\": %lu, "
+	       "\"limits\": {\"rss_per_flow\": %.0f, \"fds_per_flow\": %.2f, \"cpu_us_per_flow\": %.1f}, "
+	       "\"passed\": %s}\n",
+	       failures, checked, alive,
+	       limits.rss_per_flow, limits.fds_per_flow, limits.cpu_per_flow, passed ? "true" : "false");
+	return passed;
+}
+
+int main(int argc, char* argv[]) {
+	unsigned int connections = 0;
+	std::vector<unsigned long> plateaus;
+	double duration = 10;
+	double hold = 10;
+	size_t size = 0;
+	unsigned int ports = 1;
+	pid_t pid = 0;
+	unsigned int slow_percent = 10;
+	soak_limits limits;
+	limits.rss_per_flow = 16 * 1024;
+	limits.fds_per_flow = 2.1;
+	limits.cpu_per_flow = 250;
+
+	enum {
+		OPT_MAX_RSS = 256,
+		OPT_MAX_FDS,
+		OPT_MAX_CPU,
+	};
+	char optstring[] = "hc:d:s:H:p:P:S:";
+	struct option longopts[] = {
+		{"help",			no_argument, NULL, 'h'},
+		{"connections",		required_argument, NULL, 'c'},
+		{"duration",		required_argument, NULL, 'd'},
+		{"size",			required_argument, NULL, 's'},
+		{"hold",			required_argument, NULL, 'H'},
+		{"ports",			required_argument, NULL, 'p'},
+		{"pid",				required_argument, NULL, 'P'},
+		{"slow-readers",	required_argument, NULL, 'S'},
+		{"max-rss-per-flow",	required_argument, NULL, OPT_MAX_RSS},
+		{"max-fds-per-flow",	required_argument, NULL, OPT_MAX_FDS},
+		{"max-cpu-per-flow",	required_argument, NULL, OPT_MAX_CPU},
+		{NULL, 0, 0, 0}
+	};
+	int opt;
+	while( (opt = getopt_long(argc, argv, optstring, longopts, NULL)) != -1 ) {
+		switch(opt) {
+		case 'c': {
+			// A comma separated list of plateaus for soak
+			char *p = optarg;
+			plateaus.clear();
+			do {
+				plateaus.push_back( strtoul(p, &p, 10) );
+			} while( *p++ == ',' );
+			connections = plateaus.back();
+			break;
+			}
+		case 'd': duration = strtod(optarg, NULL); break;
+		case 's': size = strtoul(optarg, NULL, 10); break;
+		case 'H': hold = strtod(optarg, NULL); break;
+		case 'p': ports = std::max(1ul, strtoul(optarg, NULL, 10)); break;
+		case 'P': pid = strtol(optarg, NULL, 10); break;
+		case 'S': slow_percent = std::min(100ul, strtoul(optarg, NULL, 10)); break;
+		case OPT_MAX_RSS: limits.rss_per_flow = strtod(optarg, NULL); break;
+		case OPT_MAX_FDS: limits.fds_per_flow = strtod(optarg, NULL); break;
+		case OPT_MAX_CPU: limits.cpu_per_flow = strtod(optarg, NULL); break;
+		case 'h':
+		case '?':
+			fprintf(stderr,
+				"Usage: bench-load server [-c threads] [-p ports] host:port\n"
+				"       bench-load cps|throughput|latency|idle [options] host:port\n"
+				"       bench-load soak -P pid [options] host:port\n"
+				"Options:\n"
+				"  -c --connections n              Parallel connections (idle: total)\n"
+				"                                  soak: comma separated plateaus\n"
+				"                                  (default 10000,100000,500000)\n"
+				"  -d --duration s                 How long to run (default 10)\n"
+				"  -s --size n                     Message size for latency, chunk size for\n"
+				"                                  throughput, bytes for slow readers\n"
+				"  -H --hold s                     How long idle connections stay idle\n"
+				"                                  (default 10)\n"
+				"  -p --ports n                    Use n consecutive ports, so more than\n"
+				"                                  64k connections fit (default 1)\n"
+				"  -P --pid pid                    The tcp-intercept process to measure\n"
+				"  -S --slow-readers pct           Percentage of soak connections that never\n"
+				"                                  read what they get (default 10)\n"
+				"  --max-rss-per-flow bytes        Soak limits, per connection (defaults\n"
+				"  --max-fds-per-flow n            16384 bytes, 2.1 fds, 250 us CPU to\n"
+				"  --max-cpu-per-flow us           set it up)\n"
+				);
+			exit(opt == 'h' ? EX_OK : EX_USAGE);
+		}
+	}
+	if( optind != argc - 2 ) {
+		fprintf(stderr, "Need a workload and an address, see --help\n");
+		exit(EX_USAGE);
+	}
+	std::string workload = argv[optind];
+	SockAddr::SockAddr target = parse_address(argv[optind+1]);
+	raise_fd_limit();
+
+	try {
+		if( workload == "server" ) {
+			run_server(target, connections ? connections : 4, ports);
+			return EX_OK;
+		} else if( workload == "idle" ) {
+			run_idle(target, connections ? connections : 1000, hold);
+			return EX_OK;
+		} else if( workload == "soak" ) {
+			if( pid == 0 ) {
+				fprintf(stderr, "soak needs the PID of tcp-intercept, see --help\n");
+				exit(EX_USAGE);
+			}
+			if( plateaus.empty() ) {
+				plateaus.push_back(10000);
+				plateaus.push_back(100000);
+				plateaus.push_back(500000);
+			}
+			if( size == 0 ) size = 65536;
+			return run_soak(target, ports, pid, plateaus, hold, slow_percent, size, limits) ? EX_OK : 1;
+		}
+
+		void *(*fn)(void*);
+		if( workload == "cps" ) {
+			fn = cps_thread;
+		} else if( workload == "throughput" ) {
+			fn = throughput_thread;
+			if( size == 0 ) size = 65536;
+		} else if( workload == "latency" ) {
+			fn = latency_thread;
+			if( size == 0 ) size = 64;
+		} else {
+			fprintf(stderr, "Unknown workload \"%s\"\n", workload.c_str());
+			exit(EX_USAGE);
+		}
+
+		std::vector<client_job> jobs( connections ? connections : 1 );
+		double start = now();
+		for( size_t i = 0; i < jobs.size(); i++ ) {
+			jobs[i].target = target;
+			jobs[i].deadline = start + duration;
+			jobs[i].size = size;
+			jobs[i].operations = jobs[i].failures = jobs[i].bytes = 0;
+			jobs[i].finished = 0;
+		}
+		run_threads(fn, jobs);
+		double elapsed = now() - start;
+
+		std::vector<double> latencies;
+		unsigned long long operations = 0, failures = 0, bytes = 0;
+		double finished = start;
+		for( size_t i = 0; i < jobs.size(); i++ ) {
+			latencies.insert(latencies.end(), jobs[i].latencies.begin(), jobs[i].latencies.end());
+			operations += jobs[i].operations;
+			failures += jobs[i].failures;
+			bytes += jobs[i].bytes;
+			finished = std::max(finished, jobs[i].finished);
+		}
+
+		printf("{\"workload\": \"%s\", \"connections\": %zu, \"duration_s\": %.3f, ",
+		       workload.c_str(), jobs.size(), elapsed);
+		if( workload == "throughput" ) {
+			double t = finished - start;
+			printf("\"bytes\": %llu, \"bits_per_s\": %.0f, \"failures\": %llu}\n",
+			       bytes, t > 0 ? bytes * 8 / t : 0., failures);
+		} else {
+			printf("\"operations\": %llu, \"operations_per_s\": %.1f, \"failures\": %llu, ",
+			       operations, operations / elapsed, failures);
+			if( workload == "latency" ) printf("\"size\": %zu, ", size);
+			print_percentiles(latencies);
+			printf("}\n");
+		}
+	} catch( Errno &e ) {
+		fprintf(stderr, "Error: %s\n", e.what());
+		exit(EX_OSERR);
+	}
+	return EX_OK;
+}
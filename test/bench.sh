@@ -0,0 +1,171 @@
+#!/bin/sh
+#
+# End-to-end benchmark: client --veth-- tcp-intercept --veth-- server
+#
+# Every party gets its own network namespace. The intercept namespace routes
+# between the other two, and has the TPROXY setup from the README, so the
+# client's connections to the server are intercepted exactly like in a real
+# deployment. Needs root, iproute2 and iptables (with the TPROXY and socket
+# matches).
+#
+# The soak workload ramps up to hundreds of thousands of connections, and
+# fails (exit status 1) if tcp-intercept needs more memory, file descriptors
+# or CPU time per connection than allowed. For that many connections, the
+# server listens on several ports, and fs.nr_open is raised if needed.
+#
+# Usage: bench.sh path/to/tcp-intercept path/to/bench-load
+# Tunables (environment):
+#   BENCH_DURATION      seconds per workload (default 10)
+#   BENCH_CPS_CONNECTIONS, BENCH_THROUGHPUT_CONNECTIONS,
+#   BENCH_LATENCY_CONNECTIONS, BENCH_LATENCY_SIZE
+#   BENCH_IDLE_CONNECTIONS, BENCH_IDLE_HOLD
+#   BENCH_WORKLOADS     which workloads to run (default "cps throughput latency
+#                       idle", soak is available as well)
+#   BENCH_ARGS          extra options for tcp-intercept (e.g. "-s -w 4")
+#   BENCH_OUTPUT        where to write the JSON results (default bench.json)
+#   BENCH_NOFILE        file descriptor limit (default 1100000)
+#   SOAK_PLATEAUS       connection counts to measure at (default
+#                       10000,100000,500000)
+#   SOAK_HOLD           seconds to stay at every plateau (default 10)
+#   SOAK_SLOW_READERS   percentage of connections that never read (default 10)
+#   SOAK_MAX_RSS, SOAK_MAX_FDS, SOAK_MAX_CPU
+#                       limits per connection: bytes of RSS, file descriptors
+#                       and microseconds of CPU time to set it up
+#                       (defaults: see bench-load --help)
+
+set -e
+
+TCP_INTERCEPT="$1"
+BENCH_LOAD="$2"
+if [ ! -x "$TCP_INTERCEPT" ] || [ ! -x "$BENCH_LOAD" ]; then
+	echo "Usage: $0 path/to/tcp-intercept path/to/bench-load" >&2
+	exit 64
+fi
+TCP_INTERCEPT=$(readlink -f "$TCP_INTERCEPT")
+BENCH_LOAD=$(readlink -f "$BENCH_LOAD")
+
+for tool in ip iptables; do
+	if ! command -v $tool >/dev/null 2>&1; then
+		echo "$0: $tool is needed to set up the benchmark" >&2
+		exit 69
+	fi
+done
+if [ "$(id -u)" != 0 ]; then
+	echo "$0: must be run as root to create network namespaces" >&2
+	exit 77
+fi
+
+DURATION=${BENCH_DURATION:-10}
+WORKLOADS=${BENCH_WORKLOADS:-"cps throughput latency idle"}
+OUTPUT=${BENCH_OUTPUT:-bench.json}
+NOFILE=${BENCH_NOFILE:-1100000}
+
+NS_CLIENT=ti-bench-client
+NS_INTERCEPT=ti-bench-intercept
+NS_SERVER=ti-bench-server
+SERVER_ADDR=10.200.2.2
+SERVER_PORT=6000
+SERVER_PORTS=16 # 4-tuples for 16 * 64k connections from one client address
+LISTEN_PORT=5000
+IP_ROUTE_TABLE_NUMBER=5
+FWMARK="0x01/0x01"
+
+PIDS=""
+cleanup() {
+	for pid in $PIDS; do kill $pid 2>/dev/null || true; done
+	wait 2>/dev/null || true
+	for ns in $NS_CLIENT $NS_INTERCEPT $NS_SERVER; do
+		ip netns del $ns 2>/dev/null || true
+	done
+}
+trap cleanup EXIT
+trap 'exit 130' INT TERM
+
+cleanup # leftovers from an earlier run
+
+if [ "$(cat /proc/sys/fs/nr_open)" -lt "$NOFILE" ]; then
+	sysctl -q -w fs.nr_open=$NOFILE || true
+fi
+if ! ulimit -n $NOFILE 2>/dev/null; then
+	echo "$0: could not raise the file descriptor limit to $NOFILE, keeping $(ulimit -n)" >&2
+fi
+
+for ns in $NS_CLIENT $NS_INTERCEPT $NS_SERVER; do
+	ip netns add $ns
+	ip -n $ns link set lo up
+done
+
+# client 10.200.1.2 <-> 10.200.1.1 intercept 10.200.2.1 <-> 10.200.2.2 server
+ip link add veth-client netns $NS_CLIENT type veth peer name veth-c netns $NS_INTERCEPT
+ip link add veth-server netns $NS_SERVER type veth peer name veth-s netns $NS_INTERCEPT
+ip -n $NS_CLIENT addr add 10.200.1.2/24 dev veth-client
+ip -n $NS_CLIENT link set veth-client up
+ip -n $NS_CLIENT route add default via 10.200.1.1
+ip -n $NS_INTERCEPT addr add 10.200.1.1/24 dev veth-c
+ip -n $NS_INTERCEPT addr add 10.200.2.1/24 dev veth-s
+ip -n $NS_INTERCEPT link set veth-c up
+ip -n $NS_INTERCEPT link set veth-s up
+ip -n $NS_SERVER addr add $SERVER_ADDR/24 dev veth-server
+ip -n $NS_SERVER link set veth-server up
+ip -n $NS_SERVER route add default via 10.200.2.1
+
+in_intercept() { ip netns exec $NS_INTERCEPT "$@"; }
+in_intercept sysctl -q -w net.ipv4.ip_forward=1
+in_intercept sysctl -q -w net.ipv4.conf.all.rp_filter=0
+ip netns exec $NS_CLIENT sysctl -q -w net.ipv4.ip_local_port_range="1024 65535"
+
+# The iptables setup from the README
+in_intercept ip rule add fwmark $FWMARK table $IP_ROUTE_TABLE_NUMBER
+in_intercept ip route add local 0.0.0.0/0 dev lo table $IP_ROUTE_TABLE_NUMBER
+in_intercept iptables -t mangle -N tproxy
+in_intercept iptables -t mangle -A tproxy -p tcp -m socket -j MARK --set-mark $FWMARK
+in_intercept iptables -t mangle -A tproxy -p tcp -m socket -j RETURN
+in_intercept iptables -t mangle -A tproxy -p tcp -m addrtype --dst-type LOCAL -j RETURN
+in_intercept iptables -t mangle -A tproxy -p tcp -j TPROXY \
+                   --on-port $LISTEN_PORT --tproxy-mark $FWMARK
+in_intercept iptables -t mangle -A PREROUTING -j tproxy
+
+ip netns exec $NS_SERVER "$BENCH_LOAD" server -p $SERVER_PORTS "[$SERVER_ADDR]:[$SERVER_PORT]" &
+PIDS="$PIDS $!"
+# Not through in_intercept: a function in the background runs in a subshell,
+# while ip netns exec execs, so this PID is tcp-intercept itself
+ip netns exec $NS_INTERCEPT "$TCP_INTERCEPT" -f -b "[0.0.0.0]:[$LISTEN_PORT]" --log-level warn $BENCH_ARGS \
+	2> "${OUTPUT%.json}-intercept.log" &
+INTERCEPT_PID=$!
+PIDS="$PIDS $INTERCEPT_PID"
+sleep 1
+
+run() {
+	ip netns exec $NS_CLIENT "$BENCH_LOAD" "$@" "[$SERVER_ADDR]:[$SERVER_PORT]"
+}
+
+{
+	printf '{"version": "%s", "args": "%s", "results": [\n' \
+		"$("$TCP_INTERCEPT" -V | head -n 1)" "$BENCH_ARGS"
+	SEP=""
+	for w in $WORKLOADS; do
+		printf '%s' "$SEP"
+		case $w in
+		cps)        run cps -d $DURATION -c ${BENCH_CPS_CONNECTIONS:-16} ;;
+		throughput) run throughput -d $DURATION -c ${BENCH_THROUGHPUT_CONNECTIONS:-4} ;;
+		latency)    run latency -d $DURATION -c ${BENCH_LATENCY_CONNECTIONS:-16} -s ${BENCH_LATENCY_SIZE:-64} ;;
+		idle)       run idle -c ${BENCH_IDLE_CONNECTIONS:-10000} -H ${BENCH_IDLE_HOLD:-$DURATION} ;;
+		soak)       run soak -P $INTERCEPT_PID -p $SERVER_PORTS \
+		                -c ${SOAK_PLATEAUS:-10000,100000,500000} -H ${SOAK_HOLD:-10} \
+		                -S ${SOAK_SLOW_READERS:-10} \
+		                ${SOAK_MAX_RSS:+--max-rss-per-flow $SOAK_MAX_RSS} \
+		                ${SOAK_MAX_FDS:+--max-fds-per-flow $SOAK_MAX_FDS} \
+		                ${SOAK_MAX_CPU:+--max-cpu-per-flow $SOAK_MAX_CPU} \
+		            || SOAK_FAILED=1 ;;
+		*)          echo "$0: unknown workload $w" >&2; exit 64 ;;
+		esac
+		SEP=","
+	done
+	printf ']}\n'
+} > "$OUTPUT"
+
+cat "$OUTPUT"
+if [ -n "$SOAK_FAILED" ]; then
+	echo "$0: tcp-intercept exceeded the soak limits, see $OUTPUT" >&2
+	exit 1
+fi
@@ -0,0 +1,24 @@
+#ifndef __CHECK_HXX__
+#define __CHECK_HXX__
+
+#include <stdio.h>
+
+/**
+ * Minimal assertions for the check programs: report the failed condition and
+ * keep going, main() returns check_result()
+ */
+static int check_failures = 0;
+
+#define CHECK(cond) do { \
+	if( !(cond) ) { \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		check_failures++; \
+	} \
+} while(0)
+
+static inline int check_result() {
+	if( check_failures ) fprintf(stderr, "%d checks failed\n", check_failures);
+	return check_failures ? 1 : 0;
+}
+
+#endif // __CHECK_HXX__
@@ -0,0 +1,242 @@
+#include <string>
+#include <vector>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "../src/Handoff.hxx"
+#include "check.hxx"
+
+/**
+ * Whether a and b are the same open file
+ */
+static bool same_file(int const a, int const b) {
+	struct stat sa, sb;
+	if( fstat(a, &sa) != 0 || fstat(b, &sb) != 0 ) return false;
+	return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+static void close_all(std::vector<int> const &fds) {
+	for( size_t i = 0; i < fds.size(); i++ ) close(fds[i]);
+}
+
+/**
+ * Write the raw bytes of r to fd, the first split bytes with fds attached
+ * and the rest separately, so the receiver gets the header in two pieces
+ */
+static void send_raw(int const fd, Handoff::Record const &r, size_t const split,
+                     int const *fds, unsigned int const nfds) {
+	struct iovec iov;
+	iov.iov_base = const_cast<Handoff::Record*>(&r);
+	iov.iov_len = split;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	std::vector<char> control( CMSG_SPACE(nfds * sizeof(int)) );
+	if( nfds > 0 ) {
+		msg.msg_control = &control[0];
+		msg.msg_controllen = control.size();
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+	CHECK( sendmsg(fd, &msg, 0) == (ssize_t)split );
+	if( split < sizeof(r) ) {
+		CHECK( write(fd, reinterpret_cast<char const*>(&r) + split, sizeof(r) - split)
+		       == (ssize_t)(sizeof(r) - split) );
+	}
+}
+
+static void test_connection(Handoff &a, Handoff &b) {
+	int p[2];
+	CHECK( pipe(p) == 0 );
+
+	Handoff::Record r;
+	memset(&r, 0, sizeof(r));
+	r.type = Handoff::CONNECTION;
+	r.flags = Handoff::C_TO_S_OPEN | Handoff::CONNECTED;
+	r.fds = 2;
+	r.sent_offset_s_to_c = 1ULL << 40;
+	std::string c_to_s("hello");
+	std::string s_to_c(60000, 'x');
+	for( size_t i = 0; i < s_to_c.size(); i++ ) s_to_c[i] = 'a' + i % 26;
+	r.len_c_to_s = c_to_s.size();
+	r.len_s_to_c = s_to_c.size();
+	struct iovec iov[2];
+	iov[0].iov_base = &c_to_s[0];
+	iov[0].iov_len = c_to_s.size();
+	iov[1].iov_base = &s_to_c[0];
+	iov[1].iov_len = s_to_c.size();
+	a.send(r, p, iov, 2);
+
+	Handoff::Record got;
+	std::vector<int> fds;
+	std::string got_c_to_s, got_s_to_c;
+	CHECK( b.receive(got, fds, got_c_to_s, got_s_to_c) );
+	CHECK( got.type == Handoff::CONNECTION );
+	CHECK( got.flags == (Handoff::C_TO_S_OPEN | Handoff::CONNECTED) );
+	CHECK( got.sent_offset_s_to_c == 1ULL << 40 );
+	CHECK( got_c_to_s == c_to_s );
+	CHECK( got_s_to_c == s_to_c );
+	CHECK( fds.size() == 2 );
+	if( fds.size() == 2 ) {
+		CHECK( same_file(fds[0], p[0]) );
+		CHECK( same_file(fds[1], p[1]) );
+		CHECK( fcntl(fds[0], F_GETFD) & FD_CLOEXEC );
+		// and they work
+		CHECK( write(fds[1], "!", 1) == 1 );
+		char c = 0;
+		CHECK( read(p[0], &c, 1) == 1 && c == '!' );
+	}
+	close_all(fds);
+	close(p[0]);
+	close(p[1]);
+
+	// Without fds or payload
+	a.send(Handoff::READY);
+	CHECK( b.receive(got, fds, got_c_to_s, got_s_to_c) );
+	CHECK( got.type == Handoff::READY );
+	CHECK( fds.empty() && got_c_to_s.empty() && got_s_to_c.empty() );
+}
+
+static void test_split_header(int const raw, Handoff &b) {
+	int p[2];
+	CHECK( pipe(p) == 0 );
+	Handoff::Record r;
+	memset(&r, 0, sizeof(r));
+	r.magic = Handoff::MAGIC;
+	r.type = Handoff::CONNECTION;
+	r.fds = 1;
+	r.len_c_to_s = 3;
+	send_raw(raw, r, 10, &p[0], 1);
+	CHECK( write(raw, "abc", 3) == 3 );
+
+	Handoff::Record got;
+	std::vector<int> fds;
+	std::string c_to_s, s_to_c;
+	CHECK( b.receive(got, fds, c_to_s, s_to_c) );
+	CHECK( got.type == Handoff::CONNECTION );
+	CHECK( c_to_s == "abc" );
+	CHECK( fds.size() == 1 && same_file(fds[0], p[0]) );
+	close_all(fds);
+	close(p[0]);
+	close(p[1]);
+}
+
+static void check_fails(Handoff &b, int const error) {
+	Handoff::Record got;
+	std::vector<int> fds;
+	std::string c_to_s, s_to_c;
+	int e = 0;
+	try {
+		b.receive(got, fds, c_to_s, s_to_c);
+	} catch( Errno &ex ) {
+		e = ex.error_number();
+	}
+	CHECK( e == error );
+	close_all(fds);
+}
+
+static void test_bad_records(int const raw, Handoff &a, Handoff &b) {
+	Handoff::Record r;
+	memset(&r, 0, sizeof(r));
+	r.magic = Handoff::MAGIC ^ 1;
+	r.type = Handoff::END;
+	send_raw(raw, r, sizeof(r), NULL, 0);
+	check_fails(b, EPROTO);
+
+	// Fewer fds than the header says
+	int p[2];
+	CHECK( pipe(p) == 0 );
+	memset(&r, 0, sizeof(r));
+	r.magic = Handoff::MAGIC;
+	r.type = Handoff::CONNECTION;
+	r.fds = 2;
+	send_raw(raw, r, sizeof(r), &p[0], 1);
+	check_fails(b, EPROTO);
+
+	memset(&r, 0, sizeof(r));
+	r.type = Handoff::LISTENERS;
+	r.fds = Handoff::MAX_FDS + 1;
+	int e = 0;
+	try {
+		a.send(r, NULL, NULL, 0);
+	} catch( Errno &ex ) {
+		e = ex.error_number();
+	}
+	CHECK( e == EINVAL );
+	close(p[0]);
+	close(p[1]);
+}
+
+/**
+ * More listening sockets than fit in one record, with and without the maps
+ */
+static void test_listeners(Handoff &a, Handoff &b, size_t const count, bool const with_maps) {
+	int p[2];
+	CHECK( pipe(p) == 0 );
+	std::vector<int> listeners;
+	for( size_t i = 0; i < count; i++ ) {
+		// Alternate, so the order can be checked
+		listeners.push_back( dup(p[i % 3 == 0 ? 0 : 1]) );
+	}
+	int maps[2] = { p[1], p[0] };
+	a.send_listeners(listeners, with_maps ? maps : NULL);
+
+	std::vector<int> got;
+	int got_maps[2];
+	b.receive_listeners(got, got_maps);
+	CHECK( got.size() == count );
+	bool in_order = got.size() == count;
+	for( size_t i = 0; in_order && i < count; i++ ) {
+		in_order = same_file(got[i], listeners[i]);
+	}
+	CHECK( in_order );
+	if( with_maps ) {
+		CHECK( same_file(got_maps[0], p[1]) );
+		CHECK( same_file(got_maps[1], p[0]) );
+		close(got_maps[0]);
+		close(got_maps[1]);
+	} else {
+		CHECK( got_maps[0] == -1 && got_maps[1] == -1 );
+	}
+	close_all(got);
+	close_all(listeners);
+	close(p[0]);
+	close(p[1]);
+}
+
+int main() {
+	int sv[2];
+	if( socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0 ) {
+		perror("socketpair");
+		return 1;
+	}
+	int raw = dup(sv[0]); // to write malformed records
+	Handoff a(sv[0]), b(sv[1]);
+	b.set_timeout(5); // don't hang if something goes missing
+
+	test_connection(a, b);
+	test_split_header(raw, b);
+	test_bad_records(raw, a, b);
+	test_listeners(a, b, 3, false);
+	test_listeners(a, b, Handoff::MAX_FDS - 2, true);  // just fits with the maps
+	test_listeners(a, b, Handoff::MAX_FDS - 1, true);  // the maps go in a second record
+	test_listeners(a, b, 2 * Handoff::MAX_FDS + 7, true);
+	test_listeners(a, b, 2 * (Handoff::MAX_FDS - 2), false);
+
+	// Nothing but an END left over?
+	a.send(Handoff::END);
+	Handoff::Record r;
+	std::vector<int> fds;
+	std::string c_to_s, s_to_c;
+	CHECK( b.receive(r, fds, c_to_s, s_to_c) && r.type == Handoff::END );
+
+	close(raw);
+	return check_result();
+}
@@ -0,0 +1,199 @@
+#include <string.h>
+
+#include "../src/RingBuffer.hxx"
+#include "../src/BufferPool.hxx"
+#include "check.hxx"
+
+/**
+ * Append len bytes counting up from *next, through space_iov()/commit()
+ */
+static void fill(RingBuffer &rb, size_t len, unsigned char *next) {
+	struct iovec iov[2];
+	int n = rb.space_iov(iov);
+	size_t done = 0;
+	for( int i = 0; i < n && done < len; i++ ) {
+		unsigned char *p = static_cast<unsigned char*>(iov[i].iov_base);
+		for( size_t j = 0; j < iov[i].iov_len && done < len; j++, done++ ) {
+			p[j] = (*next)++;
+		}
+	}
+	CHECK( done == len );
+	rb.commit(done);
+}
+
+/**
+ * Consume len bytes through data_iov()/consume(), check they count up from
+ * *expect
+ */
+static void drain(RingBuffer &rb, size_t len, unsigned char *expect) {
+	struct iovec iov[2];
+	int n = rb.data_iov(iov);
+	size_t done = 0;
+	bool in_order = true;
+	for( int i = 0; i < n && done < len; i++ ) {
+		unsigned char *p = static_cast<unsigned char*>(iov[i].iov_base);
+		for( size_t j = 0; j < iov[i].iov_len && done < len; j++, done++ ) {
+			if( p[j] != (*expect)++ ) in_order = false;
+		}
+	}
+	CHECK( done == len );
+	CHECK( in_order );
+	rb.consume(done);
+}
+
+static size_t iov_total(struct iovec const *iov, int n) {
+	size_t total = 0;
+	for( int i = 0; i < n; i++ ) total += iov[i].iov_len;
+	return total;
+}
+
+static void test_edges() {
+	char mem[16];
+	RingBuffer rb;
+	CHECK( ! rb.attached() );
+	CHECK( ! rb.full() );
+	rb.attach(mem, sizeof(mem));
+	CHECK( rb.attached() );
+	CHECK( rb.empty() );
+	CHECK( ! rb.full() );
+	CHECK( rb.space() == 16 );
+
+	struct iovec iov[2];
+	CHECK( rb.data_iov(iov) == 0 );
+	CHECK( rb.space_iov(iov) == 1 );
+	CHECK( iov[0].iov_base == mem && iov[0].iov_len == 16 );
+
+	unsigned char next = 0, expect = 0;
+	fill(rb, 16, &next);
+	CHECK( rb.full() );
+	CHECK( ! rb.empty() );
+	CHECK( rb.space_iov(iov) == 0 );
+	CHECK( rb.data_iov(iov) == 1 );
+	CHECK( iov[0].iov_len == 16 );
+
+	drain(rb, 16, &expect);
+	CHECK( rb.empty() );
+	// Running empty starts over at the beginning
+	CHECK( rb.space_iov(iov) == 1 );
+	CHECK( iov[0].iov_base == mem && iov[0].iov_len == 16 );
+
+	CHECK( rb.detach() == mem );
+	CHECK( ! rb.attached() );
+}
+
+static void test_wraparound() {
+	char mem[16];
+	RingBuffer rb;
+	rb.attach(mem, sizeof(mem));
+	unsigned char next = 0, expect = 0;
+	struct iovec iov[2];
+
+	fill(rb, 10, &next);
+	drain(rb, 6, &expect);
+	// Data at [6,10), free space at [10,16) and [0,6)
+	CHECK( rb.space_iov(iov) == 2 );
+	CHECK( iov[0].iov_base == mem + 10 && iov[0].iov_len == 6 );
+	CHECK( iov[1].iov_base == mem && iov[1].iov_len == 6 );
+
+	// Refill across the end
+	fill(rb, 9, &next);
+	CHECK( rb.length() == 13 );
+	CHECK( rb.data_iov(iov) == 2 );
+	CHECK( iov[0].iov_base == mem + 6 && iov[0].iov_len == 10 );
+	CHECK( iov[1].iov_base == mem && iov[1].iov_len == 3 );
+	// Data wraps, so the free space is one piece in the middle
+	CHECK( rb.space_iov(iov) == 1 );
+	CHECK( iov[0].iov_base == mem + 3 && iov[0].iov_len == 3 );
+
+	fill(rb, 3, &next);
+	CHECK( rb.full() );
+	CHECK( rb.space_iov(iov) == 0 );
+	CHECK( rb.data_iov(iov) == 2 );
+	CHECK( iov_total(iov, 2) == 16 );
+
+	// Consume across the end, in uneven steps
+	drain(rb, 7, &expect);
+	drain(rb, 5, &expect);
+	CHECK( rb.length() == 4 );
+	CHECK( rb.data_iov(iov) == 1 );
+	CHECK( iov[0].iov_base == mem + 2 );
+
+	// Keep going round; the bytes must come out in order every time
+	for( int round = 0; round < 50; round++ ) {
+		size_t in = 1 + (round * 7) % rb.space();
+		fill(rb, in, &next);
+		CHECK( rb.data_iov(iov) >= 1 );
+		CHECK( iov_total(iov, rb.data_iov(iov)) == rb.length() );
+		CHECK( rb.space_iov(iov) <= 2 );
+		CHECK( iov_total(iov, rb.space_iov(iov)) == rb.space() );
+		size_t out = 1 + (round * 5) % rb.length();
+		drain(rb, out, &expect);
+	}
+	drain(rb, rb.length(), &expect);
+	CHECK( rb.empty() );
+	CHECK( next == expect );
+}
+
+static void test_budget() {
+	MemoryBudget budget(1000);
+	CHECK( budget.reserve(600) );
+	CHECK( ! budget.reserve(500) );
+	CHECK( budget.used() == 600 );
+	CHECK( budget.reserve(400) );
+	CHECK( budget.used() == 1000 );
+	budget.release(1000);
+	CHECK( budget.used() == 0 );
+
+	MemoryBudget unlimited;
+	CHECK( unlimited.reserve(1UL << 40) );
+	unlimited.release(1UL << 40);
+}
+
+static void test_pool() {
+	MemoryBudget budget(300);
+	{
+		BufferPool pool(budget, 100, 1);
+		char *a = pool.get();
+		char *b = pool.get();
+		char *c = pool.get();
+		CHECK( a != NULL && b != NULL && c != NULL );
+		CHECK( budget.used() == 300 );
+		CHECK( pool.get() == NULL ); // over budget
+		CHECK( budget.used() == 300 );
+
+		// One buffer is kept for reuse, and stays charged
+		pool.put(a, 100);
+		pool.put(b, 100);
+		CHECK( budget.used() == 200 );
+		CHECK( pool.get() == a );
+		CHECK( budget.used() == 200 );
+
+		pool.put(c, 100);
+		CHECK( budget.used() == 200 );
+		CHECK( pool.get(250) == NULL ); // over budget
+		pool.put(a, 100); // the free list is full
+		CHECK( budget.used() == 100 );
+
+		// Odd-sized buffers are never pooled
+		char *big = pool.get(150);
+		CHECK( big != NULL );
+		CHECK( budget.used() == 250 );
+		pool.put(big, 150);
+		CHECK( budget.used() == 100 );
+		CHECK( pool.get() == c );
+		pool.put(c, 100);
+
+		pool.put(NULL, 100);
+		CHECK( budget.used() == 100 );
+	}
+	// The pool gave back what it kept
+	CHECK( budget.used() == 0 );
+}
+
+int main() {
+	test_edges();
+	test_wraparound();
+	test_budget();
+	test_pool();
+	return check_result();
+}
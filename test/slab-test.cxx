@@ -0,0 +1,116 @@
+#include <stdexcept>
+
+#include "../src/Slab.hxx"
+#include "check.hxx"
+
+struct Obj {
+	static bool fail;
+	static int live;
+	int value;
+
+	Obj() : value(42) {
+		if( fail ) throw std::runtime_error("constructor failed");
+		live++;
+	}
+	~Obj() { live--; }
+};
+bool Obj::fail = false;
+int Obj::live = 0;
+
+typedef Slab<Obj, 4> ObjSlab;
+
+static void test_reuse() {
+	ObjSlab slab;
+	Obj *a = slab.alloc();
+	CHECK( a->value == 42 );
+	CHECK( slab.in_use() == 1 );
+	CHECK( slab.chunks() == 1 );
+
+	slab.free(a);
+	CHECK( slab.in_use() == 0 );
+	CHECK( Obj::live == 0 );
+
+	// The freed slot comes back, and the free list survived the constructor
+	Obj *b = slab.alloc();
+	CHECK( b == a );
+	Obj *c = slab.alloc();
+	CHECK( c != b );
+	CHECK( slab.in_use() == 2 );
+	CHECK( slab.chunks() == 1 );
+
+	slab.free(b);
+	slab.free(c);
+}
+
+static void test_fill() {
+	ObjSlab slab;
+	Obj *objs[8];
+	for( int i = 0; i < 4; i++ ) objs[i] = slab.alloc();
+	CHECK( slab.chunks() == 1 );
+	for( int i = 4; i < 8; i++ ) objs[i] = slab.alloc();
+	CHECK( slab.chunks() == 2 );
+	CHECK( slab.in_use() == 8 );
+
+	// Free and allocate everything again: no new chunk
+	for( int i = 0; i < 8; i++ ) slab.free(objs[i]);
+	CHECK( slab.in_use() == 0 );
+	for( int round = 0; round < 3; round++ ) {
+		for( int i = 0; i < 8; i++ ) objs[i] = slab.alloc();
+		for( int i = 0; i < 8; i++ ) slab.free(objs[i]);
+	}
+	CHECK( slab.chunks() == 2 );
+	CHECK( Obj::live == 0 );
+}
+
+static void test_throwing_constructor() {
+	ObjSlab slab;
+	Obj *a = slab.alloc();
+	Obj *b = slab.alloc();
+	slab.free(b);
+
+	Obj::fail = true;
+	bool thrown = false;
+	try {
+		slab.alloc();
+	} catch( std::runtime_error const & ) {
+		thrown = true;
+	}
+	Obj::fail = false;
+	CHECK( thrown );
+	CHECK( slab.in_use() == 1 );
+
+	// The slot went back on the free list
+	Obj *c = slab.alloc();
+	CHECK( c == b );
+	CHECK( slab.in_use() == 2 );
+	CHECK( slab.chunks() == 1 );
+
+	slab.free(a);
+	slab.free(c);
+	CHECK( Obj::live == 0 );
+}
+
+static void test_ptr() {
+	ObjSlab slab;
+	Obj *raw;
+	{
+		ObjSlab::Ptr p(slab);
+		raw = p.get();
+		CHECK( slab.in_use() == 1 );
+	}
+	CHECK( slab.in_use() == 0 );
+	{
+		ObjSlab::Ptr p(slab);
+		CHECK( p.get() == raw );
+		slab.free(p.release());
+	}
+	CHECK( slab.in_use() == 0 );
+}
+
+int main() {
+	test_reuse();
+	test_fill();
+	test_throwing_constructor();
+	test_ptr();
+	return check_result();
+}
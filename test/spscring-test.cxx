@@ -0,0 +1,90 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include "../src/SpscRing.hxx"
+#include "check.hxx"
+
+struct Item {
+	unsigned long seq;
+	unsigned long check; // ~seq, to catch a half-written item
+};
+
+static unsigned long const COUNT = 2000000;
+
+static void* producer(void *arg) {
+	SpscRing<Item> *ring = reinterpret_cast<SpscRing<Item>*>(arg);
+	for( unsigned long i = 0; i < COUNT; i++ ) {
+		// Let the consumer run now and then (even on one CPU); it still
+		// falls behind at times, and some items are dropped
+		if( i % 300 == 0 ) sched_yield();
+		Item *it = ring->reserve();
+		if( it == NULL ) continue; // dropped, and counted
+		it->seq = i;
+		it->check = ~i;
+		ring->publish();
+	}
+	return NULL;
+}
+
+static void test_single_thread() {
+	SpscRing<Item> ring(4);
+	CHECK( ring.front() == NULL );
+	for( unsigned long i = 0; i < 4; i++ ) {
+		Item it = { i, ~i };
+		CHECK( ring.push(it) );
+	}
+	Item extra = { 99, ~99UL };
+	CHECK( ! ring.push(extra) );
+	CHECK( ! ring.push(extra) );
+	CHECK( ring.dropped() == 2 );
+	CHECK( ring.dropped() == 0 ); // reported once
+
+	CHECK( ring.front() != NULL && ring.front()->seq == 0 );
+	ring.pop();
+	CHECK( ring.push(extra) ); // room again
+	for( unsigned long i = 1; i < 4; i++ ) {
+		CHECK( ring.front() != NULL && ring.front()->seq == i );
+		ring.pop();
+	}
+	CHECK( ring.front() != NULL && ring.front()->seq == 99 );
+	ring.pop();
+	CHECK( ring.front() == NULL );
+}
+
+/**
+ * Everything that wasn't dropped arrives, whole and in order
+ */
+static void test_threads() {
+	SpscRing<Item> ring(256);
+	pthread_t t;
+	CHECK( pthread_create(&t, NULL, producer, &ring) == 0 );
+
+	unsigned long received = 0, dropped = 0;
+	unsigned long last = 0;
+	bool in_order = true, whole = true;
+	while( received + dropped < COUNT ) {
+		Item const *it = ring.front();
+		if( it == NULL ) {
+			dropped += ring.dropped();
+			sched_yield();
+			continue;
+		}
+		if( received > 0 && it->seq <= last ) in_order = false;
+		if( it->check != ~it->seq ) whole = false;
+		last = it->seq;
+		received++;
+		ring.pop();
+	}
+	pthread_join(t, NULL);
+	dropped += ring.dropped();
+	CHECK( in_order );
+	CHECK( whole );
+	CHECK( received + dropped == COUNT );
+	CHECK( ring.front() == NULL );
+}
+
+int main() {
+	test_single_thread();
+	test_threads();
+	return check_result();
+}
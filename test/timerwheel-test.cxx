@@ -0,0 +1,185 @@
+#include <vector>
+#include <stdint.h>
+
+#include "../src/TimerWheel.hxx"
+#include "check.hxx"
+
+static uint64_t const MAX_DELTA = (uint64_t)1 << (TimerWheel::SLOT_BITS * TimerWheel::LEVELS);
+
+struct Entry {
+	TimerWheel::Timer timer;
+	uint64_t deadline;  // when it should fire, after any shortening
+	uint64_t fired_at;  // the tick advance() went to when it fired
+	unsigned int fired;
+	bool cancelled;
+
+	Entry() : deadline(0), fired_at(0), fired(0), cancelled(false) { timer.data = this; }
+	// std::vector copies them into place, data must follow
+	Entry(Entry const &) : deadline(0), fired_at(0), fired(0), cancelled(false) { timer.data = this; }
+};
+
+/**
+ * Schedule e at expires, and work out when it should fire
+ */
+static void schedule(TimerWheel &w, Entry &e, uint64_t const expires) {
+	uint64_t deadline = expires > w.now() ? expires : w.now() + 1;
+	if( deadline - w.now() >= MAX_DELTA ) deadline = w.now() + MAX_DELTA - 1;
+	e.deadline = deadline;
+	e.cancelled = false;
+	w.schedule(&e.timer, expires);
+	CHECK( e.timer.scheduled() );
+}
+
+/**
+ * Advance to now, and check that what fired was due, and not due before
+ * the previous tick
+ */
+static void advance(TimerWheel &w, uint64_t const now) {
+	uint64_t const prev = w.now();
+	std::vector<TimerWheel::Timer*> expired;
+	w.advance(now, expired);
+	CHECK( w.now() == now );
+	for( size_t i = 0; i < expired.size(); i++ ) {
+		Entry *e = reinterpret_cast<Entry*>( expired[i]->data );
+		CHECK( ! expired[i]->scheduled() );
+		CHECK( ! e->cancelled );
+		CHECK( e->deadline <= now );  // never early
+		CHECK( e->deadline > prev );  // and not a step late
+		e->fired++;
+		e->fired_at = now;
+	}
+}
+
+/**
+ * The offsets that sit on the edges between the levels
+ */
+static std::vector<uint64_t> edge_offsets() {
+	std::vector<uint64_t> o;
+	for( unsigned int l = 0; l <= TimerWheel::LEVELS; l++ ) {
+		uint64_t edge = (uint64_t)1 << (TimerWheel::SLOT_BITS * l);
+		if( edge > 1 ) o.push_back(edge - 1);
+		o.push_back(edge);
+		o.push_back(edge + 1);
+	}
+	o.push_back(MAX_DELTA * 3); // beyond the top level
+	return o;
+}
+
+/**
+ * Timers on every level edge, from a start that isn't aligned to any slot,
+ * advanced in uneven steps and then tick by tick
+ */
+static void test_levels(uint64_t const start) {
+	TimerWheel w(start);
+	std::vector<uint64_t> offsets = edge_offsets();
+	std::vector<Entry> entries(offsets.size() * 2);
+	for( size_t i = 0; i < offsets.size(); i++ ) {
+		schedule(w, entries[2*i], start + offsets[i]);
+		// and one more, a bit off the edge
+		schedule(w, entries[2*i+1], start + offsets[i] + 37);
+	}
+	CHECK( w.size() == entries.size() );
+
+	static uint64_t const steps[] = { 1, 7, 63, 64, 65, 1000, 4095, 4097, 100000, 262145 };
+	unsigned int s = 0;
+	while( w.now() < start + MAX_DELTA + 100 ) {
+		uint64_t step = steps[s++ % (sizeof(steps) / sizeof(*steps))];
+		advance(w, w.now() + step);
+	}
+	for( size_t i = 0; i < entries.size(); i++ ) CHECK( entries[i].fired == 1 );
+	CHECK( w.empty() );
+}
+
+/**
+ * Every tick on its own: each timer must fire on exactly its deadline
+ */
+static void test_exact() {
+	TimerWheel w(5000);
+	std::vector<Entry> entries(300);
+	uint64_t seed = 12345;
+	for( size_t i = 0; i < entries.size() - 1; i++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		schedule(w, entries[i], w.now() + (seed >> 33) % 20000);
+	}
+	// Beyond the top level: shortened to the furthest tick the wheel holds
+	schedule(w, entries.back(), w.now() + MAX_DELTA * 2);
+	CHECK( entries.back().deadline == w.now() + MAX_DELTA - 1 );
+	while( ! w.empty() ) advance(w, w.now() + 1);
+	for( size_t i = 0; i < entries.size(); i++ ) {
+		CHECK( entries[i].fired == 1 );
+		CHECK( entries[i].fired_at == entries[i].deadline );
+	}
+}
+
+/**
+ * Cancelled timers never fire, rescheduled ones only at their new deadline
+ */
+static void test_cancel_rearm() {
+	TimerWheel w(777);
+	std::vector<Entry> entries(200);
+	for( size_t i = 0; i < entries.size(); i++ ) {
+		schedule(w, entries[i], w.now() + 10 + i * 53);
+	}
+	// Cancel some before anything cascades, move others further away
+	for( size_t i = 0; i < entries.size(); i += 5 ) {
+		w.cancel(&entries[i].timer);
+		entries[i].cancelled = true;
+		CHECK( ! entries[i].timer.scheduled() );
+	}
+	w.cancel(&entries[0].timer); // twice is harmless
+	for( size_t i = 1; i < entries.size(); i += 5 ) {
+		schedule(w, entries[i], w.now() + 20000 + i);
+	}
+	CHECK( w.size() == entries.size() - entries.size() / 5 );
+
+	// Half way, cancel and rearm some that went down a level or two
+	advance(w, w.now() + 3000);
+	for( size_t i = 2; i < entries.size(); i += 5 ) {
+		if( entries[i].fired ) continue;
+		w.cancel(&entries[i].timer);
+		entries[i].cancelled = true;
+	}
+	for( size_t i = 3; i < entries.size(); i += 5 ) {
+		if( entries[i].fired ) continue;
+		schedule(w, entries[i], w.now() + 5); // earlier than before
+	}
+	// A deadline in the past fires on the next tick
+	schedule(w, entries[4], 0);
+	CHECK( entries[4].deadline == w.now() + 1 );
+
+	while( ! w.empty() ) advance(w, w.now() + 11);
+	for( size_t i = 0; i < entries.size(); i++ ) {
+		if( entries[i].cancelled ) {
+			CHECK( entries[i].fired == 0 );
+		} else {
+			CHECK( entries[i].fired >= 1 );
+		}
+	}
+	// entry 4 fired both before and after it was rearmed, once each time
+	CHECK( entries[4].fired <= 2 );
+	for( size_t i = 5; i < entries.size(); i++ ) {
+		if( i % 5 != 4 ) CHECK( entries[i].fired <= 1 );
+	}
+}
+
+/**
+ * A timer can be scheduled again right after it fired
+ */
+static void test_reschedule_after_fire() {
+	TimerWheel w;
+	Entry e;
+	for( unsigned int round = 0; round < 5; round++ ) {
+		schedule(w, e, w.now() + 100 + round * 1000);
+		while( ! w.empty() ) advance(w, w.now() + 3);
+		CHECK( e.fired == round + 1 );
+	}
+}
+
+int main() {
+	test_levels(0);
+	test_levels(1234567);
+	test_exact();
+	test_cancel_rearm();
+	test_reschedule_after_fire();
+	return check_result();
+}
@@ -0,0 +1,114 @@
+#include <stdint.h>
+
+#include "../src/TokenBucket.hxx"
+#include "check.hxx"
+
+static const uint64_t NS = 1000000000;
+static const uint64_t T0 = 1000 * NS; // some time after the clock started
+
+static void test_unlimited() {
+	TokenBucket b;
+	CHECK( ! b.limited() );
+	CHECK( b.available(T0, 12345) == 12345 );
+	b.consume(T0, 1 << 30);
+	CHECK( b.available(T0, 12345) == 12345 );
+	CHECK( b.wait(T0, 1 << 30) == 0 );
+
+	b.set_rate(1000, 100);
+	b.set_rate(0, 100);
+	CHECK( ! b.limited() );
+	CHECK( b.available(T0, 777) == 777 );
+}
+
+static void test_burst(uint64_t const rate, uint64_t const burst) {
+	TokenBucket b;
+	b.set_rate(rate, burst);
+	CHECK( b.limited() );
+	CHECK( b.rate() == rate );
+
+	// A full bucket holds exactly burst bytes, however long it sat idle
+	CHECK( b.available(T0, 1 << 30) == burst );
+	CHECK( b.available(T0 + 3600 * NS, 1 << 30) == burst );
+	CHECK( b.available(T0, burst / 2) == burst / 2 ); // capped at max
+
+	b.consume(T0, burst);
+	CHECK( b.available(T0, 1 << 30) == 0 );
+	CHECK( b.wait(T0, 0) == 0 );
+
+	// It refills at rate
+	uint64_t const n = burst < rate ? burst : rate;
+	uint64_t const d = n * NS / rate; // how long n bytes take
+	uint64_t w = b.wait(T0, n);
+	CHECK( w >= d && w <= d + 1 );
+	CHECK( b.available(T0 + w, 1 << 30) >= n );
+	CHECK( b.available(T0 + w - 2, 1 << 30) < n );
+
+	// Going into debt delays available() until it is paid back
+	b.consume(T0, 2 * n);
+	CHECK( b.available(T0 + d, 1 << 30) == 0 );
+	CHECK( b.available(T0 + 2 * d - d / 100, 1 << 30) == 0 );
+	CHECK( b.available(T0 + 3 * d + 1, 1 << 30) >= n );
+	CHECK( b.wait(T0, 1) > 2 * d );
+}
+
+/**
+ * wait() says how long until len bytes are available, not a bit more
+ */
+static void test_wait(uint64_t const rate, uint64_t const burst) {
+	TokenBucket b;
+	b.set_rate(rate, burst);
+	b.consume(T0, burst);
+	uint64_t now = T0;
+	static size_t const lens[] = { 1, 2, 3, 7, 100, 999 };
+	for( unsigned int i = 0; i < sizeof(lens) / sizeof(*lens); i++ ) {
+		size_t len = lens[i];
+		if( len > burst ) continue; // never all available at once
+		uint64_t w = b.wait(now, len);
+		CHECK( w > 0 );
+		CHECK( b.available(now + w, 1 << 30) >= len );
+		CHECK( b.available(now + w - 1, 1 << 30) < len );
+		CHECK( b.wait(now + w, len) == 0 );
+		now += w;
+		b.consume(now, len);
+		CHECK( b.available(now, 1 << 30) == 0 );
+	}
+	// Nothing is ever available beyond burst
+	CHECK( b.available(now + 3600 * NS, 1 << 30) == burst );
+}
+
+/**
+ * Over a long run, consuming what is available relays rate bytes a second
+ */
+static void test_average(uint64_t const rate, uint64_t const burst) {
+	TokenBucket b;
+	b.set_rate(rate, burst);
+	uint64_t total = 0;
+	uint64_t const step = NS / 1000;
+	uint64_t now = T0;
+	for( unsigned int i = 0; i < 100000; i++ ) {
+		size_t n = b.available(now, 1 << 30);
+		b.consume(now, n);
+		total += n;
+		now += step;
+	}
+	// 100 seconds, and the initial burst
+	uint64_t expect = 100 * rate + burst;
+	CHECK( total <= expect );
+	CHECK( total + rate / 100 + 1 >= expect );
+}
+
+int main() {
+	test_unlimited();
+	test_burst(1000, 1000);
+	test_burst(3, 10);
+	test_burst(1 << 20, 64 << 10);
+	test_burst(125000000, 1 << 20); // 1 Gbit/s
+	test_wait(1000, 1000);
+	test_wait(3, 10);
+	test_wait(7, 1000);
+	test_wait(1 << 20, 64 << 10);
+	test_average(1000, 100);
+	test_average(12345, 4096);
+	test_average(1 << 20, 64 << 10);
+	return check_result();
+}